@@ -1,10 +1,19 @@
 #version 330 core
 in vec2 f_texCoords;
-layout(location = 0) out uvec4 color;
+layout(location = 0) out vec4 color;
 
-uniform usampler2D glSpriteTexture;
+uniform sampler2D glSpriteTexture;
+// one row of 256 colors per palette
+uniform sampler2D glPaletteTexture;
+// palette of the 8-bit sprite texture, -1 for RGBA sprite textures
+uniform int paletteRow;
 
 void main()
 {    
-    color = texture(glSpriteTexture, f_texCoords);
-}  
+    if (paletteRow < 0) {
+        color = texture(glSpriteTexture, f_texCoords);
+        return;
+    }
+    int colorIndex = int(texture(glSpriteTexture, f_texCoords).r * 255.0 + 0.5);
+    color = texelFetch(glPaletteTexture, ivec2(colorIndex, paletteRow), 0);
+}
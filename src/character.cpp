@@ -22,12 +22,15 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 #include <array>
 #include <string>
 #include <ios>
+#include <stdexcept>
 #include <SDL.h>
 #include "mugen/sffv1.hpp"
 #include "mugen/sffv2.hpp"
+#include "mugen/spriteregistry.hpp"
 
 
 namespace Nugem {
@@ -35,13 +38,15 @@ namespace Nugem {
 Character::Character(const char * charid): m_id(charid)
 {
     m_currentPalette = 0;
+    m_colour = 1;
+    m_colourPalettes.fill(0);
     m_currentAnimStep = 0;
     m_directory = "chars/" + m_id;
     m_definitionFilename = m_id + ".def";
     loadCharacterDef((m_directory + "/" + m_definitionFilename).c_str());
-    std::string cmdfile = (std::string) m_def["files"]["cmd"];
+    std::string cmdfile(m_def.get(Mugen::sym::files, Mugen::sym::cmd));
     loadCharacterCmd((m_directory + "/" + cmdfile).c_str());
-    std::string airfile = (std::string) m_def["files"]["anim"];
+    std::string airfile(m_def.get(Mugen::sym::files, Mugen::sym::anim));
     loadCharacterAnimations((m_directory + "/" + airfile).c_str());
 }
 
@@ -53,16 +58,20 @@ Character::Character(Character && character)
     std::swap(m_x, character.m_x);
     std::swap(m_y, character.m_y);
     std::swap(m_currentPalette, character.m_currentPalette);
+    std::swap(m_colour, character.m_colour);
+    std::swap(m_colourPalettes, character.m_colourPalettes);
     std::swap(m_currentAnimStep, character.m_currentAnimStep);
     std::swap(m_directory, character.m_directory);
     std::swap(m_definitionFilename, character.m_definitionFilename);
     std::swap(m_spriteFilename, character.m_spriteFilename);
     std::swap(m_animations, character.m_animations);
     std::swap(m_def, character.m_def);
+    std::swap(m_spriteLoader, character.m_spriteLoader);
 }
 
 Character::Character(const Character & character): Character(character.id().c_str())
 {
+    setColour(character.colour());
 }
 
 Character::~Character()
@@ -92,14 +101,32 @@ const std::string & Character::dir() const
 void Character::loadCharacterDef(const char * filepath)
 {
     m_def = Mugen::DefinitionFile(filepath);
-    m_mugenVersion = (std::string) m_def["info"]["mugenversion"];
-    m_spriteFilename = (std::string) m_def["files"]["sprite"];
-    if (!m_spriteLoader.isInitialized()) {
-        if (def()["files"].count("pal1"))
-            m_spriteLoader.initialize(m_directory + "/" + m_spriteFilename, m_directory + "/" + def()["files"]["pal1"]);
-        else
-            m_spriteLoader.initialize(m_directory + "/" + m_spriteFilename);
+    m_mugenVersion = m_def.get(Mugen::sym::info, Mugen::sym::mugenversion);
+    m_spriteFilename = m_def.get(Mugen::sym::files, Mugen::sym::sprite);
+    // each distinct palette file is read once, whatever the number of colours using it
+    std::vector<std::string> paletteFiles;
+    for (size_t colour = 1; colour <= MAX_COLOURS; colour++) {
+        const Mugen::Symbol key = Mugen::sym::pal1 + colour - 1;
+        // colours without a palette file use the first palette
+        m_colourPalettes[colour - 1] = 0;
+        if (!m_def.has(Mugen::sym::files, key))
+            continue;
+        std::string paletteFile = m_directory + "/" + std::string(m_def.get(Mugen::sym::files, key));
+        auto known = std::find(paletteFiles.begin(), paletteFiles.end(), paletteFile);
+        m_colourPalettes[colour - 1] = known - paletteFiles.begin();
+        if (known == paletteFiles.end())
+            paletteFiles.push_back(paletteFile);
     }
+    if (!m_spriteLoader)
+        m_spriteLoader = Mugen::SpriteRegistry::loader(m_directory + "/" + m_spriteFilename, paletteFiles);
+    // an SFFv2 file has its own palettes: colour N is the palette numbered 1, N, or else the first one
+    if (!m_spriteLoader->usesPaletteFiles()) {
+        for (size_t colour = 1; colour <= MAX_COLOURS; colour++) {
+            int palette = m_spriteLoader->findPalette(1, colour);
+            m_colourPalettes[colour - 1] = palette >= 0 ? palette : 0;
+        }
+    }
+    setColour(m_colour);
 }
 
 void Character::loadCharacterCmd(const char * filepath)
@@ -112,9 +139,27 @@ void Character::loadCharacterAnimations(const char * filepath)
     m_animations = Mugen::AnimationData(filepath);
 }
 
-Mugen::SpriteLoader &Character::spriteLoader()
+const Mugen::SharedSpriteLoader &Character::spriteLoader() const
+{
+    return *m_spriteLoader;
+}
+
+void Character::setColour(size_t colour)
+{
+    if (colour < 1 || colour > MAX_COLOURS)
+        throw std::out_of_range("Colour " + std::to_string(colour) + " of " + m_id + " out of range");
+    m_colour = colour;
+    m_currentPalette = m_colourPalettes[colour - 1];
+}
+
+size_t Character::colour() const
+{
+    return m_colour;
+}
+
+size_t Character::palette() const
 {
-    return m_spriteLoader;
+    return m_currentPalette;
 }
 
 /*
@@ -202,7 +247,7 @@ void Character::handleEvent(const SDL_Event e)
 void Character::loadForMenu()
 {
 	std::vector<Mugen::Spriteref> menurefs { Mugen::Spriteref(9000, 0), Mugen::Spriteref(9000, 1) };
-	std::vector< std::unordered_map< Mugen::Spriteref, Mugen::Sprite > > menusprites = m_spriteLoader.load(menurefs.begin(), menurefs.end());
+	std::vector< std::unordered_map< Mugen::Spriteref, Mugen::Sprite > > menusprites = m_spriteLoader->load(menurefs.begin(), menurefs.end());
 	   m_currentPalette = 0;
 	for ( size_t i = 0; i < menusprites.size(); i++) {
 		std::unordered_map< Mugen::Spriteref, Mugen::Sprite > & palettesprites = menusprites[i];
@@ -20,16 +20,19 @@
 #ifndef CHARACTER_HPP
 #define CHARACTER_HPP
 
+#include <array>
 #include <string>
 #include <vector>
 #include <SDL.h>
 #include <unordered_map>
 #include <exception>
+#include <memory>
 
 #include "mugen/air.hpp"
 #include "mugen/cmd.hpp"
 #include "mugen/sprites.hpp"
 #include "mugen/def.hpp"
+#include "mugen/spriteregistry.hpp"
 
 namespace Nugem {
 
@@ -51,7 +54,13 @@ public:
     const std::string & id() const;
     const std::string & name() const;
     const std::string & dir() const;
-	Mugen::SpriteLoader & spriteLoader();
+	const Mugen::SharedSpriteLoader & spriteLoader() const;
+	// Colour the character is drawn with, from 1 to MAX_COLOURS: the palN of its definition, or the palette 1,N of an SFFv2 sprite file
+	void setColour(size_t colour);
+	size_t colour() const;
+	// index in spriteLoader().palettes() of the palette of the current colour
+	size_t palette() const;
+	static const size_t MAX_COLOURS = 12;
 protected:
     void loadCharacterDef(const char* filepath);
     void loadCharacterAnimations(const char* filepath);
@@ -61,7 +70,8 @@ protected:
     Mugen::DefinitionFile m_def;
     Mugen::AnimationData m_animations;
     Mugen::CharacterCommands m_cmd;
-    Mugen::SpriteLoader m_spriteLoader;
+    // shared with every other character using the same sprites
+    std::shared_ptr<const Mugen::SharedSpriteLoader> m_spriteLoader;
     unsigned int m_x;
     unsigned int m_y;
     std::vector< std::unordered_map< Mugen::Spriteref, Mugen::Sprite > > m_sprites;
@@ -73,6 +83,9 @@ private:
     std::string m_spriteFilename;
     std::string m_mugenVersion;
     size_t m_currentPalette;
+    size_t m_colour;
+    // palette of each colour: colours sharing a palette file share its palette
+    std::array<size_t, MAX_COLOURS> m_colourPalettes;
     size_t m_currentAnimStep;
     size_t m_currentGameTick;
     Mugen::Spriteref mCurrentSprite;
@@ -21,8 +21,14 @@
 
 namespace Nugem {
 
-FightCharacter::FightCharacter(Character *character, InputDevice& inputDevice): m_character(character), m_inputDevice(inputDevice)
+FightCharacter::FightCharacter(Character *character, InputDevice& inputDevice, size_t colour): m_character(character), m_inputDevice(inputDevice)
 {
+	m_character->setColour(colour);
+}
+
+Character & FightCharacter::character()
+{
+	return *m_character;
 }
 
 }
@@ -28,7 +28,9 @@ namespace Nugem {
 class FightCharacter
 {
 public:
-	FightCharacter(Character *character, InputDevice &inputDevice);
+	// colour: the palN palette the character is drawn with, see Character::setColour
+	FightCharacter(Character *character, InputDevice &inputDevice, size_t colour = 1);
+	Character & character();
 private:
 	std::unique_ptr<Character> m_character;
 	InputDevice &m_inputDevice;
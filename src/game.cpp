@@ -24,6 +24,7 @@
 
 #include "sceneloader.hpp"
 #include "scenemenu.hpp"
+#include "mugen/sprites.hpp"
 
 #include <iostream>
 
@@ -31,6 +32,9 @@ namespace Nugem {
 
 Game::Game(): m_glGraphics(m_window), mEventHandler(*this)
 {
+    // Opt-in: keeps the decoded sprites on disk to start faster the next time
+    if (const char * spriteCacheDirectory = SDL_getenv("NUGEM_SPRITE_CACHE"))
+        Mugen::SpriteLoader::setDiskCacheDirectory(spriteCacheDirectory);
     if (m_window)
         m_continueMainLoop = true;
     else
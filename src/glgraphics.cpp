@@ -204,6 +204,12 @@ namespace Nugem {
         m_UniformGlSpriteTexture = glGetUniformLocation(m_shaderProgram, "glSpriteTexture");
         if (m_UniformGlSpriteTexture == -1)
             std::cerr << "Could not bind sprite texture uniform" << std::endl;
+        m_uniformGlPaletteTexture = glGetUniformLocation(m_shaderProgram, "glPaletteTexture");
+        if (m_uniformGlPaletteTexture == -1)
+            std::cerr << "Could not bind palette texture uniform" << std::endl;
+        m_uniformPaletteRow = glGetUniformLocation(m_shaderProgram, "paletteRow");
+        if (m_uniformPaletteRow == -1)
+            std::cerr << "Could not bind palette row uniform" << std::endl;
 
         glGenBuffers(1, &m_itemPositionsBuffer);
         glGenBuffers(1, &m_itemTexCoordsBuffer);
@@ -282,6 +288,14 @@ namespace Nugem {
                 glUniform1i(m_UniformGlSpriteTexture, 0);
                 glActiveTexture(GL_TEXTURE0);
                 glBindTexture(GL_TEXTURE_2D, item.tid);
+                // 8-bit sprites take their colors from a row of the palette texture
+                glUniform1i(m_uniformPaletteRow, item.paletteTid ? item.paletteRow : -1);
+                if (item.paletteTid) {
+                    glUniform1i(m_uniformGlPaletteTexture, 1);
+                    glActiveTexture(GL_TEXTURE1);
+                    glBindTexture(GL_TEXTURE_2D, item.paletteTid);
+                    glActiveTexture(GL_TEXTURE0);
+                }
                 glEnableVertexAttribArray(m_texCoordsAttrib);
                 testGlError();
                 // Describe our vertices array to OpenGL (it can't guess its format automatically)
@@ -309,7 +323,11 @@ namespace Nugem {
     }
 
     void GlGraphics::passItem(GLuint tid, Positions&& positions, TexCoords&& texCoords) {
-        frameItems.push_back({ tid, positions, texCoords });
+        frameItems.push_back({ tid, 0, -1, positions, texCoords });
+    }
+
+    void GlGraphics::passItem(GLuint tid, GLuint paletteTid, GLint paletteRow, Positions&& positions, TexCoords&& texCoords) {
+        frameItems.push_back({ tid, paletteTid, paletteRow, positions, texCoords });
     }
 
 }
\ No newline at end of file
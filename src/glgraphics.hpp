@@ -93,6 +93,8 @@ namespace Nugem {
 	private:
 		struct InternalDisplayItem {
 			GLuint tid;
+			GLuint paletteTid;
+			GLint paletteRow;
 			Positions positions;
 			TexCoords texCoords;
 		};
@@ -104,6 +106,8 @@ namespace Nugem {
 		void clear();
 		void display();
 		void passItem(GLuint tid, Positions&& positions, TexCoords&& texCoords);
+		// paletteRow: row of paletteTid holding the colors of the 8-bit texture tid, -1 if tid is RGBA
+		void passItem(GLuint tid, GLuint paletteTid, GLint paletteRow, Positions&& positions, TexCoords&& texCoords);
 		const Window& window() const;
 	private:
 		Window& m_window;
@@ -116,6 +120,8 @@ namespace Nugem {
 		GLuint m_itemTexCoordsBuffer;
 		GLint m_uniformMvp;
 		GLint m_UniformGlSpriteTexture;
+		GLint m_uniformGlPaletteTexture;
+		GLint m_uniformPaletteRow;
 		GLint m_shaderProgram;
 		GLuint m_lastTidUsed;
 		std::vector<InternalDisplayItem> frameItems;
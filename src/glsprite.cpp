@@ -1,6 +1,9 @@
 #include "glsprite.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 
 #include <SDL2/SDL_image.h>
 
@@ -8,7 +11,7 @@ namespace Nugem {
 
 	const SDL_Rect GlSpriteDisplayer::defaultSpriteCanvas = { -1, -1, -1, -1 };
 
-	GlSpriteCollection::GlSpriteCollection(GLuint tid, std::vector<GlSpriteCollectionData>&& spriteList) : m_tid(tid), m_sprites(spriteList), m_totalHeight(0) {
+	GlSpriteCollection::GlSpriteCollection(GLuint tid, std::vector<GlSpriteCollectionData>&& spriteList, GLuint paletteTid) : m_tid(tid), m_paletteTid(paletteTid), m_sprites(spriteList), m_totalHeight(0) {
 		m_totalWidth = m_sprites.back().x + m_sprites.back().w;
 		for (auto& sprite : m_sprites) {
 			if (sprite.h > m_totalHeight)
@@ -16,57 +19,74 @@ namespace Nugem {
 		}
 	}
 
-	GlSpriteCollection::GlSpriteCollection(GlSpriteCollection&& original) : m_tid(std::move(original.m_tid)), m_sprites(std::move(original.m_sprites)), m_totalWidth(std::move(original.m_totalWidth)), m_totalHeight(std::move(original.m_totalHeight)) {
+	GlSpriteCollection::GlSpriteCollection(GlSpriteCollection&& original) : m_tid(std::move(original.m_tid)), m_paletteTid(std::move(original.m_paletteTid)), m_sprites(std::move(original.m_sprites)), m_totalWidth(std::move(original.m_totalWidth)), m_totalHeight(std::move(original.m_totalHeight)) {
 		original.m_tid = 0;
+		original.m_paletteTid = 0;
 	}
 
 	GlSpriteCollection::~GlSpriteCollection() {
 		if (m_tid) {
 			glDeleteTextures(1, &m_tid);
 		}
+		if (m_paletteTid) {
+			glDeleteTextures(1, &m_paletteTid);
+		}
 	}
 
-	GlSpriteCollectionBuilder::GlSpriteCollectionBuilder() : m_maxHeight(0), m_totalWidth(0), m_built(false), m_surface(nullptr), m_result(nullptr) {}
+	GlSpriteCollectionBuilder::GlSpriteCollectionBuilder(bool indexed) : m_indexed(indexed), m_maxHeight(0), m_totalWidth(0), m_built(false), m_result(nullptr) {}
+
+	GlSpriteCollectionBuilder::~GlSpriteCollectionBuilder() {}
+
+	size_t GlSpriteCollectionBuilder::addPalette(const SDL_Color* colors, size_t ncolors) {
+		size_t row = m_palettes.size() / PALETTE_SIZE;
+		if (ncolors > PALETTE_SIZE)
+			ncolors = PALETTE_SIZE;
+		m_palettes.insert(m_palettes.end(), colors, colors + ncolors);
+		m_palettes.resize((row + 1) * PALETTE_SIZE, { 0, 0, 0, 0 });
+		return row;
+	}
 
-	GlSpriteCollectionBuilder::~GlSpriteCollectionBuilder() {
-		if (m_surface)
-			SDL_FreeSurface(m_surface);
+	uint8_t* GlSpriteCollectionBuilder::addSlice(size_t width, size_t height) {
+		if (height > m_maxHeight)
+			m_maxHeight = height;
+		m_sliceOffsets.push_back(m_arena.size());
+		m_spriteList.push_back({ width, height, m_totalWidth, -1, -1 });
+		m_totalWidth += width;
+		m_arena.resize(m_arena.size() + width * height * (m_indexed ? 1 : 4));
+		return m_arena.data() + m_sliceOffsets.back();
 	}
 
-	size_t GlSpriteCollectionBuilder::addSprite(const SDL_Surface* surface) {
-		Uint32 rmask, gmask, bmask, amask;
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-		rmask = 0xff000000;
-		gmask = 0x00ff0000;
-		bmask = 0x0000ff00;
-		amask = 0x000000ff;
-#else
-		rmask = 0x000000ff;
-		gmask = 0x0000ff00;
-		bmask = 0x00ff0000;
-		amask = 0xff000000;
-#endif
-		if ((long unsigned int) surface->h > m_maxHeight)
-			m_maxHeight = surface->h;
-		GLuint currentOrdinate = m_totalWidth;
-		m_totalWidth += surface->w;
-		testGlError();
-		SDL_Surface* newSurface = SDL_CreateRGBSurface(0, m_totalWidth, m_maxHeight, 32, rmask, gmask, bmask, amask);
-		if (m_surface) {
-			SDL_Rect dstRect = { 0, 0, m_surface->w, m_surface->h };
-			SDL_BlitSurface(m_surface, nullptr, newSurface, &dstRect);
-			SDL_FreeSurface(m_surface);
+	size_t GlSpriteCollectionBuilder::addSprite(const SDL_Surface* surface, int paletteBase, int palette) {
+		if (m_indexed != (surface->format->BytesPerPixel == 1)) {
+			std::cerr << "Error: the sprite does not match the pixel format of the atlas" << std::endl;
+			addSlice(0, 0);
+			return lastSprite();
 		}
-		{
-			SDL_Rect dstRect = { 0, 0, surface->w, surface->h };
-			dstRect.x = currentOrdinate;
-			SDL_BlitSurface(const_cast<SDL_Surface*>(surface), nullptr, newSurface, &dstRect);
+		// rows are copied as they are: 8-bit surfaces would otherwise go through their SDL palettes
+		const size_t rowSize = surface->w * surface->format->BytesPerPixel;
+		uint8_t* slice = addSlice(surface->w, surface->h);
+		for (int y = 0; y < surface->h; y++)
+			memcpy(slice + y * rowSize, static_cast<const uint8_t*>(surface->pixels) + y * surface->pitch, rowSize);
+		if (m_indexed)
+			setSpritePalette(lastSprite(), paletteBase, palette);
+		return lastSprite();
+	}
+
+	uint8_t* GlSpriteCollectionBuilder::pixels(size_t width, size_t height, size_t bytesPerPixel, size_t& pitch) {
+		pitch = width * bytesPerPixel;
+		if (m_indexed != (bytesPerPixel == 1)) {
+			// the sprite is left blank, as in addSprite: it is drawn where nothing is kept
+			std::cerr << "Error: the sprite does not match the pixel format of the atlas" << std::endl;
+			addSlice(0, 0);
+			m_discarded.resize(width * height * bytesPerPixel);
+			return m_discarded.data();
 		}
-		m_surface = newSurface;
-		size_t identifier = m_spriteList.size();
-		m_spriteList.push_back({ (size_t) surface->w,  (size_t) surface->h,  (size_t) currentOrdinate });
-		// 	IMG_SavePNG(const_cast<SDL_Surface *>(surface), ("img_" + std::to_string(identifier) + ".png").c_str()); // DEBUG
-		return identifier;
+		return addSlice(width, height);
+	}
+
+	void GlSpriteCollectionBuilder::setSpritePalette(size_t sprite, int paletteBase, int palette) {
+		m_spriteList[sprite].paletteBase = paletteBase;
+		m_spriteList[sprite].palette = palette;
 	}
 
 	GlSpriteCollection* GlSpriteCollectionBuilder::build() {
@@ -93,16 +113,45 @@ namespace Nugem {
 			// 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 			// 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_surface->w, m_surface->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_surface->pixels);
+			// the atlas is allocated once, then each sprite goes to its rectangle straight from the arena
+			GLenum format = m_indexed ? GL_RED : GL_RGBA;
+			glTexImage2D(GL_TEXTURE_2D, 0, m_indexed ? GL_R8 : GL_RGBA, std::max<size_t>(m_totalWidth, 1), std::max<size_t>(m_maxHeight, 1), 0, format, GL_UNSIGNED_BYTE, nullptr);
+			for (size_t i = 0; i < m_spriteList.size(); i++) {
+				const GlSpriteCollectionData& sprite = m_spriteList[i];
+				if (sprite.w && sprite.h)
+					glTexSubImage2D(GL_TEXTURE_2D, 0, sprite.x, 0, sprite.w, sprite.h, format, GL_UNSIGNED_BYTE, m_arena.data() + m_sliceOffsets[i]);
+			}
 			glGenerateMipmap(GL_TEXTURE_2D);
-			m_result = new GlSpriteCollection(tid, std::move(m_spriteList));
+			m_arena = std::vector<uint8_t>();
+			m_sliceOffsets = std::vector<size_t>();
+
+			GLuint paletteTid = 0;
+			if (m_indexed) {
+				// one row of 256 colors per palette
+				if (m_palettes.empty())
+					m_palettes.resize(PALETTE_SIZE, { 0, 0, 0, 0 });
+				glGenTextures(1, &paletteTid);
+				glBindTexture(GL_TEXTURE_2D, paletteTid);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, PALETTE_SIZE, m_palettes.size() / PALETTE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_palettes.data());
+			}
+			m_result = new GlSpriteCollection(tid, std::move(m_spriteList), paletteTid);
 			m_built = true;
 			testGlError();
 		}
 		return m_result;
 	}
 
-	GlSpriteDisplayer::GlSpriteDisplayer(GlSpriteCollection& spriteAtlas) : m_spriteAtlas(spriteAtlas) {}
+	GlSpriteDisplayer::GlSpriteDisplayer(GlSpriteCollection& spriteAtlas) : m_spriteAtlas(spriteAtlas), m_palette(0) {}
+
+	void GlSpriteDisplayer::setPalette(size_t palette) {
+		m_palette = palette;
+	}
 
 	void GlSpriteDisplayer::addSprite(size_t spriteNumber, const SDL_Rect& dest, const SDL_Rect& src) {
 		if (spriteNumber >= m_spriteAtlas.sprites().size()) {
@@ -149,25 +198,33 @@ namespace Nugem {
 						bndTop = maxBndBottom;
 				}
 			}
+			GLint paletteRow = -1;
+			if (sprite.paletteBase >= 0)
+				paletteRow = sprite.paletteBase + (sprite.palette >= 0 ? sprite.palette : m_palette);
 			if (enableDisplay) {
-				m_positions.push_back({ { dest.x, dest.y } });
-				m_positions.push_back({ { dest.x + dest.w, dest.y } });
-				m_positions.push_back({ { dest.x, dest.y + dest.h } });
-				m_positions.push_back({ { dest.x + dest.w, dest.y + dest.h } });
-				m_positions.push_back({ { dest.x + dest.w, dest.y } });
-				m_positions.push_back({ { dest.x, dest.y + dest.h } });
-				m_texCoords.push_back({ { bndLeft, bndTop } });
-				m_texCoords.push_back({ { bndRight, bndTop } });
-				m_texCoords.push_back({ { bndLeft, bndBottom } });
-				m_texCoords.push_back({ { bndRight, bndBottom } });
-				m_texCoords.push_back({ { bndRight, bndTop } });
-				m_texCoords.push_back({ { bndLeft, bndBottom } });
+				if (m_batches.empty() || m_batches.back().paletteRow != paletteRow)
+					m_batches.push_back({ paletteRow, {}, {} });
+				Batch& batch = m_batches.back();
+				batch.positions.push_back({ { dest.x, dest.y } });
+				batch.positions.push_back({ { dest.x + dest.w, dest.y } });
+				batch.positions.push_back({ { dest.x, dest.y + dest.h } });
+				batch.positions.push_back({ { dest.x + dest.w, dest.y + dest.h } });
+				batch.positions.push_back({ { dest.x + dest.w, dest.y } });
+				batch.positions.push_back({ { dest.x, dest.y + dest.h } });
+				batch.texCoords.push_back({ { bndLeft, bndTop } });
+				batch.texCoords.push_back({ { bndRight, bndTop } });
+				batch.texCoords.push_back({ { bndLeft, bndBottom } });
+				batch.texCoords.push_back({ { bndRight, bndBottom } });
+				batch.texCoords.push_back({ { bndRight, bndTop } });
+				batch.texCoords.push_back({ { bndLeft, bndBottom } });
 			}
 		}
 	}
 
 	void GlSpriteDisplayer::display(GlGraphics& glGraphics) {
-		glGraphics.passItem(m_spriteAtlas.tid(), std::move(m_positions), std::move(m_texCoords));
+		for (auto& batch : m_batches)
+			glGraphics.passItem(m_spriteAtlas.tid(), m_spriteAtlas.paletteTid(), batch.paletteRow, std::move(batch.positions), std::move(batch.texCoords));
+		m_batches.clear();
 	}
 
 }
@@ -21,7 +21,9 @@
 #define GLSPRITE_HPP
 
 #include "glgraphics.hpp"
+#include "mugen/sprites.hpp"
 #include <SDL.h>
+#include <vector>
 
 namespace Nugem {
 
@@ -30,38 +32,60 @@ struct GlSpriteCollectionData
 	size_t w;
 	size_t h;
 	size_t x;
+	// indexed sprites: first palette row of the sprite's palettes, and palette forced by the sprite (-1: the selected one)
+	int paletteBase;
+	int palette;
 };
 
 class GlSpriteCollection
 {
 public:
-	GlSpriteCollection(GLuint, std::vector<GlSpriteCollectionData> &&);
+	GlSpriteCollection(GLuint, std::vector<GlSpriteCollectionData> &&, GLuint paletteTid = 0);
 	GlSpriteCollection(GlSpriteCollection &&);
 	~GlSpriteCollection();
 	decltype(auto) tid() { return m_tid; };
+	// texture of 256-color palette rows, 0 if the sprites are not indexed
+	decltype(auto) paletteTid() { return m_paletteTid; };
 	decltype(auto) width() { return m_totalWidth; };
 	decltype(auto) height() { return m_totalHeight; };
 	const std::vector<GlSpriteCollectionData> & sprites() { return m_sprites; };
 private:
 	GLuint m_tid;
+	GLuint m_paletteTid;
 	std::vector<GlSpriteCollectionData> m_sprites;
 	GLfloat m_totalWidth;
 	GLfloat m_totalHeight;
 };
 
-class GlSpriteCollectionBuilder
+// Drawing into the builder adds a sprite to the atlas, without going through a surface of its own
+class GlSpriteCollectionBuilder: public SpriteTarget
 {
 public:
-	GlSpriteCollectionBuilder();
+	// An indexed collection takes 8-bit surfaces of color indices, drawn with the palettes added to it
+	GlSpriteCollectionBuilder(bool indexed = false);
 	~GlSpriteCollectionBuilder();
-	size_t addSprite(const SDL_Surface *);
+	size_t addPalette(const SDL_Color * colors, size_t ncolors);
+	size_t addSprite(const SDL_Surface *, int paletteBase = -1, int palette = -1);
+	uint8_t * pixels(size_t width, size_t height, size_t bytesPerPixel, size_t & pitch);
+	// the sprite added last, such as the one just drawn into the builder
+	size_t lastSprite() const { return m_spriteList.size() - 1; };
+	void setSpritePalette(size_t sprite, int paletteBase, int palette);
 	GlSpriteCollection *build();
+	static const size_t PALETTE_SIZE = 256;
 private:
+	// room for the pixels of a new sprite, at the end of the arena
+	uint8_t * addSlice(size_t width, size_t height);
 	std::vector<GlSpriteCollectionData> m_spriteList;
+	std::vector<SDL_Color> m_palettes;
+	// pixels of every sprite, one after the other, until they are uploaded
+	std::vector<uint8_t> m_arena;
+	std::vector<size_t> m_sliceOffsets;
+	// where the sprites that do not match the pixel format of the atlas are drawn
+	std::vector<uint8_t> m_discarded;
+	bool m_indexed;
 	size_t m_maxHeight;
 	size_t m_totalWidth;
 	bool m_built;
-	SDL_Surface *m_surface;
 	GlSpriteCollection *m_result;
 };
 
@@ -69,13 +93,21 @@ class GlSpriteDisplayer
 {
 public:
 	GlSpriteDisplayer(GlSpriteCollection &);
+	// selectable palette used by the indexed sprites added afterwards
+	void setPalette(size_t);
 	void addSprite(size_t, const SDL_Rect &, const SDL_Rect & = defaultSpriteCanvas);
 	void display(GlGraphics &);
 	static const SDL_Rect defaultSpriteCanvas;
 private:
+	struct Batch {
+		GLint paletteRow;
+		GlGraphics::Positions positions;
+		GlGraphics::TexCoords texCoords;
+	};
 	GlSpriteCollection &m_spriteAtlas;
-	GlGraphics::Positions m_positions;
-	GlGraphics::TexCoords m_texCoords;
+	size_t m_palette;
+	// sprites to display in the order they were added, a new batch starting whenever the palette row (-1 for RGBA sprites) changes
+	std::vector<Batch> m_batches;
 };
 
 }
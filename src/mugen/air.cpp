@@ -1,5 +1,10 @@
 #include "air.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <string_view>
+
 using namespace std;
 
 namespace Nugem {
@@ -9,14 +14,160 @@ AnimationData::AnimationData()
 {
 }
 
-AnimationData::AnimationData(AnimationData && animationData): std::map<size_t, animation_t>(animationData)
+namespace {
+
+bool startsWith(string_view text, string_view prefix)
+{
+	if (text.size() < prefix.size())
+		return false;
+	for (size_t i = 0; i < prefix.size(); i++) {
+		if (tolower(static_cast<unsigned char>(text[i])) != prefix[i])
+			return false;
+	}
+	return true;
+}
+
+string_view trim(string_view text)
 {
+	const size_t first = text.find_first_not_of(" \t\r");
+	if (first == string_view::npos)
+		return string_view();
+	return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
 }
 
-const std::regex AnimationData::regexSection("Begin Action ([0-9]+)");
-const std::regex AnimationData::regexClsnInit("[ \t\r\n]*(Clsn([0-9]+)(?:Default)?):[ \t]*([0-9]+)[ \t\r\n]*");
-const std::regex AnimationData::regexClsn("[ \t\r\n]*Clsn2\\[([0-9]+)\\][ \t]*=[ \t]*(-?[0-9]+),[ \t]*(-?[0-9]+),[ \t]*(-?[0-9]+),[ \t]*(-?[0-9]+)[ \t\r\n]*");
-const std::regex AnimationData::regexStep("[ \t\r\n]*(-?[0-9]+),[ \t]*(-?[0-9]+),[ \t]*(-?[0-9]+),[ \t]*(-?[0-9]+),[ \t]*(-?[0-9]+)((?:[ \t]*,[ \t]*[A-Za-z0-9]*)*)[ \t\r\n]*");
+// Reads the integer at the start of text, after blanks, and moves text past it
+bool readInt(string_view & text, int & value)
+{
+	text = trim(text);
+	if (!text.empty() && text[0] == '+')
+		text.remove_prefix(1);
+	const from_chars_result result = from_chars(text.data(), text.data() + text.size(), value);
+	if (result.ec != errc())
+		return false;
+	text.remove_prefix(result.ptr - text.data());
+	return true;
+}
+
+// Reads the integer and the separator after it
+bool readInt(string_view & text, int & value, char separator)
+{
+	if (!readInt(text, value))
+		return false;
+	text = trim(text);
+	if (text.empty() || text[0] != separator)
+		return false;
+	text.remove_prefix(1);
+	return true;
+}
+
+// Clsn1 boxes are attack boxes, Clsn2 ones collision boxes
+struct ClsnBoxes {
+	vector<animbox_t> defaults;
+	vector<animbox_t> overrides;
+	bool overridden = false;
+	// where the next box lines go
+	vector<animbox_t> * target = nullptr;
+};
+
+// "Clsn2Default: 2", "Clsn1: 1" or "Clsn2[0] = -10, 0, 10, -79"
+void readClsn(string_view line, ClsnBoxes clsnBoxes[2])
+{
+	line.remove_prefix(4);
+	if (line.empty() || (line[0] != '1' && line[0] != '2'))
+		return;
+	const size_t type = line[0] == '1' ? animbox_t::ATTACK : animbox_t::COLLISION;
+	ClsnBoxes & boxes = clsnBoxes[type];
+	line.remove_prefix(1);
+	if (startsWith(line, "default")) {
+		boxes.defaults.clear();
+		boxes.target = &boxes.defaults;
+	}
+	else if (trim(line).substr(0, 1) == ":") {
+		boxes.overrides.clear();
+		boxes.overridden = true;
+		boxes.target = &boxes.overrides;
+	}
+	else if (boxes.target) {
+		// the index of the box is of no use: the boxes come in order
+		const size_t equal = line.find('=');
+		if (equal == string_view::npos)
+			return;
+		line.remove_prefix(equal + 1);
+		int coordinates[4];
+		if (!readInt(line, coordinates[0], ',') || !readInt(line, coordinates[1], ',') || !readInt(line, coordinates[2], ',') || !readInt(line, coordinates[3]))
+			return;
+		animbox_t box;
+		box.type = static_cast<decltype(box.type)>(type);
+		box.coordinates[0] = min(coordinates[0], coordinates[2]);
+		box.coordinates[1] = min(coordinates[1], coordinates[3]);
+		box.coordinates[2] = max(coordinates[0], coordinates[2]);
+		box.coordinates[3] = max(coordinates[1], coordinates[3]);
+		boxes.target->push_back(box);
+	}
+}
+
+// "group, image, x, y, ticks[, flip[, blending]]"
+bool readStep(string_view line, animstep_t & step)
+{
+	int values[5];
+	for (int i = 0; i < 4; i++) {
+		if (!readInt(line, values[i], ','))
+			return false;
+	}
+	if (!readInt(line, values[4]))
+		return false;
+	line = trim(line);
+	if (!line.empty() && line[0] != ',')
+		return false;
+	step.group = values[0];
+	step.image = values[1];
+	step.x = values[2];
+	step.y = values[3];
+	step.ticks = values[4];
+	// the flip is the field after the ticks
+	string_view flip;
+	if (!line.empty()) {
+		line.remove_prefix(1);
+		flip = line.substr(0, line.find(','));
+	}
+	step.hinvert = flip.find_first_of("Hh") != string_view::npos;
+	step.vinvert = flip.find_first_of("Vv") != string_view::npos;
+	return true;
+}
+
+// Appends the boxes of the step, or lets it share the range of the previous step of the animation if they are the same
+void addStepBoxes(vector<animbox_t> & boxes, const animstep_t * previousStep, animstep_t & step, ClsnBoxes clsnBoxes[2])
+{
+	const vector<animbox_t> & collision = clsnBoxes[animbox_t::COLLISION].overridden ? clsnBoxes[animbox_t::COLLISION].overrides : clsnBoxes[animbox_t::COLLISION].defaults;
+	const vector<animbox_t> & attack = clsnBoxes[animbox_t::ATTACK].overridden ? clsnBoxes[animbox_t::ATTACK].overrides : clsnBoxes[animbox_t::ATTACK].defaults;
+	step.boxCount = collision.size() + attack.size();
+	step.boxOffset = boxes.size();
+	auto sameBoxes = [](const animbox_t * first, const vector<animbox_t> & boxes) {
+		for (const animbox_t & box: boxes) {
+			if (first->type != box.type || !equal(box.coordinates, box.coordinates + 4, first->coordinates))
+				return false;
+			first++;
+		}
+		return true;
+	};
+	if (previousStep && previousStep->boxCount == step.boxCount) {
+		const animbox_t * previous = boxes.data() + previousStep->boxOffset;
+		if (sameBoxes(previous, collision) && sameBoxes(previous + collision.size(), attack))
+			step.boxOffset = previousStep->boxOffset;
+	}
+	if (step.boxOffset == boxes.size()) {
+		boxes.insert(boxes.end(), collision.begin(), collision.end());
+		boxes.insert(boxes.end(), attack.begin(), attack.end());
+	}
+	// the overrides only go for one step
+	for (int type = 0; type < 2; type++) {
+		clsnBoxes[type].overrides.clear();
+		clsnBoxes[type].overridden = false;
+		clsnBoxes[type].target = nullptr;
+	}
+}
+
+}
 
 AnimationData::AnimationData(const std::string & filepath)
 {
@@ -26,75 +177,139 @@ AnimationData::AnimationData(const std::string & filepath)
 AnimationData & AnimationData::readFile(const std::string & filepath)
 {
 	MugenTextFile air(filepath);
-	std::string line;
-	animation_t currentAnimation;
-	int actionNumber = -1;
-	for (line = air.nextLine(); air; line = air.nextLine()) {
-		std::smatch sm;
+	const size_t firstAnimation = m_animations.size();
+	animation_t * currentAnimation = nullptr;
+	ClsnBoxes clsnBoxes[2];
+	for (string_view line = air.nextLine(); air; line = air.nextLine()) {
 		// new action start (i.e. a section describing an animation)
 		if (air.newSection()) {
-			// first, if the current action is named, we add it
-			if (actionNumber >= 0) {
-				(*this)[actionNumber] = currentAnimation;
-			}
 			// find the number of the new action
-			if (!std::regex_match(air.section(), sm, regexSection)) {
-				// if a number can't be found then we just skip this line and section
-				actionNumber = -1;
-				continue;
+			string_view section = air.section();
+			currentAnimation = nullptr;
+			if (startsWith(section, "begin action")) {
+				section.remove_prefix(12);
+				int number;
+				// if a number can't be found then we just skip this section
+				if (readInt(section, number) && section.empty() && number >= 0) {
+					// then start a new action, its steps at the end of the others
+					m_animations.push_back({ static_cast<size_t>(number), m_steps.size(), 0, 0, 0, 0, 0, animation_t::NO_FRAMES });
+					currentAnimation = &m_animations.back();
+				}
 			}
-			// then start a new action
-			actionNumber = std::stoi(sm[1]);
-			currentAnimation = animation_t();
+			clsnBoxes[0] = clsnBoxes[1] = ClsnBoxes();
+			continue;
+		}
+		// if we're not actually in a numbered action then we skip this line
+		if (!currentAnimation)
+			continue;
+		line = trim(line);
+		if (startsWith(line, "clsn")) {
+			readClsn(line, clsnBoxes);
 			continue;
 		}
-		// if we're not actually in a numbered action then we skip this key-value pair
-		if (actionNumber < 0)
+		if (startsWith(line, "loopstart")) {
+			currentAnimation->loopstart = currentAnimation->stepCount;
 			continue;
+		}
 		// we want a line with 5 numbers separated by commas
 		// Note: Putting -1,0 for the sprite means it does not draw anything
-		// elem is of the form "x,y" with x image group and y image number in group
-		if (std::regex_match(line, sm, regexStep)) {
-			// start at index 1 of sm because index 0 is the whole string
-			animstep_t step;
-			step.group = std::stoi(sm[1]);
-			step.image = std::stoi(sm[2]);
-			step.x = std::stoi(sm[3]);
-			step.y = std::stoi(sm[4]);
-			step.ticks = std::stoi(sm[5]);
-			if (sm.size() > 6) { // horizontal and vertical inversion
-				const std::string arg(sm[6]);
-				size_t hinv = arg.find('H');
-				step.hinvert = (hinv != std::string::npos);
-				size_t vinv = arg.find('V');
-				step.vinvert = (vinv != std::string::npos);
-			}
-			else {
-				step.hinvert = false;
-				step.vinvert = false;
-			}
-			if (sm.size() > 7) {}
-			currentAnimation.steps.push_back(step);
-		}
-		else if (line.find("LoopStart") != std::string::npos) {
-			currentAnimation.loopstart = currentAnimation.steps.size();
+		animstep_t step;
+		if (readStep(line, step)) {
+			addStepBoxes(m_boxes, currentAnimation->stepCount ? &m_steps.back() : nullptr, step, clsnBoxes);
+			m_steps.push_back(step);
+			currentAnimation->stepCount++;
 		}
 	}
-	if (actionNumber >= 0)
-		(*this)[actionNumber] = currentAnimation;
+	for (size_t i = firstAnimation; i < m_animations.size(); i++)
+		computeTiming(m_animations[i]);
+	// sort the actions, the last one read winning over the others with the same number
+	stable_sort(m_animations.begin(), m_animations.end(), [](const animation_t & a, const animation_t & b) {
+		return a.action < b.action;
+	});
+	size_t kept = 0;
+	for (size_t i = 0; i < m_animations.size(); i++) {
+		if (kept && m_animations[kept - 1].action == m_animations[i].action)
+			kept--;
+		m_animations[kept++] = m_animations[i];
+	}
+	m_animations.resize(kept);
 	return *this;
 }
 
-AnimationData & AnimationData::operator=(AnimationData && animationData)
+const animation_t * AnimationData::find(size_t action) const
 {
-	std::map<size_t, animation_t>::operator=(animationData);
-	return *this;
+	auto animation = lower_bound(m_animations.begin(), m_animations.end(), action, [](const animation_t & a, size_t action) {
+		return a.action < action;
+	});
+	if (animation == m_animations.end() || animation->action != action)
+		return nullptr;
+	return &*animation;
 }
 
-AnimationData & AnimationData::operator=(const AnimationData & animationData)
+void AnimationData::computeTiming(animation_t & animation)
 {
-	std::map<size_t, animation_t>::operator=(animationData);
-	return *this;
+	animstep_t * steps = m_steps.data() + animation.firstStep;
+	animation.foreverStep = animation.stepCount;
+	size_t tick = 0;
+	for (size_t i = 0; i < animation.stepCount; i++) {
+		steps[i].start = tick;
+		if (i == animation.loopstart)
+			animation.loopTick = tick;
+		if (animation.foreverStep < animation.stepCount)
+			continue;
+		if (static_cast<int>(steps[i].ticks) < 0)
+			animation.foreverStep = i;
+		else
+			tick += steps[i].ticks;
+	}
+	animation.ticks = tick;
+	if (animation.loopstart >= animation.stepCount)
+		animation.loopTick = tick;
+	if (tick > MAX_FRAME_TABLE_TICKS || animation.stepCount > UINT16_MAX)
+		return;
+	animation.firstFrame = m_frames.size();
+	for (size_t i = 0; i < animation.foreverStep; i++)
+		m_frames.insert(m_frames.end(), steps[i].ticks, i);
+}
+
+size_t AnimationData::animationTick(const animation_t & animation, size_t tick) const
+{
+	const size_t loopTicks = animation.ticks - animation.loopTick;
+	if (tick < animation.ticks || animation.foreverStep < animation.stepCount || !loopTicks)
+		return tick;
+	return animation.loopTick + (tick - animation.loopTick) % loopTicks;
+}
+
+size_t AnimationData::element(const animation_t & animation, size_t tick) const
+{
+	const size_t time = animationTick(animation, tick);
+	if (time >= animation.ticks)
+		return min(animation.foreverStep, animation.stepCount - 1);
+	if (animation.firstFrame != animation_t::NO_FRAMES)
+		return m_frames[animation.firstFrame + time];
+	// the last step started by then: the steps without duration share their start with the next one
+	const animstep_t * steps = m_steps.data() + animation.firstStep;
+	const animstep_t * step = upper_bound(steps, steps + animation.foreverStep, time, [](size_t time, const animstep_t & step) {
+		return time < step.start;
+	});
+	return step - steps - 1;
+}
+
+long AnimationData::elementTime(const animation_t & animation, size_t tick, size_t element) const
+{
+	return static_cast<long>(animationTick(animation, tick)) - static_cast<long>(m_steps[animation.firstStep + element].start);
+}
+
+long AnimationData::animationTime(const animation_t & animation, size_t tick) const
+{
+	if (tick < animation.ticks)
+		return static_cast<long>(tick) - static_cast<long>(animation.ticks);
+	const size_t loopTicks = animation.ticks - animation.loopTick;
+	if (animation.foreverStep < animation.stepCount || !loopTicks)
+		return 0;
+	// each pass of the loop ends on its last tick
+	const size_t loopTime = (tick - animation.ticks) % loopTicks;
+	return loopTime ? static_cast<long>(loopTime) - static_cast<long>(loopTicks) : 0;
 }
 
 }
@@ -2,7 +2,8 @@
 #define AIR_HPP
 
 #include "mugenutils.hpp"
-#include <map>
+#include <cstdint>
+#include <vector>
 
 namespace Nugem {
 namespace Mugen {
@@ -11,45 +12,80 @@ struct animstep_t {
 	// values separated by a comma in the file
 	size_t group;
 	size_t image;
-	unsigned int x;
-	unsigned int y;
-	unsigned int ticks; // duration. Unit: 1/60 of a second
+	int x;
+	int y;
+	unsigned int ticks; // duration. Unit: 1/60 of a second, -1 for ever
 	bool hinvert; // horizontal inversion
 	bool vinvert; // vertical inversion
+	// range of the boxes of the step in AnimationData::boxes()
+	size_t boxOffset;
+	size_t boxCount;
+	// tick the step starts at, from the start of the animation
+	size_t start;
 };
 
+// Collision box of a step, relative to the axis of the sprite
 struct animbox_t {
-	enum { COLLISION, ATTACK } type;
-	unsigned int coordinates[4];
-	size_t framenumber;
-};
-
-struct animboxlist_t {
-	size_t framenumber;
-	
+	enum { COLLISION, ATTACK } type; // Clsn2, Clsn1
+	int coordinates[4]; // left, top, right, bottom
 };
 
+// An action of the AIR file: its range in AnimationData::steps()
 struct animation_t {
-	::std::vector<animbox_t> boxes;
-	::std::vector<animstep_t> steps;
-	size_t loopstart;
-	animation_t() {
-			loopstart = 0;
-	}
+	size_t action;
+	size_t firstStep;
+	size_t stepCount;
+	size_t loopstart; // index of the step the animation loops back to, from the first one
+	// the steps before the first one lasting for ever take that many ticks
+	size_t ticks;
+	// tick the loop starts at
+	size_t loopTick;
+	// step lasting for ever, or stepCount
+	size_t foreverStep;
+	// step of each of the ticks in AnimationData's frame table, or NO_FRAMES for long animations
+	size_t firstFrame;
+	static const size_t NO_FRAMES = static_cast<size_t>(-1);
 };
 
-class AnimationData: public ::std::map<size_t, animation_t> {
+/**
+ * Animations of an AIR file, sorted by action number.
+ *
+ * The steps of all the animations are in one array, and their boxes in another:
+ * consecutive steps with the same boxes share their range.
+ *
+ * The timing queries take the ticks since the animation started, and answer in constant time:
+ * the step of each tick of an animation is in a table, and the start tick of each step in the step.
+ */
+class AnimationData {
 public:
 	AnimationData();
 	AnimationData(const ::std::string & filepath);
-	AnimationData(AnimationData && animationData);
-	AnimationData& operator=(AnimationData && animationData);
-	AnimationData& operator=(const AnimationData & animationData);
+	// Reads the animations of the file, replacing the actions already read with the same numbers
 	AnimationData& readFile(const ::std::string & filepath);
-	static const ::std::regex regexSection;
-	static const ::std::regex regexClsnInit;
-	static const ::std::regex regexClsn;
-	static const ::std::regex regexStep;
+	const ::std::vector<animation_t> & animations() const { return m_animations; };
+	// nullptr if there is no such action
+	const animation_t * find(size_t action) const;
+	const ::std::vector<animstep_t> & steps() const { return m_steps; };
+	const ::std::vector<animbox_t> & boxes() const { return m_boxes; };
+	const animstep_t * steps(const animation_t & animation) const { return m_steps.data() + animation.firstStep; };
+	const animbox_t * boxes(const animstep_t & step) const { return m_boxes.data() + step.boxOffset; };
+	// Tick within the steps of the animation: past its end, the loop repeats, unless the last step holds
+	size_t animationTick(const animation_t & animation, size_t tick) const;
+	// Index of the step shown, from 0 (AnimElemNo - 1); the animation must have steps
+	size_t element(const animation_t & animation, size_t tick) const;
+	// Ticks since the step started in the current loop, negative before (AnimElemTime)
+	long elementTime(const animation_t & animation, size_t tick, size_t element) const;
+	// Ticks to the end of the current loop, 0 at its end and once the animation holds its last step (AnimTime)
+	long animationTime(const animation_t & animation, size_t tick) const;
+	// Animations up to that many ticks long get a frame table
+	static const size_t MAX_FRAME_TABLE_TICKS = 4096;
+private:
+	void computeTiming(animation_t & animation);
+	::std::vector<animation_t> m_animations;
+	::std::vector<animstep_t> m_steps;
+	::std::vector<animbox_t> m_boxes;
+	// step indices, from the first step of their animation
+	::std::vector<uint16_t> m_frames;
 };
 
 }
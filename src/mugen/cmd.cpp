@@ -44,11 +44,11 @@ void CharacterCommands::readFile(const std::string & filepath)
 			if (kv.name() == "name")
 				currentDefinition->name = kv.value();
 			else if (kv.name() == "command")
-				currentDefinition->inputs = readInputDefinition(kv.value());
+				currentDefinition->inputs = readInputDefinition(std::string(kv.value()));
 			else if (kv.name() == "time")
-				currentDefinition->time = std::stoi(kv.value());
+				currentDefinition->time = std::stoi(std::string(kv.value()));
 			else if (kv.name() == "buffer.time")
-				currentDefinition->buffertime = std::stoi(kv.value());
+				currentDefinition->buffertime = std::stoi(std::string(kv.value()));
 		}
 	}
 }
@@ -10,50 +10,52 @@ DefinitionFile::DefinitionFile()
 
 }
 
-DefinitionFile::DefinitionFile(DefinitionFile && definitionFile)
-{
-	std::swap(m_sections, definitionFile.m_sections);
-}
-
 DefinitionFile::DefinitionFile(const std::string & filepath)
 {
 	readFile(filepath);
 }
 
-DefinitionFile & DefinitionFile::operator=(DefinitionFile && definitionFile)
+DefinitionFile & DefinitionFile::readFile(const std::string & filepath)
 {
-	std::swap(m_sections, definitionFile.m_sections);
+	MugenTextFile def(filepath);
+	MugenTextKeyValue kv;
+	Symbol section = sym::empty;
+	while ((kv = def.nextValue())) {
+		// the section is interned once, on its first value
+		if (def.newSection())
+			section = SymbolTable::intern(def.section());
+		m_values[entry(section, SymbolTable::intern(kv.name()))] = kv.value();
+	}
 	return *this;
 }
 
-DefinitionFile & DefinitionFile::operator=(const DefinitionFile & definitionFile)
+bool DefinitionFile::has(Symbol section, Symbol key) const
 {
-	m_sections = definitionFile.sections();
-	return *this;
+	return m_values.count(entry(section, key));
 }
 
-DefinitionFile & DefinitionFile::readFile(const std::string & filepath)
+std::string_view DefinitionFile::get(Symbol section, Symbol key) const
 {
-	MugenTextFile def(filepath);
-	MugenTextKeyValue kv;
-	while ((kv = def.nextValue())) {
-		std::string identifier = kv.name();
-		std::transform(identifier.begin(), identifier.end(), identifier.begin(), ::tolower);
-		std::string section = def.section();
-		std::transform(section.begin(), section.end(), section.begin(), ::tolower);
-		m_sections[section][identifier] = kv.value();
-	}
-	return *this;
+	auto value = m_values.find(entry(section, key));
+	if (value == m_values.end())
+		return std::string_view();
+	return value->second;
 }
 
-const std::unordered_map<std::string, std::unordered_map<std::string, std::string>> & DefinitionFile::sections() const
+bool DefinitionFile::has(std::string_view section, std::string_view key) const
 {
-	return m_sections;
+	const Symbol sectionSymbol = SymbolTable::find(section);
+	const Symbol keySymbol = SymbolTable::find(key);
+	return sectionSymbol != SymbolTable::NONE && keySymbol != SymbolTable::NONE && has(sectionSymbol, keySymbol);
 }
 
-std::unordered_map< std::string, std::string > & DefinitionFile::operator[] (const std::string & section)
+std::string_view DefinitionFile::get(std::string_view section, std::string_view key) const
 {
-	return m_sections[section];
+	const Symbol sectionSymbol = SymbolTable::find(section);
+	const Symbol keySymbol = SymbolTable::find(key);
+	if (sectionSymbol == SymbolTable::NONE || keySymbol == SymbolTable::NONE)
+		return std::string_view();
+	return get(sectionSymbol, keySymbol);
 }
 
 }
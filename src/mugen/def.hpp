@@ -1,24 +1,38 @@
 #ifndef DEF_H
 #define DEF_H
 
+#include "symbols.hpp"
+
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 namespace Nugem {
 namespace Mugen {
 
+/**
+ * Values of a definition file, by section and key, both case-insensitive.
+ *
+ * The sections and keys are symbols of the SymbolTable: def.get(sym::files, sym::sprite) looks the value up without allocating.
+ */
 class DefinitionFile {
 private:
-	std::unordered_map<std::string, std::unordered_map<std::string, std::string>> m_sections;
+	// the section symbol in the high half, the key symbol in the low one
+	static uint64_t entry(Symbol section, Symbol key) { return static_cast<uint64_t>(section) << 32 | key; };
+	struct EntryHash {
+		size_t operator()(uint64_t entry) const { return (entry >> 32) * 0x9E3779B1u ^ (entry & 0xFFFFFFFF); };
+	};
+	std::unordered_map<uint64_t, std::string, EntryHash> m_values;
 public:
 	DefinitionFile();
 	DefinitionFile(const std::string & filepath);
-	DefinitionFile(DefinitionFile && definitionFile);
-	DefinitionFile & operator=(DefinitionFile && definitionFile);
-	DefinitionFile & operator=(const DefinitionFile & definitionFile);
 	DefinitionFile & readFile(const std::string & filepath);
-	std::unordered_map<std::string, std::string> & operator[](const std::string& section);
-	const std::unordered_map<std::string, std::unordered_map<std::string, std::string>> & sections() const;
+	bool has(Symbol section, Symbol key) const;
+	// Value of the key in the section, empty if there is none
+	std::string_view get(Symbol section, Symbol key) const;
+	// The same, for names that may not be symbols yet
+	bool has(std::string_view section, std::string_view key) const;
+	std::string_view get(std::string_view section, std::string_view key) const;
 };
 
 }
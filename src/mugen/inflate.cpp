@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "inflate.hpp"
+
+#include <cstring>
+
+namespace Nugem {
+namespace Mugen {
+
+namespace {
+
+const uint16_t LENGTH_BASES[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t LENGTH_EXTRA_BITS[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t DISTANCE_BASES[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t DISTANCE_EXTRA_BITS[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+// order in which the lengths of the code length code are stored
+const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+}
+
+Inflater::Inflater(const Source & source, const Sink & sink): m_source(source), m_sink(sink), m_input(nullptr), m_inputEnd(nullptr), m_bitBuffer(0), m_bitCount(0), m_output(new uint8_t[2 * WINDOW_SIZE]), m_position(0), m_flushed(0)
+{
+}
+
+bool Inflater::Huffman::build(const uint8_t * lengths, size_t nSymbols)
+{
+    memset(counts, 0, sizeof(counts));
+    for (size_t symbol = 0; symbol < nSymbols; symbol++)
+        counts[lengths[symbol]]++;
+    counts[0] = 0;
+    // an over-subscribed code is invalid, an incomplete one is allowed
+    int left = 1;
+    uint16_t offsets[MAX_BITS + 2];
+    offsets[1] = 0;
+    for (unsigned length = 1; length <= MAX_BITS; length++) {
+        left = (left << 1) - counts[length];
+        if (left < 0)
+            return false;
+        offsets[length + 1] = offsets[length] + counts[length];
+    }
+    for (size_t symbol = 0; symbol < nSymbols; symbol++) {
+        if (lengths[symbol])
+            symbols[offsets[lengths[symbol]]++] = symbol;
+    }
+    // the bits of a code come first bit first: the table is indexed by the reversed codes
+    memset(fast, 0, sizeof(fast));
+    unsigned code = 0;
+    size_t index = 0;
+    for (unsigned length = 1; length <= FAST_BITS; length++, code <<= 1) {
+        for (unsigned i = 0; i < counts[length]; i++, code++, index++) {
+            unsigned reversed = 0;
+            for (unsigned bit = 0; bit < length; bit++)
+                reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+            for (unsigned entry = reversed; entry < (1u << FAST_BITS); entry += 1u << length)
+                fast[entry] = length << 9 | symbols[index];
+        }
+    }
+    return true;
+}
+
+bool Inflater::fill(unsigned nBits)
+{
+    while (m_bitCount < nBits) {
+        while (m_input == m_inputEnd) {
+            const uint8_t * data = nullptr;
+            size_t size = 0;
+            if (!m_source(data, size))
+                return false;
+            m_input = data;
+            m_inputEnd = data + size;
+        }
+        m_bitBuffer |= static_cast<uint64_t>(*m_input++) << m_bitCount;
+        m_bitCount += 8;
+    }
+    return true;
+}
+
+uint32_t Inflater::bits(unsigned nBits)
+{
+    const uint32_t value = m_bitBuffer & ((1ull << nBits) - 1);
+    m_bitBuffer >>= nBits;
+    m_bitCount -= nBits;
+    return value;
+}
+
+bool Inflater::decodeSymbol(const Huffman & huffman, unsigned & symbol)
+{
+    // as many bits as there are: the stream may end right after a short code
+    while (m_bitCount <= 56) {
+        if (m_input == m_inputEnd) {
+            const uint8_t * data = nullptr;
+            size_t size = 0;
+            if (m_bitCount >= MAX_BITS || !m_source(data, size))
+                break;
+            m_input = data;
+            m_inputEnd = data + size;
+            continue;
+        }
+        m_bitBuffer |= static_cast<uint64_t>(*m_input++) << m_bitCount;
+        m_bitCount += 8;
+    }
+    const uint16_t entry = huffman.fast[m_bitBuffer & ((1u << FAST_BITS) - 1)];
+    if (entry) {
+        if ((entry >> 9) > m_bitCount)
+            return false;
+        bits(entry >> 9);
+        symbol = entry & 0x1FF;
+        return true;
+    }
+    // longer codes, a bit at a time
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (unsigned length = 1; length <= MAX_BITS && length <= m_bitCount; length++) {
+        code |= (m_bitBuffer >> (length - 1)) & 1;
+        const int count = huffman.counts[length];
+        if (code - first < count) {
+            bits(length);
+            symbol = huffman.symbols[index + code - first];
+            return true;
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return false;
+}
+
+bool Inflater::flush()
+{
+    if (m_position > m_flushed && !m_sink(m_output.get() + m_flushed, m_position - m_flushed))
+        return false;
+    if (m_position > WINDOW_SIZE) {
+        memmove(m_output.get(), m_output.get() + m_position - WINDOW_SIZE, WINDOW_SIZE);
+        m_position = WINDOW_SIZE;
+    }
+    m_flushed = m_position;
+    return true;
+}
+
+bool Inflater::storedBlock()
+{
+    // the length comes at the next byte boundary
+    bits(m_bitCount % 8);
+    if (!fill(32))
+        return false;
+    const uint32_t length = bits(16);
+    if ((~bits(16) & 0xFFFF) != length)
+        return false;
+    for (uint32_t i = 0; i < length; i++) {
+        if (!fill(8))
+            return false;
+        if (m_position == 2 * WINDOW_SIZE && !flush())
+            return false;
+        m_output[m_position++] = bits(8);
+    }
+    return true;
+}
+
+bool Inflater::dynamicTables(Huffman & lengths, Huffman & distances)
+{
+    if (!fill(14))
+        return false;
+    const unsigned nLengths = bits(5) + 257;
+    const unsigned nDistances = bits(5) + 1;
+    const unsigned nCodeLengths = bits(4) + 4;
+    if (nLengths > 286 || nDistances > 30)
+        return false;
+    uint8_t codeLengths[19] = { 0 };
+    for (unsigned i = 0; i < nCodeLengths; i++) {
+        if (!fill(3))
+            return false;
+        codeLengths[CODE_LENGTH_ORDER[i]] = bits(3);
+    }
+    Huffman codeLengthCode;
+    if (!codeLengthCode.build(codeLengths, 19))
+        return false;
+    uint8_t symbolLengths[286 + 30];
+    unsigned n = 0;
+    while (n < nLengths + nDistances) {
+        unsigned symbol;
+        if (!decodeSymbol(codeLengthCode, symbol))
+            return false;
+        if (symbol < 16) {
+            symbolLengths[n++] = symbol;
+            continue;
+        }
+        uint8_t repeated = 0;
+        unsigned repeat;
+        if (symbol == 16) {
+            if (n == 0 || !fill(2))
+                return false;
+            repeated = symbolLengths[n - 1];
+            repeat = 3 + bits(2);
+        }
+        else if (symbol == 17) {
+            if (!fill(3))
+                return false;
+            repeat = 3 + bits(3);
+        }
+        else {
+            if (!fill(7))
+                return false;
+            repeat = 11 + bits(7);
+        }
+        if (n + repeat > nLengths + nDistances)
+            return false;
+        memset(symbolLengths + n, repeated, repeat);
+        n += repeat;
+    }
+    // the end of block code must be there
+    if (!symbolLengths[256])
+        return false;
+    return lengths.build(symbolLengths, nLengths) && distances.build(symbolLengths + nLengths, nDistances);
+}
+
+bool Inflater::codes(const Huffman & lengths, const Huffman & distances)
+{
+    for (;;) {
+        unsigned symbol;
+        if (!decodeSymbol(lengths, symbol))
+            return false;
+        if (symbol < 256) {
+            if (m_position == 2 * WINDOW_SIZE && !flush())
+                return false;
+            m_output[m_position++] = symbol;
+            continue;
+        }
+        if (symbol == 256)
+            return true;
+        symbol -= 257;
+        if (symbol >= 29 || !fill(LENGTH_EXTRA_BITS[symbol]))
+            return false;
+        const size_t length = LENGTH_BASES[symbol] + bits(LENGTH_EXTRA_BITS[symbol]);
+        if (!decodeSymbol(distances, symbol) || symbol >= 30 || !fill(DISTANCE_EXTRA_BITS[symbol]))
+            return false;
+        const size_t distance = DISTANCE_BASES[symbol] + bits(DISTANCE_EXTRA_BITS[symbol]);
+        if (m_position + length > 2 * WINDOW_SIZE && !flush())
+            return false;
+        if (distance > m_position)
+            return false;
+        uint8_t * output = m_output.get() + m_position;
+        const uint8_t * copied = output - distance;
+        if (distance >= length)
+            memcpy(output, copied, length);
+        else // the copy overlaps what it writes
+            for (size_t i = 0; i < length; i++)
+                output[i] = copied[i];
+        m_position += length;
+    }
+}
+
+bool Inflater::inflate()
+{
+    bool last = false;
+    while (!last) {
+        if (!fill(3))
+            return false;
+        last = bits(1);
+        const unsigned type = bits(2);
+        bool valid = false;
+        if (type == 0) {
+            valid = storedBlock();
+        }
+        else if (type == 1) {
+            // fixed codes, built once
+            static const struct FixedCodes {
+                Huffman lengths;
+                Huffman distances;
+                FixedCodes() {
+                    uint8_t symbolLengths[288];
+                    memset(symbolLengths, 8, 144);
+                    memset(symbolLengths + 144, 9, 112);
+                    memset(symbolLengths + 256, 7, 24);
+                    memset(symbolLengths + 280, 8, 8);
+                    lengths.build(symbolLengths, 288);
+                    memset(symbolLengths, 5, 30);
+                    distances.build(symbolLengths, 30);
+                }
+            } fixedCodes;
+            valid = codes(fixedCodes.lengths, fixedCodes.distances);
+        }
+        else if (type == 2) {
+            Huffman lengths;
+            Huffman distances;
+            valid = dynamicTables(lengths, distances) && codes(lengths, distances);
+        }
+        if (!valid) {
+            flush();
+            return false;
+        }
+    }
+    return flush();
+}
+
+bool Inflater::inflateZlib()
+{
+    if (!fill(16))
+        return false;
+    const uint32_t method = bits(8);
+    const uint32_t flags = bits(8);
+    // deflate compression, no preset dictionary
+    if ((method & 0x0F) != 8 || (method >> 4) > 7 || (method << 8 | flags) % 31 || (flags & 0x20))
+        return false;
+    return inflate();
+}
+
+}
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INFLATE_HPP
+#define INFLATE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace Nugem {
+namespace Mugen {
+
+/**
+ * Streaming DEFLATE decoder (RFC 1951), for the PNG sprites.
+ *
+ * The compressed data is pulled from a source, piece by piece, and the output is pushed to a sink as it is produced:
+ * only the last 32 KiB of output, which back references can reach, are kept.
+ */
+class Inflater {
+public:
+	// Gives the next piece of compressed data, false when there is none left
+	typedef std::function<bool(const uint8_t * & data, size_t & size)> Source;
+	// Receives the next piece of output, false to stop inflating
+	typedef std::function<bool(const uint8_t * data, size_t size)> Sink;
+	Inflater(const Source & source, const Sink & sink);
+	// Inflates a zlib stream (RFC 1950), without checking its checksum.
+	// false if the data is invalid or truncated, or if the sink stopped: the output given so far stays valid.
+	bool inflateZlib();
+	// Same, for raw DEFLATE data
+	bool inflate();
+private:
+	static const unsigned MAX_BITS = 15;
+	static const unsigned FAST_BITS = 10;
+	static const size_t WINDOW_SIZE = 32768;
+	// Canonical Huffman code, with a table of the codes of at most FAST_BITS bits
+	struct Huffman {
+		uint16_t counts[MAX_BITS + 1];
+		uint16_t symbols[288];
+		// (length << 9 | symbol) indexed by the next FAST_BITS bits, 0 for the longer codes
+		uint16_t fast[1 << FAST_BITS];
+		// false if the lengths do not make a prefix code
+		bool build(const uint8_t * lengths, size_t nSymbols);
+	};
+	bool fill(unsigned nBits);
+	uint32_t bits(unsigned nBits);
+	bool decodeSymbol(const Huffman & huffman, unsigned & symbol);
+	bool storedBlock();
+	bool dynamicTables(Huffman & lengths, Huffman & distances);
+	bool codes(const Huffman & lengths, const Huffman & distances);
+	// hands the output to the sink, keeping the window
+	bool flush();
+	Source m_source;
+	Sink m_sink;
+	const uint8_t * m_input;
+	const uint8_t * m_inputEnd;
+	uint64_t m_bitBuffer;
+	unsigned m_bitCount;
+	// output, twice the window: the first half is only there for the back references
+	std::unique_ptr<uint8_t[]> m_output;
+	size_t m_position;
+	size_t m_flushed;
+};
+
+}
+}
+
+#endif // INFLATE_HPP
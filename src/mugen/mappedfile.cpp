@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mappedfile.hpp"
+
+#include <utility>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Nugem {
+namespace Mugen {
+
+MappedFile::MappedFile(): m_data(nullptr), m_size(0), m_mapped(false)
+{
+}
+
+MappedFile::MappedFile(const std::string & path): MappedFile()
+{
+	open(path);
+}
+
+MappedFile::MappedFile(MappedFile && mappedFile): MappedFile()
+{
+	*this = std::move(mappedFile);
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile & MappedFile::operator=(MappedFile && mappedFile)
+{
+	std::swap(m_data, mappedFile.m_data);
+	std::swap(m_size, mappedFile.m_size);
+	std::swap(m_mapped, mappedFile.m_mapped);
+	std::swap(m_buffer, mappedFile.m_buffer);
+	return *this;
+}
+
+bool MappedFile::open(const std::string & path)
+{
+	close();
+#if defined(_WIN32)
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		return false;
+	m_buffer.resize(file.tellg());
+	file.seekg(0, std::ios::beg);
+	if (m_buffer.empty() || !file.read(reinterpret_cast<char *>(m_buffer.data()), m_buffer.size())) {
+		m_buffer.clear();
+		return false;
+	}
+	m_data = m_buffer.data();
+	m_size = m_buffer.size();
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat filestat;
+	if (fstat(fd, &filestat) < 0 || filestat.st_size <= 0) {
+		::close(fd);
+		return false;
+	}
+	void * mapping = mmap(nullptr, filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps its own reference to the file
+	::close(fd);
+	if (mapping == MAP_FAILED)
+		return false;
+	m_data = static_cast<const uint8_t *>(mapping);
+	m_size = filestat.st_size;
+	m_mapped = true;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+#if !defined(_WIN32)
+	if (m_mapped)
+		munmap(const_cast<uint8_t *>(m_data), m_size);
+#endif
+	m_buffer.clear();
+	m_data = nullptr;
+	m_size = 0;
+	m_mapped = false;
+}
+
+}
+}
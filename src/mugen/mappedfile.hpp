@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Nugem {
+namespace Mugen {
+
+/**
+ * Read-only view of the whole contents of a file.
+ *
+ * The file is memory-mapped where the platform allows it, and read into memory in one go otherwise.
+ * Pointers returned by data() stay valid until the object is closed or destroyed.
+ */
+class MappedFile {
+public:
+	MappedFile();
+	MappedFile(const std::string & path);
+	MappedFile(MappedFile && mappedFile);
+	MappedFile(const MappedFile &) = delete;
+	~MappedFile();
+	MappedFile & operator=(MappedFile && mappedFile);
+	MappedFile & operator=(const MappedFile &) = delete;
+	bool open(const std::string & path);
+	void close();
+	const uint8_t * data() const { return m_data; };
+	size_t size() const { return m_size; };
+	operator bool() const { return m_data != nullptr; };
+private:
+	const uint8_t * m_data;
+	size_t m_size;
+	bool m_mapped;
+	std::vector<uint8_t> m_buffer;
+};
+
+}
+}
+
+#endif // MAPPEDFILE_HPP
@@ -1,156 +1,154 @@
 #include "mugenutils.hpp"
 
-#include <fstream>
-#include <sstream>
-#include <iostream>
-
-#include "sprites.hpp"
-
 using namespace std;
 
 namespace Nugem {
 namespace Mugen {
-	
 
-istream & _getline(std::istream & __is, std::string & __str)
+namespace {
+
+bool isBlank(char c)
 {
-    std::istream & _is = getline(__is, __str);
-	// Cut the line at the comments: find the ; character
-	bool ignored = false;
-	for (unsigned int index = 0; index < __str.size(); index++) {
-		if (ignored) {
-			if (__str[index] == '\"')
-				ignored = false;
-			continue;
-		}
-		// else
-		switch (__str[index]) {
-		case '"':
-			ignored = true;
-			break;
-		case ';': // do not process comments
-			__str = __str.substr(0, index);
-			index = __str.size();
-			break;
-		}
-	}
-	return _is;
+	return c == ' ' || c == '\t';
 }
 
-const regex MugenTextFile::regexSectionHeader("^[ \t]*\\[[ \t]*([^\\]]+?)[ \t]*\\][ \t\r]*$");
-const regex MugenTextFile::regexKeyValue("^[ \t]*([^=]+?)[ \t]*=[ \t]*([^\r]+?)[ \t\r]*$");
-const regex MugenTextFile::regexKeyQuotedValue("^[ \t]*([^=]+?)[ \t]*=[ \t]*\"([^\r\"]+?)\"[ \t\r]*$");
-
-MugenTextFile::MugenTextFile(const std::string & path): m_path(path), m_inputstream(path)
+// The text between the leading blanks and the given trailing characters.
+// Blank text keeps its last leading blank, as a field cannot be empty.
+bool trimField(string_view text, string_view trailing, string_view & field)
 {
-	m_section = "";
+	size_t first = 0;
+	while (first < text.size() && isBlank(text[first]))
+		first++;
+	size_t last = text.size();
+	while (last > first && trailing.find(text[last - 1]) != string_view::npos)
+		last--;
+	if (first == last) {
+		if (first == 0)
+			return false;
+		first--;
+		last = first + 1;
+	}
+	field = text.substr(first, last - first);
+	return true;
 }
 
-MugenTextFile::~MugenTextFile()
+}
+
+MugenTextFile::MugenTextFile(const std::string & path): m_path(path)
 {
-	if (m_inputstream.is_open())
-		m_inputstream.close();
+	m_good = m_file.open(path);
 }
 
-const std::string & MugenTextFile::section() const
+string_view MugenTextFile::section() const
 {
 	return m_section;
 }
 
-const bool MugenTextFile::newSection() const
+bool MugenTextFile::newSection() const
 {
 	return m_newSection;
 }
 
-const std::string MugenTextFile::nextLine()
+bool MugenTextFile::readLine(string_view & line)
 {
-	m_newSection = false;
-	std::string s;
-	_getline(m_inputstream, s);
-	smatch sm;
-	if (regex_match(s, sm, regexSectionHeader)) {
-		m_section = sm[1];
-		m_newSection = true;
+	if (!m_good || m_position >= m_file.size()) {
+		m_good = false;
+		return false;
+	}
+	const char * text = reinterpret_cast<const char *>(m_file.data());
+	const size_t start = m_position;
+	// Cut the line at the comments: the ; characters out of quotes
+	size_t end = string_view::npos;
+	bool quoted = false;
+	for (; m_position < m_file.size() && text[m_position] != '\n'; m_position++) {
+		if (text[m_position] == '"')
+			quoted = !quoted;
+		else if (text[m_position] == ';' && !quoted && end == string_view::npos)
+			end = m_position;
 	}
-	return s;
+	if (end == string_view::npos)
+		end = m_position;
+	// skip the \n
+	m_position++;
+	line = string_view(text + start, end - start);
+	return true;
 }
 
-MugenTextFile::operator bool() const
+bool MugenTextFile::readSectionHeader(string_view line)
 {
-	return (bool) m_inputstream;
+	// [ section name ], followed by blanks only
+	size_t open = 0;
+	while (open < line.size() && isBlank(line[open]))
+		open++;
+	if (open == line.size() || line[open] != '[')
+		return false;
+	const size_t close = line.find(']', open + 1);
+	if (close == string_view::npos || line.find_first_not_of(" \t\r", close + 1) != string_view::npos)
+		return false;
+	if (!trimField(line.substr(open + 1, close - open - 1), " \t", m_section))
+		return false;
+	m_newSection = true;
+	return true;
 }
 
-const MugenTextKeyValue MugenTextFile::nextValue()
+string_view MugenTextFile::nextLine()
 {
-	std::string line;
 	m_newSection = false;
-	while (_getline(m_inputstream, line)) {
-		smatch sm;
-		if (regex_match(line, sm, regexSectionHeader)) {
-			m_section = sm[1];
-			m_newSection = true;
-		}
-		else if (regex_match(line, sm, regexKeyQuotedValue)) {
-			return MugenTextKeyValue(sm[1], sm[2]);
-		}
-		else if (regex_match(line, sm, regexKeyValue)) {
-			return MugenTextKeyValue(sm[1], sm[2]);
-		}
-	}
-	return MugenTextKeyValue();
+	string_view line;
+	if (readLine(line))
+		readSectionHeader(line);
+	return line;
 }
 
-MugenTextKeyValue::MugenTextKeyValue(): m_empty(true)
+MugenTextFile::operator bool() const
 {
+	return m_good;
 }
 
-MugenTextKeyValue MugenTextKeyValue::read(const std::string & stringToRead)
+MugenTextKeyValue MugenTextFile::nextValue()
 {
-	smatch sm;
-	if (regex_match(stringToRead, sm, MugenTextFile::regexKeyQuotedValue)) {
-		return MugenTextKeyValue(sm[1], sm[2]);
-	}
-	else if (regex_match(stringToRead, sm, MugenTextFile::regexKeyValue)) {
-		return MugenTextKeyValue(sm[1], sm[2]);
+	string_view line;
+	m_newSection = false;
+	while (readLine(line)) {
+		if (readSectionHeader(line))
+			continue;
+		MugenTextKeyValue kv = MugenTextKeyValue::read(line);
+		if (kv)
+			return kv;
 	}
 	return MugenTextKeyValue();
 }
 
-MugenTextKeyValue::MugenTextKeyValue(std::string key, std::string value): m_key(key), m_value(value)
-{
-}
-
-MugenTextKeyValue::MugenTextKeyValue(const MugenTextKeyValue & kvpair): m_key(kvpair.name()), m_value(kvpair.value())
-{
-}
-
-MugenTextKeyValue::MugenTextKeyValue(MugenTextKeyValue && kvpair)
+MugenTextKeyValue::MugenTextKeyValue(): m_empty(true)
 {
-	swap(m_empty, kvpair.m_empty);
-	if (!m_empty) {
-		swap(m_key, kvpair.m_key);
-		swap(m_value, kvpair.m_value);
-	}
 }
 
-MugenTextKeyValue & MugenTextKeyValue::operator=(MugenTextKeyValue && kvpair)
+MugenTextKeyValue MugenTextKeyValue::read(string_view stringToRead)
 {
-	swap(m_empty, kvpair.m_empty);
-	if (!m_empty) {
-		swap(m_key, kvpair.m_key);
-		swap(m_value, kvpair.m_value);
+	// the key ends at the first =
+	const size_t equal = stringToRead.find('=');
+	string_view key;
+	if (equal == string_view::npos || !trimField(stringToRead.substr(0, equal), " \t", key))
+		return MugenTextKeyValue();
+	const string_view rest = stringToRead.substr(equal + 1);
+	// the quotes of a quoted value are left out
+	const size_t quote = rest.find_first_not_of(" \t");
+	if (quote != string_view::npos && rest[quote] == '"') {
+		const size_t closingQuote = rest.find('"', quote + 1);
+		if (closingQuote != string_view::npos && closingQuote > quote + 1 && rest.find_first_not_of(" \t\r", closingQuote + 1) == string_view::npos) {
+			const string_view value = rest.substr(quote + 1, closingQuote - quote - 1);
+			if (value.find('\r') == string_view::npos)
+				return MugenTextKeyValue(key, value);
+		}
 	}
-	return *this;
+	string_view value;
+	if (!trimField(rest, " \t\r", value) || value.find('\r') != string_view::npos)
+		return MugenTextKeyValue();
+	return MugenTextKeyValue(key, value);
 }
 
-MugenTextKeyValue & MugenTextKeyValue::operator=(const MugenTextKeyValue & kvpair)
+MugenTextKeyValue::MugenTextKeyValue(string_view key, string_view value): m_key(key), m_value(value)
 {
-	m_empty = ! (bool) kvpair;
-	if (!m_empty) {
-		m_key = kvpair.name();
-		m_value = kvpair.value();
-	}
-	return *this;
 }
 
 MugenTextKeyValue::operator bool() const
@@ -158,12 +156,12 @@ MugenTextKeyValue::operator bool() const
 	return !m_empty;
 }
 
-const std::string & MugenTextKeyValue::name() const
+string_view MugenTextKeyValue::name() const
 {
 	return m_key;
 }
 
-const std::string & MugenTextKeyValue::value() const
+string_view MugenTextKeyValue::value() const
 {
 	return m_value;
 }
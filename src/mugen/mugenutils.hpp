@@ -2,52 +2,62 @@
 #define MUGENUTILS_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
-#include <fstream>
-#include <regex>
+
+#include "mappedfile.hpp"
 
 namespace Nugem {
 namespace Mugen {
 
-// ::std::getline adjusted for the ; comment character
-::std::istream& _getline(::std::istream& __is, ::std::string& __str);
-
+// Key and value of a "key = value" line, viewing the text they were read from
 class MugenTextKeyValue {
 public:
-	static MugenTextKeyValue read(const ::std::string & stringToRead);
+	// Reads a "key = value" or a "key = "value"" line, or returns an empty pair
+	static MugenTextKeyValue read(::std::string_view stringToRead);
 	MugenTextKeyValue();
-	MugenTextKeyValue(::std::string key, ::std::string value);
-	MugenTextKeyValue(const MugenTextKeyValue & kvpair);
-	MugenTextKeyValue(MugenTextKeyValue && kvpair);
-	const ::std::string & name() const;
-	const ::std::string & value() const;
+	MugenTextKeyValue(::std::string_view key, ::std::string_view value);
+	::std::string_view name() const;
+	::std::string_view value() const;
 	operator bool() const;
-	MugenTextKeyValue & operator=(MugenTextKeyValue && kvpair);
-	MugenTextKeyValue & operator=(const MugenTextKeyValue & kvpair);
 private:
-	::std::string m_key;
-	::std::string m_value;
+	::std::string_view m_key;
+	::std::string_view m_value;
 	bool m_empty = false;
 };
 
+/**
+ * Reader of the text files of Mugen (DEF, CMD, AIR...), line by line, in a single pass over the mapped file.
+ *
+ * The lines are cut at the ; comments that are not within quotes.
+ * The sections, lines, keys and values returned view the file: they stay valid as long as the MugenTextFile.
+ */
 class MugenTextFile {
 public:
 	MugenTextFile(const ::std::string & path);
-	~MugenTextFile();
-	const MugenTextKeyValue nextValue();
-	const ::std::string nextLine();
-	const ::std::string & section() const;
-	const bool newSection() const;
+	MugenTextFile(const MugenTextFile &) = delete;
+	MugenTextFile & operator=(const MugenTextFile &) = delete;
+	// Next "key = value" line, through the section headers
+	MugenTextKeyValue nextValue();
+	// Next line, whatever it holds
+	::std::string_view nextLine();
+	::std::string_view section() const;
+	// true when the last line read went through a section header
+	bool newSection() const;
+	// false once a read went past the last line
 	operator bool() const;
-	static const ::std::regex regexSectionHeader;
-	static const ::std::regex regexKeyValue;
-	static const ::std::regex regexKeyQuotedValue;
 private:
+	// Next line without its comment, false past the last one
+	bool readLine(::std::string_view & line);
+	// Reads a "[section]" header into m_section
+	bool readSectionHeader(::std::string_view line);
 	bool m_newSection = false;
-	::std::string m_section;
+	::std::string_view m_section;
 	const ::std::string m_path;
-	::std::ifstream m_inputstream;
+	MappedFile m_file;
+	size_t m_position = 0;
+	bool m_good;
 };
 
 }
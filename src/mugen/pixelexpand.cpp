@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pixelexpand.hpp"
+
+#include <SDL.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NUGEM_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(NUGEM_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#define NUGEM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NUGEM_TARGET(isa)
+#endif
+
+namespace Nugem {
+namespace Mugen {
+
+void expandIndicesScalar(const uint8_t * indices, size_t count, const uint32_t * colors, uint32_t * pixels)
+{
+	for (size_t i = 0; i < count; i++)
+		pixels[i] = colors[indices[i]];
+}
+
+#if defined(NUGEM_X86_SIMD)
+
+// SSE2 has no gather: the table loads stay scalar, the stores are 16 bytes wide
+NUGEM_TARGET("sse2")
+static void expandIndicesSse2(const uint8_t * indices, size_t count, const uint32_t * colors, uint32_t * pixels)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i pixelGroup = _mm_setr_epi32(colors[indices[i]], colors[indices[i + 1]], colors[indices[i + 2]], colors[indices[i + 3]]);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + i), pixelGroup);
+	}
+	expandIndicesScalar(indices + i, count - i, colors, pixels + i);
+}
+
+// 8 pixels at a time: the indices are widened to 32 bits and used to gather the colors
+NUGEM_TARGET("avx2")
+static void expandIndicesAvx2(const uint8_t * indices, size_t count, const uint32_t * colors, uint32_t * pixels)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i indexGroup = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(indices + i)));
+		__m256i pixelGroup = _mm256_i32gather_epi32(reinterpret_cast<const int *>(colors), indexGroup, 4);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels + i), pixelGroup);
+	}
+	expandIndicesScalar(indices + i, count - i, colors, pixels + i);
+}
+
+#endif
+
+ExpandFunction expandIndicesFunction(ExpandPath path)
+{
+	switch (path) {
+#if defined(NUGEM_X86_SIMD)
+	case ExpandPath::Avx2:
+		return SDL_HasAVX2() ? expandIndicesAvx2 : nullptr;
+	case ExpandPath::Sse2:
+		return SDL_HasSSE2() ? expandIndicesSse2 : nullptr;
+#endif
+	case ExpandPath::Scalar:
+		return expandIndicesScalar;
+	default:
+		return nullptr;
+	}
+}
+
+static ExpandFunction selectExpandFunction()
+{
+	if (ExpandFunction expand = expandIndicesFunction(ExpandPath::Avx2))
+		return expand;
+	if (ExpandFunction expand = expandIndicesFunction(ExpandPath::Sse2))
+		return expand;
+	return expandIndicesScalar;
+}
+
+void expandIndices(const uint8_t * indices, size_t count, const uint32_t * colors, uint32_t * pixels)
+{
+	static const ExpandFunction expand = selectExpandFunction();
+	expand(indices, count, colors, pixels);
+}
+
+}
+}
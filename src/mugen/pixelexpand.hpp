@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PIXELEXPAND_HPP
+#define PIXELEXPAND_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Nugem {
+namespace Mugen {
+
+// Writes colors[indices[i]] to pixels[i] for the count pixels.
+// Uses AVX2 or SSE2 when the processor has them.
+void expandIndices(const uint8_t * indices, size_t count, const uint32_t * colors, uint32_t * pixels);
+
+// Portable version of expandIndices
+void expandIndicesScalar(const uint8_t * indices, size_t count, const uint32_t * colors, uint32_t * pixels);
+
+enum class ExpandPath {
+	Scalar,
+	Sse2,
+	Avx2
+};
+
+typedef void (*ExpandFunction)(const uint8_t * indices, size_t count, const uint32_t * colors, uint32_t * pixels);
+
+// One version of expandIndices, nullptr if the build or the processor does not have it
+ExpandFunction expandIndicesFunction(ExpandPath path);
+
+}
+}
+
+#endif // PIXELEXPAND_HPP
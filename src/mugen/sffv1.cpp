@@ -19,12 +19,16 @@
 
 #include "sffv1.hpp"
 
+#include "spritedecoders.hpp"
 #include "../character.hpp"
+#include "../workerpool.hpp"
 
 #include <ios>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
 #include <array>
+#include <cstring>
 
 namespace Nugem {
 namespace Mugen {
@@ -32,41 +36,46 @@ namespace Mugen {
 
 uint16_t Sffv1::SpriteInfo::xmin() const
 {
-	return *( ((uint16_t * ) data) + 2);
+	return read_uint16(data + 4);
 }
 
 uint16_t Sffv1::SpriteInfo::xmax() const
 {
-	return *( ((uint16_t * ) data) + 4);;
+	return read_uint16(data + 8);
 }
 
 uint16_t Sffv1::SpriteInfo::ymin() const
 {
-	return *( ((uint16_t * ) data) + 3);;
+	return read_uint16(data + 6);
 }
 
 uint16_t Sffv1::SpriteInfo::ymax() const
 {
-	return *( ((uint16_t * ) data) + 5);;
+	return read_uint16(data + 10);
 }
 
 uint8_t Sffv1::SpriteInfo::nplanes() const
 {
-	return *( (uint8_t * ) data + 65);
+	return data[65];
 }
 
 uint16_t Sffv1::SpriteInfo::bytesPerLine() const
 {
-	return *( (uint16_t * ) data + 33);
+	return read_uint16(data + 66);
 }
 
 uint16_t Sffv1::SpriteInfo::width() const
 {
+	// without a complete PCX header there is no image to draw
+	if (dataSize < PCX_HEADER_SIZE)
+		return 0;
 	return xmax() - xmin() + 1;
 }
 
 uint16_t Sffv1::SpriteInfo::height() const
 {
+	if (dataSize < PCX_HEADER_SIZE)
+		return 0;
 	return ymax() - ymin() + 1;
 }
 
@@ -75,176 +84,290 @@ uint32_t Sffv1::SpriteInfo::totalBytesPerLine() const
 	return nplanes() * bytesPerLine();
 }
 
-Sffv1::Sffv1(const char * filename, const char * paletteFile): m_filename(filename), m_paletteFile(paletteFile)
+Sffv1::Sffv1(const char * filename, const std::vector<std::string> & paletteFiles): m_filename(filename), m_paletteFiles(paletteFiles)
 {
     m_sffv1Container.clear();
     m_palettes.clear();
     loadSffFile();
     loadSharedPalettes();
+    m_indexedPalettes = m_palettes;
+    updateColorTables();
 }
 
 Sffv1::~Sffv1()
 {
-    for (size_t i = 0; i < m_sffv1Container.size(); i++)
-        delete [] m_sffv1Container[i].data;
 }
 
 void Sffv1::loadSffFile()
 {
-    uint8_t * readbuf[READBUF_SIZE];
-    std::ifstream charfile(m_filename.c_str());
+    if (!m_file.open(m_filename))
+        throw std::runtime_error(std::string("Cannot open sprite file: ") + m_filename);
+    const uint8_t * filedata = m_file.data();
+    const size_t filesize = m_file.size();
     // First 512 bytes: header
     // Signature at the start of the file: 'ElecbyteSpr\0'
-    charfile.read((char *) readbuf, 12);
-    if (strcmp((char *) readbuf, "ElecbyteSpr")) {
+    if (filesize < HEADER_SIZE || memcmp(filedata, "ElecbyteSpr", 12)) {
         throw std::runtime_error(std::string("Invalid sprite file: ") + m_filename);
     }
     // Version bytes
-    std::array<uint8_t, 4> version = extract_version(charfile);
+    std::array<uint8_t, 4> version = extract_version(filedata + 12);
     // if the version is too high, throw it
     if (version[3] > 1)
         throw version;
     // Number of groups
-    m_ngroups = read_uint32(charfile);
-    m_nimages = read_uint32(charfile);
-    uint32_t nextSubfileOffset = read_uint32(charfile);
-    uint32_t subheaderSize = read_uint32(charfile);
-    uint8_t sharedPaletteByte;
-    charfile >> sharedPaletteByte;
-    m_sharedPalette = (sharedPaletteByte != 0);
-    // Reading the subfiles
-    while (charfile.good() && ((int) nextSubfileOffset) > 0 && m_sffv1Container.size() < m_nimages) {
-        SpriteInfo sprite;
-        charfile.seekg(nextSubfileOffset, std::ios::beg);
-        nextSubfileOffset = read_uint32(charfile);
-        sprite.dataSize = read_uint32(charfile);
-        sprite.axisX = read_uint16(charfile);
-        sprite.axisY = read_uint16(charfile);
-        sprite.group = read_uint16(charfile);
-        sprite.groupimage = read_uint16(charfile);
-        sprite.linkedindex = read_uint16(charfile);
-        uint8_t usesSharedPaletteByte;
-        charfile >> usesSharedPaletteByte;
-        sprite.usesSharedPalette = (usesSharedPaletteByte != 0);
-        charfile.seekg(13, std::ios::cur); // skipping the next 12 bytes, from byte 19 to byte 31
-        // According to formats.txt:
-        // "PCX graphic data. If palette data is available, it is the last 768 bytes."
-        sprite.data = new uint8_t[sprite.dataSize];
-        charfile.read((char *) sprite.data, sprite.dataSize);
-        // Add the sprites' index to its group and image number
-        m_groups[sprite.group].i[sprite.groupimage] = m_sffv1Container.size();
-        m_sffv1Container.emplace_back(std::move(sprite));
+    m_ngroups = read_uint32(filedata + 16);
+    m_nimages = read_uint32(filedata + 20);
+    // each subfile takes at least its header after the file header: a larger count is not to be believed
+    m_nimages = std::min<size_t>(m_nimages, (filesize - HEADER_SIZE) / SUBHEADER_SIZE);
+    m_nextSubfileOffset = read_uint32(filedata + 24);
+    // bytes 28 to 31: size of a subfile header, always 32
+    m_sharedPalette = (filedata[32] != 0);
+    m_scanComplete = false;
+    // no reallocation while scanning: the drawers keep references to the sprites
+    m_sffv1Container.reserve(m_nimages);
+}
+
+bool Sffv1::scanNextSubfile()
+{
+    const uint8_t * filedata = m_file.data();
+    const size_t filesize = m_file.size();
+    if (m_scanComplete)
+        return false;
+    if (m_nextSubfileOffset == 0 || m_nextSubfileOffset > filesize - SUBHEADER_SIZE || m_sffv1Container.size() >= m_nimages) {
+        m_scanComplete = true;
+        m_index.clear();
+        m_index.reserve(m_sffv1Container.size());
+        for (size_t i = 0; i < m_sffv1Container.size(); i++)
+            m_index.add(Spriteref(m_sffv1Container[i].group, m_sffv1Container[i].groupimage), i);
+        m_index.build(true);
+        return false;
     }
-    charfile.close();
+    // Reading the subfile header, straight from the mapped file
+    const uint8_t * subheader = filedata + m_nextSubfileOffset;
+    const size_t dataOffset = m_nextSubfileOffset + SUBHEADER_SIZE;
+    SpriteInfo sprite;
+    m_nextSubfileOffset = read_uint32(subheader);
+    sprite.dataSize = read_uint32(subheader + 4);
+    sprite.axisX = read_uint16(subheader + 8);
+    sprite.axisY = read_uint16(subheader + 10);
+    sprite.group = read_uint16(subheader + 12);
+    sprite.groupimage = read_uint16(subheader + 14);
+    sprite.linkedindex = read_uint16(subheader + 16);
+    sprite.usesSharedPalette = (subheader[18] != 0);
+    // bytes 19 to 31 are blank
+    // According to formats.txt:
+    // "PCX graphic data. If palette data is available, it is the last 768 bytes."
+    // The data is not copied: the sprite points into the mapping, and is only read when drawn
+    sprite.data = filedata + dataOffset;
+    if (sprite.dataSize > filesize - dataOffset)
+        sprite.dataSize = filesize - dataOffset;
+    m_scannedRefs.emplace(Spriteref(sprite.group, sprite.groupimage), m_sffv1Container.size());
+    m_sffv1Container.push_back(sprite);
+    return true;
+}
+
+void Sffv1::scanSubfiles(size_t count)
+{
+    while (m_sffv1Container.size() < count && scanNextSubfile());
+}
+
+void Sffv1::scanAllSubfiles()
+{
+    while (scanNextSubfile());
+}
+
+size_t Sffv1::findSprite(const Spriteref & ref)
+{
+    if (m_scanComplete)
+        return m_index.find(ref);
+    auto scanned = m_scannedRefs.find(ref);
+    if (scanned != m_scannedRefs.end())
+        return scanned->second;
+    // the chain is only scanned up to the sprite
+    while (scanNextSubfile()) {
+        const SpriteInfo & sprite = m_sffv1Container.back();
+        if (sprite.group == ref.group && sprite.groupimage == ref.image)
+            return m_sffv1Container.size() - 1;
+    }
+    return SpriteIndex::npos;
+}
+
+const SpriteIndex & Sffv1::index()
+{
+    scanAllSubfiles();
+    return m_index;
 }
 
 void Sffv1::loadSharedPalettes()
 {
-	if (m_paletteFile.empty())
-		return;
-    bool continueLoop = true;
-    // We get the values of pal1, pal2, pal3, ... etc in order until pal12
-    for (int i = 1; continueLoop && i <= 12; i++) {
-        std::string keyname = "pal";
-        keyname += std::to_string(i);
-        try {
-            continueLoop = readActPalette(m_paletteFile.c_str());
-        }
-        catch
-            (std::out_of_range) { // thrown by character.getdef() if the method at doesn't find the key
-            break;
-        }
+    for (const std::string & paletteFile: m_paletteFiles) {
+        if (readActPalette(paletteFile.c_str()))
+            continue;
+        std::cerr << "Could not read the palette file " << paletteFile << std::endl;
+        // keeps the palettes of the next files at their index
+        m_palettes.push_back(placeholderPalette());
     }
 }
 
-const Sffv1::PaletteInfo Sffv1::getPaletteForSprite(size_t spriteNumber, size_t currentPaletteId)
+Palette Sffv1::placeholderPalette()
 {
-    PaletteInfo s;
-    size_t iterationNumber = m_sprites.size();
-    if (m_sharedPalette && m_sffv1Container[spriteNumber].usesSharedPalette)
-        return m_palettes[currentPaletteId];
+    // the palette of the first sprite, the one used when there are no palette files
+    scanSubfiles(1);
+    if (!m_sffv1Container.empty()) {
+        const SpriteInfo & firstSprite = m_sffv1Container[0];
+        if (firstSprite.dataSize > 768 && firstSprite.data[firstSprite.dataSize - 768 - 1] == 0x0C)
+            return embeddedPalette(0);
+    }
+    // fully transparent otherwise
+    Palette palette = {};
+    return palette;
+}
+
+int Sffv1::findPaletteSprite(size_t spriteNumber)
+{
+    if (m_sharedPalette && m_sffv1Container[spriteNumber].usesSharedPalette && !m_palettes.empty())
+        return -1;
+    // look for the closest previous sprite that has its own palette
+    size_t iterationNumber = m_sffv1Container.size();
     while (m_sffv1Container[spriteNumber].usesSharedPalette && iterationNumber > 0) {
         iterationNumber--;
-		if (spriteNumber > 0)
+		if (spriteNumber > 0) {
 			spriteNumber--;
-        else
+        } else {
+            // wrapping around to the last sprite of the file
+            if (!m_scanComplete) {
+                const size_t stepsTaken = m_sffv1Container.size() - iterationNumber;
+                scanAllSubfiles();
+                iterationNumber = m_sffv1Container.size() - stepsTaken;
+            }
             spriteNumber += m_sffv1Container.size() - 1;
-    }
-    SpriteInfo & paletteSprite = m_sffv1Container[spriteNumber];
-    if (paletteSprite.dataSize > 768 && paletteSprite.data[paletteSprite.dataSize - 768 - 1] == 0x0C) {
-        uint8_t * paletteData = paletteSprite.data + (paletteSprite.dataSize - 768);
-        for (int i = 0; i < PALETTE_NCOLORS; i++) {
-            s.colors[i] = (Color) {
-                *(paletteData + 3 * i), *(paletteData + 3 * i + 1), *(paletteData + 3 * i + 2)
-            };
         }
-        return s;
     }
-    return m_palettes[currentPaletteId];
+    const SpriteInfo & paletteSprite = m_sffv1Container[spriteNumber];
+    if (paletteSprite.dataSize > 768 && paletteSprite.data[paletteSprite.dataSize - 768 - 1] == 0x0C)
+        return spriteNumber;
+    return -1;
+}
+
+Palette Sffv1::embeddedPalette(size_t spriteNumber) const
+{
+    Palette palette;
+    const SpriteInfo & paletteSprite = m_sffv1Container[spriteNumber];
+    const uint8_t * paletteData = paletteSprite.data + (paletteSprite.dataSize - 768);
+    for (int i = 0; i < PALETTE_NCOLORS; i++) {
+        palette[i] = (SDL_Color) {
+            *(paletteData + 3 * i), *(paletteData + 3 * i + 1), *(paletteData + 3 * i + 2), 0xFF
+        };
+    }
+    // apply transparency if the color value is zero
+    palette[0] = (SDL_Color) { 0, 0, 0, 0 };
+    return palette;
 }
 
+void Sffv1::updateColorTables()
+{
+    for (size_t i_palette = m_colorTables.size(); i_palette < m_indexedPalettes.size(); i_palette++)
+        m_colorTables.push_back(makeColorTable(m_indexedPalettes[i_palette]));
+}
 
-Sffv1::Drawer::Drawer(const SpriteInfo& sprite, const PaletteInfo& palette): Nugem::SurfaceDrawer(sprite.width(), sprite.height()), m_sprite(sprite), m_palette(palette)
+Sffv1::Drawer::Drawer(const SpriteInfo& sprite, const ColorTable * colors): Nugem::SurfaceDrawer(sprite.width(), sprite.height(), colors), m_sprite(sprite)
 {}
 
-void Sffv1::Drawer::draw(uint32_t * pixelData, size_t width, size_t height)
+void Sffv1::Drawer::draw(uint8_t * indexData, size_t width, size_t height)
 {
 	// PCX file format: data starts at offset 128
 	// before offset 128 is the header: see the Sffv1Sprite methods
-    uint8_t * dataStart = m_sprite.data + 128;
-    size_t i_pixel, i_byte;
-    for (i_pixel = 0, i_byte = 0; i_pixel < width * height && i_byte < (m_sprite.dataSize - 128); i_byte++) {
-        uint16_t runLength;
-        SDL_Color sdlcolor;
-        uint8_t colorIndex;
-        if ((dataStart[i_byte] & 0xC0) == 0xC0) { // RLE byte
-            runLength = dataStart[i_byte] & 0x3F;
-            i_byte++;
-            colorIndex = dataStart[i_byte];
-        }
-        else { // simple pixel byte
-            runLength = 1;
-            colorIndex = dataStart[i_byte];
-        }
-        if (colorIndex) { // if not null
-            const Color & color = m_palette.colors[dataStart[i_byte]];
-            sdlcolor = (SDL_Color) {
-                color.red, color.green, color.blue, 0xFF
-            };
-        }
-        else // apply transparency if the color value is zero
-            sdlcolor = (SDL_Color) {
-            0, 0, 0, 0
-        };
-        for (int runCount = runLength; runCount > 0 && i_pixel < width * height; runCount--, i_pixel++)
-            *(pixelData + i_pixel) = rgba(sdlcolor.r, sdlcolor.g, sdlcolor.b, sdlcolor.a);
+    if (m_sprite.dataSize < PCX_HEADER_SIZE)
+        return;
+    decodePcx(m_sprite.data + PCX_HEADER_SIZE, m_sprite.dataSize - PCX_HEADER_SIZE, indexData, width * height);
+}
+
+size_t Sffv1::displayedSprite(size_t spriteNumber) const
+{
+    const SpriteInfo & sprite = m_sffv1Container[spriteNumber];
+    if (sprite.linkedindex && !sprite.dataSize && sprite.linkedindex < m_sffv1Container.size())
+        return sprite.linkedindex;
+    return spriteNumber;
+}
+
+Sprite Sffv1::renderRgba(size_t spriteNumber, size_t currentPaletteId, SpriteTarget * target)
+{
+    int paletteId = spritePaletteId(spriteNumber);
+    updateColorTables();
+    const ColorTable & colors = m_colorTables[paletteId >= 0 ? paletteId : currentPaletteId];
+    Drawer drawer(m_sffv1Container[displayedSprite(spriteNumber)], &colors);
+    SDL_Surface * surface = nullptr;
+    if (target)
+        drawer.drawTo(*target, m_trimming);
+    else
+        surface = drawer(m_trimming);
+    return Sprite(spriteRef(spriteNumber), surface, currentPaletteId, spriteGeometry(spriteNumber, drawer.geometry()));
+}
+
+int Sffv1::spritePaletteId(size_t spriteNumber)
+{
+    // a linked sprite can point further in the chain
+    const SpriteInfo & sprite = m_sffv1Container[spriteNumber];
+    if (sprite.linkedindex && !sprite.dataSize)
+        scanSubfiles(sprite.linkedindex + 1);
+    // sprites with their own palette keep it, the others follow the selected shared palette
+    int paletteSprite = findPaletteSprite(displayedSprite(spriteNumber));
+    if (paletteSprite < 0)
+        return -1;
+    auto embeddedId = m_embeddedPaletteIds.find(paletteSprite);
+    if (embeddedId == m_embeddedPaletteIds.end()) {
+        embeddedId = m_embeddedPaletteIds.insert(std::make_pair(paletteSprite, m_indexedPalettes.size())).first;
+        m_indexedPalettes.push_back(embeddedPalette(paletteSprite));
     }
+    return embeddedId->second;
 }
 
-SDL_Surface * Sffv1::renderToSurface(size_t spriteNumber, size_t currentPaletteId)
+Sprite Sffv1::renderIndexed(size_t spriteNumber, SpriteTarget * target)
 {
-    size_t displayedSpriteNumber = spriteNumber;
-    if (m_sffv1Container[spriteNumber].linkedindex && !m_sffv1Container[spriteNumber].dataSize)
-        displayedSpriteNumber = m_sffv1Container[spriteNumber].linkedindex;
-    return Drawer(m_sffv1Container[displayedSpriteNumber], getPaletteForSprite(displayedSpriteNumber, currentPaletteId))();
+    int paletteId = spritePaletteId(spriteNumber);
+    Drawer drawer(m_sffv1Container[displayedSprite(spriteNumber)], nullptr);
+    SDL_Surface * surface = nullptr;
+    if (target)
+        drawer.drawTo(*target, m_trimming);
+    else
+        surface = drawer(m_trimming);
+    return Sprite(spriteRef(spriteNumber), surface, paletteId, spriteGeometry(spriteNumber, drawer.geometry()));
+}
+
+Spriteref Sffv1::spriteRef(size_t spriteNumber) const
+{
+    const SpriteInfo & sprite = m_sffv1Container[spriteNumber];
+    return Spriteref(sprite.group, sprite.groupimage);
+}
+
+SpriteGeometry Sffv1::spriteGeometry(size_t spriteNumber, SpriteGeometry drawn) const
+{
+    // a linked sprite keeps its own axis
+    const SpriteInfo & sprite = m_sffv1Container[spriteNumber];
+    drawn.axisX = static_cast<int16_t>(sprite.axisX);
+    drawn.axisY = static_cast<int16_t>(sprite.axisY);
+    return drawn;
 }
 
 bool Sffv1::readActPalette(const char * filepath)
 {
-    Sffv1::PaletteInfo palette;
+    Palette palette;
     std::ifstream actfile;
     // reading a .act file: a Photoshop 8-bit palette
     try {
-        actfile.open(filepath);
+        actfile.open(filepath, std::ios::binary);
         if (actfile.fail())
             return false;
         // for some reason the colors are in reverse order
         // it didn't appear to be in the official specification though
         for (int i_palette = 0; i_palette < PALETTE_NCOLORS && actfile.good(); i_palette++) {
-            palette.colors[PALETTE_NCOLORS - 1 - i_palette].red = actfile.get();
-            palette.colors[PALETTE_NCOLORS - 1 - i_palette].green = actfile.get();
-            palette.colors[PALETTE_NCOLORS - 1 - i_palette].blue = actfile.get();
+            palette[PALETTE_NCOLORS - 1 - i_palette].r = actfile.get();
+            palette[PALETTE_NCOLORS - 1 - i_palette].g = actfile.get();
+            palette[PALETTE_NCOLORS - 1 - i_palette].b = actfile.get();
+            palette[PALETTE_NCOLORS - 1 - i_palette].a = 0xFF;
         }
+        // apply transparency if the color value is zero
+        palette[0] = (SDL_Color) { 0, 0, 0, 0 };
         actfile.close();
     }
     catch
@@ -259,32 +382,122 @@ bool Sffv1::readActPalette(const char * filepath)
 
 void Sffv1::load()
 {
-    m_sprites.clear();
-    for (size_t currentPalette = 0; currentPalette < m_palettes.size(); currentPalette++) {
-        std::unordered_map<Spriteref, Sprite> currentPaletteSprites;
-        for (size_t currentSprite = 0; currentSprite < m_sffv1Container.size(); currentSprite++) {
-            SpriteInfo & sprite = m_sffv1Container[currentSprite];
-            Spriteref ref(sprite.group, sprite.groupimage);
-            currentPaletteSprites.insert(std::pair<Spriteref, Sprite>(ref, Sprite(ref, renderToSurface(currentSprite, currentPalette), currentPalette)));
-        }
-        m_sprites.push_back(currentPaletteSprites);
+    std::vector<std::pair<Spriteref, size_t>> selection;
+    scanAllSubfiles();
+    selection.reserve(m_sffv1Container.size());
+    for (size_t currentSprite = 0; currentSprite < m_sffv1Container.size(); currentSprite++) {
+        SpriteInfo & sprite = m_sffv1Container[currentSprite];
+        selection.emplace_back(Spriteref(sprite.group, sprite.groupimage), currentSprite);
     }
+    loadSelection(selection);
 }
 
 void Sffv1::load(std::vector<Spriteref>::iterator first, std::vector<Spriteref>::iterator last)
 {
-    m_sprites.clear();
-    for (size_t currentPalette = 0; currentPalette < m_palettes.size(); currentPalette++) {
-        m_sprites.push_back(std::unordered_map<Spriteref, Sprite>());
+    std::vector<std::pair<Spriteref, size_t>> selection;
+    for (; first != last; first++) {
+        size_t currentSprite = findSprite(*first);
+        // sprites missing from the file are left out
+        if (currentSprite != SpriteIndex::npos)
+            selection.emplace_back(*first, currentSprite);
     }
+    loadSelection(selection);
+}
 
-    for (; first != last; first++) {
-        for (size_t currentPalette = 0; currentPalette < m_palettes.size(); currentPalette++) {
-            Spriteref & ref = *first;
-            size_t currentSprite = m_groups[ref.group].i[ref.image];
-            m_sprites[currentPalette].insert(std::pair<Spriteref, Sprite>(ref, Sprite(ref, renderToSurface(currentSprite, currentPalette), currentPalette)));
+void Sffv1::loadSelection(const std::vector<std::pair<Spriteref, size_t>> & selection)
+{
+    m_sprites.clear();
+    m_indexedPalettes = m_palettes;
+    m_colorTables.resize(m_palettes.size());
+    m_embeddedPaletteIds.clear();
+    // palette ids and color tables are set up beforehand: the decoding threads only read
+    std::vector<int> paletteIds;
+    paletteIds.reserve(selection.size());
+    for (auto & selected : selection)
+        paletteIds.push_back(spritePaletteId(selected.second));
+    // linked sprites and identical payloads are decoded once, and share their pixels
+    std::vector<SpritePayload> payloads;
+    payloads.reserve(selection.size());
+    for (auto & selected : selection) {
+        const SpriteInfo & sprite = m_sffv1Container[displayedSprite(selected.second)];
+        payloads.push_back({ sprite.data, sprite.dataSize, 0 });
+    }
+    const std::vector<size_t> firsts = findIdenticalPayloads(payloads);
+    if (m_format == SpriteFormat::Indexed8) {
+        std::vector<SpritePixels> pixels(selection.size());
+        std::vector<SpriteGeometry> geometries(selection.size());
+        WorkerPool::instance().parallelFor(selection.size(), [&](size_t i) {
+            if (firsts[i] != i)
+                return;
+            Drawer drawer(m_sffv1Container[displayedSprite(selection[i].second)], nullptr);
+            pixels[i] = SpritePixels(drawer(m_trimming), SDL_FreeSurface);
+            geometries[i] = drawer.geometry();
+        });
+        std::unordered_map<Spriteref, Sprite> indexedSprites;
+        for (size_t i = 0; i < selection.size(); i++) {
+            const SpriteGeometry geometry = spriteGeometry(selection[i].second, geometries[firsts[i]]);
+            indexedSprites.insert(std::pair<Spriteref, Sprite>(selection[i].first, Sprite(selection[i].first, pixels[firsts[i]], paletteIds[i], geometry)));
+        }
+        m_sprites.push_back(std::move(indexedSprites));
+        return;
+    }
+    updateColorTables();
+    // one surface per distinct payload and color table: a sprite with its own palette looks the same in every palette
+    const size_t nSprites = selection.size();
+    const size_t firstPalette = firstLoadedPalette(m_palettes.size());
+    const size_t nPalettes = lastLoadedPalette(m_palettes.size()) - firstPalette;
+    std::vector<std::pair<size_t, size_t>> surfaceKeys;
+    std::unordered_map<uint64_t, size_t> surfaceNumbers;
+    std::vector<size_t> spriteSurfaces(nPalettes * nSprites);
+    for (size_t n = 0; n < nPalettes; n++) {
+        for (size_t i = 0; i < nSprites; i++) {
+            const size_t colorTable = paletteIds[i] >= 0 ? paletteIds[i] : firstPalette + n;
+            auto surfaceNumber = surfaceNumbers.insert(std::make_pair(static_cast<uint64_t>(firsts[i]) << 32 | colorTable, surfaceKeys.size()));
+            if (surfaceNumber.second)
+                surfaceKeys.emplace_back(firsts[i], colorTable);
+            spriteSurfaces[n * nSprites + i] = surfaceNumber.first->second;
         }
     }
+    std::vector<SpritePixels> pixels(surfaceKeys.size());
+    std::vector<SpriteGeometry> geometries(surfaceKeys.size());
+    WorkerPool::instance().parallelFor(surfaceKeys.size(), [&](size_t i) {
+        Drawer drawer(m_sffv1Container[displayedSprite(selection[surfaceKeys[i].first].second)], &m_colorTables[surfaceKeys[i].second]);
+        pixels[i] = SpritePixels(drawer(m_trimming), SDL_FreeSurface);
+        geometries[i] = drawer.geometry();
+    });
+    for (size_t n = 0; n < nPalettes; n++) {
+        std::unordered_map<Spriteref, Sprite> currentPaletteSprites;
+        for (size_t i = 0; i < nSprites; i++) {
+            const Spriteref & ref = selection[i].first;
+            const size_t surface = spriteSurfaces[n * nSprites + i];
+            currentPaletteSprites.insert(std::pair<Spriteref, Sprite>(ref, Sprite(ref, pixels[surface], firstPalette + n, spriteGeometry(selection[i].second, geometries[surface]))));
+        }
+        m_sprites.push_back(std::move(currentPaletteSprites));
+    }
+}
+
+Sprite * Sffv1::loadSprite(const Spriteref & ref, size_t palette)
+{
+    size_t currentSprite = findSprite(ref);
+    if (currentSprite == SpriteIndex::npos)
+        return nullptr;
+    if (m_format == SpriteFormat::Indexed8)
+        return new Sprite(renderIndexed(currentSprite));
+    if (palette >= m_palettes.size())
+        return nullptr;
+    return new Sprite(renderRgba(currentSprite, palette));
+}
+
+Sprite * Sffv1::drawSprite(const Spriteref & ref, size_t palette, SpriteTarget & target)
+{
+    size_t currentSprite = findSprite(ref);
+    if (currentSprite == SpriteIndex::npos)
+        return nullptr;
+    if (m_format == SpriteFormat::Indexed8)
+        return new Sprite(renderIndexed(currentSprite, &target));
+    if (palette >= m_palettes.size())
+        return nullptr;
+    return new Sprite(renderRgba(currentSprite, palette, &target));
 }
 
 }
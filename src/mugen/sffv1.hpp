@@ -20,9 +20,8 @@
 #ifndef SFFV1_H
 #define SFFV1_H
 
-#define PALETTE_NCOLORS 256
-
 #include "sprites.hpp"
+#include "mappedfile.hpp"
 #include <string>
 #include <vector>
 #include <array>
@@ -35,14 +34,6 @@ namespace Mugen {
 class Sffv1: public SpriteHandler
 {
 private:
-	struct Color {
-		uint8_t red;
-		uint8_t green;
-		uint8_t blue;
-	};
-	struct PaletteInfo {
-		Color colors[PALETTE_NCOLORS];
-	};
 	struct SpriteInfo {
 		// image coordinates
 		uint16_t axisX;
@@ -52,7 +43,7 @@ private:
 		uint32_t dataSize;
 		uint16_t linkedindex; // only for a linked sprite
 		bool usesSharedPalette; // if the image owns its palette, or if it uses a shared palette
-		uint8_t * data;
+		const uint8_t * data; // points into the mapped sprite file
 		uint16_t xmin() const;
 		uint16_t xmax() const;
 		uint16_t ymin() const;
@@ -63,46 +54,81 @@ private:
 		uint16_t height() const;
 		uint32_t totalBytesPerLine() const;
 	};
-	struct GroupInfo {
-		// map: index in group -> absolute image index
-		std::unordered_map<size_t, size_t> i;
-	};
 public:
-	Sffv1(const char* filename, const char* paletteFile = "");
+	// one selectable palette per palette file, in order: the pal1 to pal12 of a character
+	Sffv1(const char* filename, const std::vector<std::string> & paletteFiles = std::vector<std::string>());
 	~Sffv1();
 	void load();
 	void load(std::vector< Spriteref >::iterator first, std::vector< Spriteref >::iterator last);
+	Sprite * loadSprite(const Spriteref & ref, size_t palette);
+	Sprite * drawSprite(const Spriteref & ref, size_t palette, SpriteTarget & target);
+	const SpriteIndex & index();
 protected:
+	// Reads the file header: the subfiles are only scanned when they are needed
 	void loadSffFile();
+	// Reads the header of the next subfile of the chain, false at the end of the chain
+	bool scanNextSubfile();
+	// Scans the chain until there are at least count sprites, or until its end
+	void scanSubfiles(size_t count);
+	void scanAllSubfiles();
+	// first sprite with this reference, scanning the chain as far as needed; SpriteIndex::npos if there is none
+	size_t findSprite(const Spriteref & ref);
 	void loadSharedPalettes();
+	// stands for a palette file that cannot be read
+	Palette placeholderPalette();
 	// true if there is a palette file that was sucessfully read
 	// false if not
 	bool readActPalette(const char* filepath);
-	const PaletteInfo getPaletteForSprite(size_t spriteNumber, size_t currentPaletteId);
-	SDL_Surface * renderToSurface(size_t spriteNumber, size_t currentPaletteId);
+	// index of the sprite whose embedded palette is used to draw a sprite, -1 if it uses the shared palette
+	int findPaletteSprite(size_t spriteNumber);
+	Palette embeddedPalette(size_t spriteNumber) const;
+	size_t displayedSprite(size_t spriteNumber) const;
+	Sprite renderRgba(size_t spriteNumber, size_t currentPaletteId, SpriteTarget * target = nullptr);
+	// index in palettes() of the palette forced by a sprite, -1 if it uses the selected one
+	int spritePaletteId(size_t spriteNumber);
+	// converts the palettes that do not have a color table yet
+	void updateColorTables();
+	Sprite renderIndexed(size_t spriteNumber, SpriteTarget * target = nullptr);
+	Spriteref spriteRef(size_t spriteNumber) const;
+	// geometry of a drawn sprite, with its axis
+	SpriteGeometry spriteGeometry(size_t spriteNumber, SpriteGeometry drawn) const;
+	void loadSelection(const std::vector<std::pair<Spriteref, size_t>> & selection);
 private:
 	class Drawer: public SurfaceDrawer {
 	public:
-		Drawer(const SpriteInfo& sprite, const PaletteInfo& palette);
+		Drawer(const SpriteInfo& sprite, const ColorTable * colors);
 		~Drawer() {};
 	protected:
-		void draw(uint32_t * pixelData, size_t width, size_t height);
+		void draw(uint8_t * indexData, size_t width, size_t height);
 	private:
 		const SpriteInfo& m_sprite;
-		const PaletteInfo& m_palette;
 	};
-	static const size_t READBUF_SIZE = 12;
+	static const size_t HEADER_SIZE = 512;
+	static const size_t SUBHEADER_SIZE = 32;
+	static const size_t PCX_HEADER_SIZE = 128;
 	std::string m_filename;
-	std::string m_paletteFile;
+	MappedFile m_file;
+	std::vector<std::string> m_paletteFiles;
 	uint32_t m_ngroups;
 	uint32_t m_nimages;
+	// sprites scanned so far, in the order of the chain
 	std::vector<SpriteInfo> m_sffv1Container;
+	uint32_t m_nextSubfileOffset;
+	bool m_scanComplete;
+	// first sprite of each reference scanned so far
+	std::unordered_map<Spriteref, size_t> m_scannedRefs;
 	bool m_sharedPalette; // if not, it's an individual palette
-	std::vector<PaletteInfo> m_palettes;
-	std::unordered_map<size_t, GroupInfo> m_groups;
+	std::vector<Palette> m_palettes;
 	std::vector<std::unordered_map<Spriteref, Sprite>> m_sprites;
+	// palettes used to draw the sprites: the shared palettes, then the embedded ones
+	std::vector<Palette> m_indexedPalettes;
+	std::vector<ColorTable> m_colorTables;
+	// sprite owning an embedded palette -> its index in m_indexedPalettes
+	std::unordered_map<size_t, int> m_embeddedPaletteIds;
 public:
-	std::vector<std::unordered_map<Spriteref, Sprite>> sprites() { return m_sprites; };
+	std::vector<std::unordered_map<Spriteref, Sprite>> takeSprites() { return std::move(m_sprites); };
+	std::vector<Palette> palettes() { return m_indexedPalettes; };
+	size_t selectablePalettes() { return m_palettes.size(); };
 };
 
 }
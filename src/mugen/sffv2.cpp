@@ -19,10 +19,13 @@
 
 #include "sffv2.hpp"
 
-#include <ios>
-#include <fstream>
+#include "spritedecoders.hpp"
+#include "../workerpool.hpp"
+
+#include <algorithm>
 #include <iostream>
 #include <array>
+#include <cstring>
 
 namespace Nugem {
 namespace Mugen {
@@ -32,315 +35,373 @@ bool Sffv2::SpriteInfo::usesTData() const
 	return flags & 0x01;;
 }
 
+bool Sffv2::SpriteInfo::trueColor() const
+{
+	return fmt == 11 || fmt == 12;
+}
+
 Sffv2::Sffv2(const char * filename): m_filename(filename)
 {
     m_ldata = nullptr;
     m_tdata = nullptr;
     m_sffv2Container.clear();
     m_palettes.clear();
-    m_groups.clear();
+    m_index.clear();
     loadSffFile();
 }
 
 Sffv2::~Sffv2()
 {
-    if (m_ldata != nullptr)
-        delete [] m_ldata;
-    if (m_tdata != nullptr)
-        delete [] m_tdata;
 }
 
 void Sffv2::loadSffFile()
 {
-    uint32_t fileptr;
-    uint8_t * readbuf[READBUF_SIZE];
-    std::ifstream charfile(m_filename.c_str());
-    // Reading the filename
+    if (!m_file.open(m_filename))
+        throw std::runtime_error(std::string("Cannot open sprite file: ") + m_filename);
+    const uint8_t * filedata = m_file.data();
+    const uint64_t filesize = m_file.size();
 
     // First 512 bytes: header
     // Signature at the start of the file: 'ElecbyteSpr\0'
-    charfile.read((char *) readbuf, 12);
-    if (strcmp((char *) readbuf, "ElecbyteSpr")) {
+    if (filesize < HEADER_SIZE || memcmp(filedata, "ElecbyteSpr", 12)) {
         throw std::runtime_error(std::string("Invalid sprite file: ") + m_filename);
     }
-    // Version bytes
-    std::array<uint8_t, 4> version = extract_version(charfile);
-    // Reserved bytes
-    charfile.seekg(8, std::ios::cur);
-    // Compatibility version bytes
-    std::array<uint8_t, 4> compatver = extract_version(charfile);
-    charfile.seekg(8, std::ios::cur);
-    uint32_t first_sprite_offset = read_uint32(charfile);
-    size_t nSprites = read_uint32(charfile);
-    uint32_t first_palette_offset = read_uint32(charfile);
-    size_t nPalettes = read_uint32(charfile);
+    // Bytes 12 to 15: version, 16 to 23: reserved
+    // Bytes 24 to 27: compatibility version, 28 to 35: reserved
+    uint32_t first_sprite_offset = read_uint32(filedata + 36);
+    size_t nSprites = read_uint32(filedata + 40);
+    uint32_t first_palette_offset = read_uint32(filedata + 44);
+    size_t nPalettes = read_uint32(filedata + 48);
 
     // ldata (literal data block) information
-    uint32_t ldata_offset = read_uint32(charfile);
-    m_ldataLength = read_uint32(charfile);
-    if (m_ldataLength > 0)
-        m_ldata = new uint8_t[m_ldataLength];
-    // Copying ldata into memory
-    fileptr = charfile.tellg();
-    charfile.seekg(ldata_offset, std::ios::beg);
-    charfile.read((char *) m_ldata, m_ldataLength);
-    charfile.seekg(fileptr, std::ios::beg);
+    uint32_t ldata_offset = read_uint32(filedata + 52);
+    m_ldataLength = read_uint32(filedata + 56);
 
     // tdata (translated data block) information: it is supposed to be translated during load
-    uint32_t tdata_offset = read_uint32(charfile);
-    m_tdataLength = read_uint32(charfile);
-    if (m_tdataLength > 0)
-        m_tdata = new uint8_t[m_tdataLength];
-    // Copying tdata into memory
-    fileptr = charfile.tellg();
-    charfile.seekg(tdata_offset, std::ios::beg);
-    charfile.read((char *) m_tdata, m_tdataLength);
-    charfile.seekg(fileptr, std::ios::beg);
-
-    // Going to first sprite data
-    charfile.seekg(first_sprite_offset, std::ios::beg);
+    uint32_t tdata_offset = read_uint32(filedata + 60);
+    m_tdataLength = read_uint32(filedata + 64);
+
+    if (ldata_offset + static_cast<uint64_t>(m_ldataLength) > filesize
+        || tdata_offset + static_cast<uint64_t>(m_tdataLength) > filesize
+        || first_sprite_offset + nSprites * SPRITE_NODE_SIZE > filesize
+        || first_palette_offset + nPalettes * PALETTE_NODE_SIZE > filesize)
+        throw std::runtime_error(std::string("Truncated sprite file: ") + m_filename);
+    // Both data blocks are used in place: nothing is copied out of the mapping
+    m_ldata = filedata + ldata_offset;
+    m_tdata = filedata + tdata_offset;
+
+    m_sffv2Container.reserve(nSprites);
+    m_index.reserve(nSprites);
     for (size_t i_sprite = 0; i_sprite < nSprites; i_sprite++)
-        m_sffv2Container.push_back(readSprite(charfile));
+        m_sffv2Container.push_back(readSprite(filedata + first_sprite_offset + i_sprite * SPRITE_NODE_SIZE));
+    m_index.build();
 
-    // Going to first palette data
-    charfile.seekg(first_palette_offset, std::ios::beg);
+    m_palettes.reserve(nPalettes);
     for (size_t i_palette = 0; i_palette < nPalettes; i_palette++)
-        m_palettes.push_back(readPalette(charfile));
+        m_palettes.push_back(readPalette(filedata + first_palette_offset + i_palette * PALETTE_NODE_SIZE));
 
-    charfile.close();
+    m_paletteColors.reserve(nPalettes);
+    m_colorTables.reserve(nPalettes);
+    for (size_t i_palette = 0; i_palette < nPalettes; i_palette++) {
+        m_paletteColors.push_back(readPaletteColors(i_palette));
+        m_colorTables.push_back(makeColorTable(m_paletteColors.back()));
+    }
 }
 
-Sffv2::SpriteInfo Sffv2::readSprite(std::ifstream & fileobj)
+Sffv2::SpriteInfo Sffv2::readSprite(const uint8_t * node)
 {
     Sffv2::SpriteInfo sprite;
-    sprite.groupno = read_uint16(fileobj);
-    sprite.itemno = read_uint16(fileobj);
-    sprite.width = read_uint16(fileobj);
-    sprite.height = read_uint16(fileobj);
-    sprite.axisx = read_uint16(fileobj);
-    sprite.axisy = read_uint16(fileobj);
-    sprite.linkedindex = read_uint16(fileobj);
-    sprite.fmt = fileobj.get();
-    sprite.coldepth = fileobj.get();
-    sprite.dataOffset = read_uint32(fileobj);
-    sprite.dataLength = read_uint32(fileobj);
-    sprite.paletteIndex = read_uint16(fileobj);
-    sprite.flags = read_uint16(fileobj);
+    sprite.groupno = read_uint16(node);
+    sprite.itemno = read_uint16(node + 2);
+    sprite.width = read_uint16(node + 4);
+    sprite.height = read_uint16(node + 6);
+    sprite.axisx = read_uint16(node + 8);
+    sprite.axisy = read_uint16(node + 10);
+    sprite.linkedindex = read_uint16(node + 12);
+    sprite.fmt = node[14];
+    sprite.coldepth = node[15];
+    sprite.dataOffset = read_uint32(node + 16);
+    sprite.dataLength = read_uint32(node + 20);
+    sprite.paletteIndex = read_uint16(node + 24);
+    sprite.flags = read_uint16(node + 26);
     sprite.texture = nullptr;
-    m_groups[sprite.groupno].i[sprite.itemno] = m_sffv2Container.size();
+    // a sprite whose data lies outside of its block is left empty
+    const uint32_t blockLength = sprite.usesTData() ? m_tdataLength : m_ldataLength;
+    if (sprite.dataOffset + static_cast<uint64_t>(sprite.dataLength) > blockLength)
+        sprite.dataLength = 0;
+    m_index.add(Spriteref(sprite.groupno, sprite.itemno), m_sffv2Container.size());
     return sprite;
 }
 
-Sffv2::PaletteInfo Sffv2::readPalette(std::ifstream & fileobj)
+int Sffv2::findPalette(uint16_t group, uint16_t item)
+{
+    for (size_t i_palette = 0; i_palette < m_palettes.size(); i_palette++) {
+        if (m_palettes[i_palette].groupno == group && m_palettes[i_palette].itemno == item)
+            return i_palette;
+    }
+    return -1;
+}
+
+Sffv2::PaletteInfo Sffv2::readPalette(const uint8_t * node)
 {
     Sffv2::PaletteInfo palette;
-    palette.groupno = read_uint16(fileobj);
-    palette.itemno = read_uint16(fileobj);
-    palette.numcols = read_uint16(fileobj);
-    palette.linkedindex = read_uint16(fileobj);
-    palette.ldataOffset = read_uint32(fileobj);
-    palette.dataLength = read_uint32(fileobj);
+    palette.groupno = read_uint16(node);
+    palette.itemno = read_uint16(node + 2);
+    palette.numcols = read_uint16(node + 4);
+    palette.linkedindex = read_uint16(node + 6);
+    palette.ldataOffset = read_uint32(node + 8);
+    palette.dataLength = read_uint32(node + 12);
     return palette;
 }
 
-Sffv2::Drawer::Drawer(const SpriteInfo& sprite, const PaletteInfo& palette, uint8_t * ldata, uint8_t * tdata): Nugem::SurfaceDrawer(sprite.width, sprite.height), m_sprite(sprite), m_palette(palette), m_ldata(ldata), m_tdata(tdata)
+Palette Sffv2::readPaletteColors(size_t paletteNumber) const
 {
+    // case of a linked palette
+    const PaletteInfo * paletteInfo = &m_palettes[paletteNumber];
+    if (paletteInfo->linkedindex && paletteInfo->linkedindex < m_palettes.size())
+        paletteInfo = &m_palettes[paletteInfo->linkedindex];
+    Palette palette;
+    for (size_t color = 0; color < PALETTE_NCOLORS; color++) {
+        uint64_t colorOffset = paletteInfo->ldataOffset + color * 4;
+        if (colorOffset + 3 > m_ldataLength) {
+            palette[color] = (SDL_Color) { 0, 0, 0, 0xFF };
+            continue;
+        }
+        const uint8_t * colorarray = m_ldata + colorOffset;
+        palette[color] = (SDL_Color) { colorarray[0], colorarray[1], colorarray[2], 0xFF };
+    }
+    // the first color is the transparent one
+    palette[0].a = 0x00;
+    return palette;
 }
 
-void Sffv2::Drawer::draw(uint32_t * pixelData, size_t width, size_t height)
+Sffv2::Drawer::Drawer(const SpriteInfo& sprite, const ColorTable * colors, const uint8_t * ldata, const uint8_t * tdata): Nugem::SurfaceDrawer(sprite.width, sprite.height, colors), m_sprite(sprite), m_ldata(ldata), m_tdata(tdata)
+{
+}
+
+const uint8_t * Sffv2::Drawer::spriteData() const
 {
-	const size_t surfaceSize = width * height;
-	auto outputColoredPixel = [&](uint8_t color, const uint32_t indexPixel) {
-		if (indexPixel < surfaceSize) {
-			const uint8_t * colorarray = m_ldata + (m_palette.ldataOffset + color * 4);
-			uint8_t red, green, blue, alpha;
-			red = colorarray[0];
-			green = colorarray[1];
-			blue = colorarray[2];
-			if (color)
-				alpha = 0xFF;
-			else
-				alpha = 0x00;
-			* (pixelData + indexPixel) = rgba(red, green, blue, alpha);
-		}
-	};
-    // Initializing the variables we will need for the rest
-    const uint8_t * sdata;
 	if (m_sprite.usesTData())
-		sdata = m_tdata + m_sprite.dataOffset;
-	else
-		sdata = m_ldata + m_sprite.dataOffset;
-    uint64_t indexPixel = 0;
-    uint32_t i_byte = 0;
+		return m_tdata + m_sprite.dataOffset;
+	return m_ldata + m_sprite.dataOffset;
+}
+
+void Sffv2::Drawer::draw(uint8_t * indexData, size_t width, size_t height)
+{
+	const size_t surfaceSize = width * height;
+    const uint8_t * sdata = spriteData();
     switch (m_sprite.fmt) {
-    case 0: // raw
-        for (i_byte = 4; i_byte < m_sprite.dataLength; i_byte++, indexPixel++) {
-            outputColoredPixel(sdata[i_byte], indexPixel);
-        }
+    case 0: // raw, after the 4 bytes of uncompressed size
+        if (m_sprite.dataLength > 4)
+            memcpy(indexData, sdata + 4, std::min<size_t>(m_sprite.dataLength - 4, surfaceSize));
         break;
     case 1: // invalid
         break;
     case 2: // RLE8 (Run-Length Encoding at 8 bits-per-pixel pixmap)
-        for (i_byte = 4; i_byte < m_sprite.dataLength; i_byte++) {
-            uint8_t first_byte = sdata[i_byte];
-            if ((first_byte & 0xC0) == 0x40) {  // in the case of a RLE control packet
-                i_byte++;
-                uint8_t color = sdata[i_byte]; // <- the next byte
-                uint8_t run_length = (first_byte & 0x3F);
-                for (int run_count = 0; run_count < run_length; run_count++)
-                    outputColoredPixel(color, indexPixel++);
-            }
-            else
-                outputColoredPixel(first_byte, indexPixel++);
-        }
+        decodeRle8(sdata, m_sprite.dataLength, indexData, surfaceSize);
         break;
     case 3: // RLE5 (5 bits-per-pixel pixmaps)
-        for (i_byte = 4; i_byte < m_sprite.dataLength; i_byte++) {
-            uint8_t run_length = sdata[i_byte];
-            i_byte++;
-            uint8_t data_length = sdata[i_byte];
-            uint8_t color;
-            if (data_length & 0x80) // testing the color bit
-                color = sdata[++i_byte];
-            else
-                color = 0;
-            for (int run_count = 0; run_count < run_length; run_count++)
-                outputColoredPixel(color, indexPixel++);
-            for (int bytes_processed = 0; bytes_processed < (data_length & 0x7F) - 1; bytes_processed++) {
-                uint8_t byte = sdata[++i_byte];
-                color = byte & 0x1F;
-                run_length = byte >> 5;
-                for (uint8_t run_count = 0; run_count < run_length; run_count++)
-                    outputColoredPixel(color, indexPixel++);
-            }
-        }
+        decodeRle5(sdata, m_sprite.dataLength, indexData, surfaceSize);
         break;
     case 4: // LZ5
-        // see the documentation on LZ5 compression: https://web.archive.org/web/20141230125932/http://elecbyte.com/wiki/index.php/LZ5
-        uint32_t shortlzpackets = 1;
-        uint8_t recycledbits = 0;
-        // first 4 bytes are the size of uncompressed data
-        // so we skip them
-        for (i_byte = 4; i_byte < m_sprite.dataLength; i_byte++) {
-            uint8_t control_packet = sdata[i_byte];
-            uint8_t i_data_packet;
-            for (i_data_packet = 0; i_data_packet < 8 && i_byte < m_sprite.dataLength; i_data_packet++) {
-                uint8_t flag = control_packet & (1 << i_data_packet); // value 0-> it is a RLE packet, value 1-> LZ packet
-                i_byte++;
-                if (!flag) { // RLE packet (short or long)
-                    uint8_t color = sdata[i_byte] & 0x1F;
-                    uint32_t run_length = sdata[i_byte] & 0xE0;
-                    size_t run_count;
-                    if (run_length > 0) { // short RLE packet
-                        run_length >>= 5; // the color runs in 1 to 7 pixels, so it's mapped on 3 bits all right
-                    }
-                    else {   // long RLE packet
-                        i_byte++;
-                        run_length = sdata[i_byte] + 8;
-                        // the color runs in 8 to 263 times
-                    }
-                    for (run_count = 0; run_count < run_length; run_count++)
-                        outputColoredPixel(color, indexPixel++);
-                }
-                else {   // LZ packet (short or long)
-                    uint32_t copylength = sdata[i_byte] & 0x3F; // bits 0-5
-                    uint16_t offset = 0;
-                    if (copylength) { // short LZ packet, if initial copy length is not null
-                        copylength += 1; // <- see the docs
-                        // How recycled bits work:
-// 						bits 6-7: recycled bits of short LZ packet 4k + 1
-// 						bits 4-5: recycled bits of short LZ packet 4k + 2
-// 						bits 2-3: recycled bits of short LZ packet 4k + 3
-// 						bits 0-1: recycled bits of short LZ packet 4k + 4
-                        if (shortlzpackets % 4 == 0) { // use the recycled bits
-                            recycledbits |= (sdata[i_byte] & 0xC0) >> 6;
-                            offset = recycledbits + 1;
-                            // new recycled bits cycle
-                            recycledbits = 0;
-                        }
-                        else { // read the extra byte
-                            recycledbits |= (sdata[i_byte] & 0xC0) >> (2 * ((shortlzpackets - 1) % 4));
-                            i_byte++;
-                            offset = sdata[i_byte] + 1;
-                        }
-                        shortlzpackets++;
-                    }
-                    else {   // long LZ packet
-                        offset = sdata[i_byte] << 2; // since the 0x3F-masked bits are null, there is only the 0xC0-masked bits left
-                        // ^ these are the highest 2 bits out of the 10-bit offset
-                        i_byte++;
-                        offset |= sdata[i_byte]; // low 8 bits of the 10-bit offset
-                        offset += 1;
-                        i_byte++;
-                        copylength = sdata[i_byte] + 3; // value range: 8 to 263
-                    }
-                    // memory copy
-                    // stay safe...
-                    // If the length is greater than the offset, then the copy pointer must go back to the beginning of the source when it reaches the full length
-                    // According to the Nomen developper
-                    // So that is why the offset has a factor here
-                    for (uint32_t i_pixel = 0; i_pixel < copylength && indexPixel < surfaceSize; i_pixel++, indexPixel++) {
-                        uint32_t offsetFromBeginning;
-                        if (offset)
-                            offsetFromBeginning = offset * (1 + i_pixel / offset);
-                        else // the offset should never be null though...
-                            offsetFromBeginning = i_pixel; // just copy the same pixel over and over again I guess
-                        * (pixelData + indexPixel) = * (pixelData + indexPixel - offsetFromBeginning);
-                    }
-                }
-            }
-        }
+        decodeLz5(sdata, m_sprite.dataLength, indexData, surfaceSize);
+        break;
+    case 10: // PNG8, after the 4 bytes of uncompressed size
+        if (m_sprite.dataLength > 4)
+            decodePng8(sdata + 4, m_sprite.dataLength - 4, indexData, width, height);
         break;
     }
 }
 
-SDL_Surface * Sffv2::renderToSurface(size_t spriteNumber, size_t currentPaletteId)
+bool Sffv2::Drawer::trueColor() const
+{
+    return m_sprite.trueColor();
+}
+
+void Sffv2::Drawer::drawColors(uint8_t * rgbaData, size_t width, size_t height)
+{
+    // PNG24 or PNG32, after the 4 bytes of uncompressed size
+    if (m_sprite.dataLength > 4)
+        decodePngRgba(spriteData() + 4, m_sprite.dataLength - 4, rgbaData, width, height);
+}
+
+size_t Sffv2::displayedSprite(size_t spriteNumber) const
 {
     // Case of a linked sprite
-    size_t displayedSprite = spriteNumber;
-    if (m_sffv2Container[spriteNumber].linkedindex)
-        displayedSprite = m_sffv2Container[spriteNumber].linkedindex;
-    Sffv2::SpriteInfo & sprite = m_sffv2Container[displayedSprite];
+    const size_t linkedindex = m_sffv2Container[spriteNumber].linkedindex;
+    if (linkedindex && linkedindex < m_sffv2Container.size())
+        return linkedindex;
+    return spriteNumber;
+}
+
+Sprite Sffv2::renderRgba(size_t spriteNumber, size_t currentPaletteId, SpriteTarget * target)
+{
+    Sffv2::SpriteInfo & sprite = m_sffv2Container[displayedSprite(spriteNumber)];
     // Guess:
     // if the sprite indicates a palette number other than 0, it's forcing that one
     size_t paletteUsed = sprite.paletteIndex;
-    if (!paletteUsed)
+    if (!paletteUsed || paletteUsed >= m_paletteColors.size())
         paletteUsed = currentPaletteId;
-    // case of a linked palette
-    if (m_palettes[paletteUsed].linkedindex)
-        paletteUsed = m_palettes[paletteUsed].linkedindex;
-    return Drawer(sprite, m_palettes[paletteUsed], m_ldata, m_tdata)();
+    Drawer drawer(sprite, &m_colorTables[paletteUsed], m_ldata, m_tdata);
+    SDL_Surface * surface = nullptr;
+    if (target)
+        drawer.drawTo(*target, m_trimming);
+    else
+        surface = drawer(m_trimming);
+    return Sprite(spriteRef(spriteNumber), surface, currentPaletteId, spriteGeometry(spriteNumber, drawer.geometry()));
+}
+
+int Sffv2::spritePaletteId(size_t spriteNumber) const
+{
+    const Sffv2::SpriteInfo & sprite = m_sffv2Container[displayedSprite(spriteNumber)];
+    if (sprite.paletteIndex && sprite.paletteIndex < m_paletteColors.size())
+        return sprite.paletteIndex;
+    return -1;
+}
+
+Sprite Sffv2::renderIndexed(size_t spriteNumber, SpriteTarget * target)
+{
+    Drawer drawer(m_sffv2Container[displayedSprite(spriteNumber)], nullptr, m_ldata, m_tdata);
+    SDL_Surface * surface = nullptr;
+    if (target)
+        drawer.drawTo(*target, m_trimming);
+    else
+        surface = drawer(m_trimming);
+    return Sprite(spriteRef(spriteNumber), surface, spritePaletteId(spriteNumber), spriteGeometry(spriteNumber, drawer.geometry()));
+}
+
+Spriteref Sffv2::spriteRef(size_t spriteNumber) const
+{
+    const SpriteInfo & sprite = m_sffv2Container[spriteNumber];
+    return Spriteref(sprite.groupno, sprite.itemno);
+}
+
+SpriteGeometry Sffv2::spriteGeometry(size_t spriteNumber, SpriteGeometry drawn) const
+{
+    // a linked sprite keeps its own axis
+    const SpriteInfo & sprite = m_sffv2Container[spriteNumber];
+    drawn.axisX = static_cast<int16_t>(sprite.axisx);
+    drawn.axisY = static_cast<int16_t>(sprite.axisy);
+    return drawn;
 }
 
 void Sffv2::load()
 {
-    m_sprites.clear();
-    for (size_t currentPalette = 0; currentPalette < m_palettes.size(); currentPalette++) {
-        std::unordered_map<Spriteref, Sprite> currentPaletteSprites;
-        for (size_t currentSprite = 0; currentSprite < m_sffv2Container.size(); currentSprite++) {
-            SpriteInfo & sprite = m_sffv2Container[currentSprite];
-            Spriteref ref(sprite.groupno, sprite.itemno);
-            currentPaletteSprites.insert(std::pair<Spriteref, Sprite>(ref, Sprite(ref, renderToSurface(currentSprite, currentPalette), currentPalette)));
-        }
-        m_sprites.push_back(currentPaletteSprites);
+    std::vector<std::pair<Spriteref, size_t>> selection;
+    selection.reserve(m_sffv2Container.size());
+    for (size_t currentSprite = 0; currentSprite < m_sffv2Container.size(); currentSprite++) {
+        SpriteInfo & sprite = m_sffv2Container[currentSprite];
+        selection.emplace_back(Spriteref(sprite.groupno, sprite.itemno), currentSprite);
     }
+    loadSelection(selection);
 }
 
 void Sffv2::load(std::vector<Spriteref>::iterator first, std::vector<Spriteref>::iterator last)
 {
-    m_sprites.clear();
-    for (size_t currentPalette = 0; currentPalette < m_palettes.size(); currentPalette++)
-        m_sprites.push_back(std::unordered_map<Spriteref, Sprite>());
-
+    std::vector<std::pair<Spriteref, size_t>> selection;
     for (; first != last; first++) {
-        for (size_t currentPalette = 0; currentPalette < m_palettes.size(); currentPalette++) {
-            Spriteref & ref = *first;
-            size_t currentSprite = m_groups[ref.group].i[ref.image];
-            m_sprites[currentPalette].insert(std::pair<Spriteref, Sprite>(ref, Sprite(ref, renderToSurface(currentSprite, currentPalette), currentPalette)));
+        size_t currentSprite = m_index.find(*first);
+        // sprites missing from the file are left out
+        if (currentSprite != SpriteIndex::npos)
+            selection.emplace_back(*first, currentSprite);
+    }
+    loadSelection(selection);
+}
+
+void Sffv2::loadSelection(const std::vector<std::pair<Spriteref, size_t>> & selection)
+{
+    m_sprites.clear();
+    // linked sprites and identical payloads are decoded once, and share their pixels
+    std::vector<SpritePayload> payloads;
+    std::vector<int> paletteIds;
+    payloads.reserve(selection.size());
+    paletteIds.reserve(selection.size());
+    for (auto & selected : selection) {
+        const SpriteInfo & sprite = m_sffv2Container[displayedSprite(selected.second)];
+        const uint8_t * data = (sprite.usesTData() ? m_tdata : m_ldata) + sprite.dataOffset;
+        const uint64_t layout = sprite.width | static_cast<uint64_t>(sprite.height) << 16 | static_cast<uint64_t>(sprite.fmt) << 32;
+        payloads.push_back({ data, sprite.dataLength, layout });
+        paletteIds.push_back(spritePaletteId(selected.second));
+    }
+    const std::vector<size_t> firsts = findIdenticalPayloads(payloads);
+    if (m_format == SpriteFormat::Indexed8) {
+        std::vector<SpritePixels> pixels(selection.size());
+        std::vector<SpriteGeometry> geometries(selection.size());
+        WorkerPool::instance().parallelFor(selection.size(), [&](size_t i) {
+            if (firsts[i] != i)
+                return;
+            Drawer drawer(m_sffv2Container[displayedSprite(selection[i].second)], nullptr, m_ldata, m_tdata);
+            pixels[i] = SpritePixels(drawer(m_trimming), SDL_FreeSurface);
+            geometries[i] = drawer.geometry();
+        });
+        std::unordered_map<Spriteref, Sprite> indexedSprites;
+        for (size_t i = 0; i < selection.size(); i++) {
+            const Spriteref & ref = selection[i].first;
+            const SpriteGeometry geometry = spriteGeometry(selection[i].second, geometries[firsts[i]]);
+            indexedSprites.insert(std::pair<Spriteref, Sprite>(ref, Sprite(ref, pixels[firsts[i]], paletteIds[i], geometry)));
+        }
+        m_sprites.push_back(std::move(indexedSprites));
+        return;
+    }
+    // one surface per distinct payload and color table: a sprite forcing its palette looks the same in every palette,
+    // and a true color sprite does not depend on the palettes at all
+    const size_t nSprites = selection.size();
+    const size_t firstPalette = firstLoadedPalette(m_palettes.size());
+    const size_t nPalettes = lastLoadedPalette(m_palettes.size()) - firstPalette;
+    std::vector<std::pair<size_t, size_t>> surfaceKeys;
+    std::unordered_map<uint64_t, size_t> surfaceNumbers;
+    std::vector<size_t> spriteSurfaces(nPalettes * nSprites);
+    for (size_t n = 0; n < nPalettes; n++) {
+        for (size_t i = 0; i < nSprites; i++) {
+            const bool trueColor = m_sffv2Container[displayedSprite(selection[i].second)].trueColor();
+            const size_t colorTable = paletteIds[i] >= 0 ? paletteIds[i] : trueColor ? firstPalette : firstPalette + n;
+            auto surfaceNumber = surfaceNumbers.insert(std::make_pair(static_cast<uint64_t>(firsts[i]) << 32 | colorTable, surfaceKeys.size()));
+            if (surfaceNumber.second)
+                surfaceKeys.emplace_back(firsts[i], colorTable);
+            spriteSurfaces[n * nSprites + i] = surfaceNumber.first->second;
         }
     }
+    std::vector<SpritePixels> pixels(surfaceKeys.size());
+    std::vector<SpriteGeometry> geometries(surfaceKeys.size());
+    WorkerPool::instance().parallelFor(surfaceKeys.size(), [&](size_t i) {
+        Drawer drawer(m_sffv2Container[displayedSprite(selection[surfaceKeys[i].first].second)], &m_colorTables[surfaceKeys[i].second], m_ldata, m_tdata);
+        pixels[i] = SpritePixels(drawer(m_trimming), SDL_FreeSurface);
+        geometries[i] = drawer.geometry();
+    });
+    for (size_t n = 0; n < nPalettes; n++) {
+        std::unordered_map<Spriteref, Sprite> currentPaletteSprites;
+        for (size_t i = 0; i < nSprites; i++) {
+            const Spriteref & ref = selection[i].first;
+            const size_t surface = spriteSurfaces[n * nSprites + i];
+            currentPaletteSprites.insert(std::pair<Spriteref, Sprite>(ref, Sprite(ref, pixels[surface], firstPalette + n, spriteGeometry(selection[i].second, geometries[surface]))));
+        }
+        m_sprites.push_back(std::move(currentPaletteSprites));
+    }
 }
 
+Sprite * Sffv2::loadSprite(const Spriteref & ref, size_t palette)
+{
+    size_t currentSprite = m_index.find(ref);
+    if (currentSprite == SpriteIndex::npos)
+        return nullptr;
+    if (m_format == SpriteFormat::Indexed8)
+        return new Sprite(renderIndexed(currentSprite));
+    if (palette >= m_paletteColors.size())
+        return nullptr;
+    return new Sprite(renderRgba(currentSprite, palette));
 }
+
+Sprite * Sffv2::drawSprite(const Spriteref & ref, size_t palette, SpriteTarget & target)
+{
+    size_t currentSprite = m_index.find(ref);
+    if (currentSprite == SpriteIndex::npos)
+        return nullptr;
+    if (m_format == SpriteFormat::Indexed8)
+        return new Sprite(renderIndexed(currentSprite, &target));
+    if (palette >= m_paletteColors.size())
+        return nullptr;
+    return new Sprite(renderRgba(currentSprite, palette, &target));
 }
 
+}
+}
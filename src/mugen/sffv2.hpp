@@ -21,6 +21,7 @@
 #define SFFV2_H
 
 #include "sprites.hpp"
+#include "mappedfile.hpp"
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -45,7 +46,7 @@ private:
 		uint16_t axisx;
 		uint16_t axisy;
 		uint16_t linkedindex;
-		uint8_t fmt; // Format: 0 -> raw, 1 -> invalid, 2 -> RLE8, 3 -> RLE5, 4 -> LZ5
+		uint8_t fmt; // Format: 0 -> raw, 1 -> invalid, 2 -> RLE8, 3 -> RLE5, 4 -> LZ5, 10 -> PNG8, 11 -> PNG24, 12 -> PNG32
 		uint8_t coldepth;
 		uint32_t dataOffset;
 		uint32_t dataLength;
@@ -55,6 +56,8 @@ private:
 		// bit 1 to 15: unused
 		SDL_Texture * texture;
 		bool usesTData() const;
+		// PNG24 and PNG32 sprites have their own colors, and no palette
+		bool trueColor() const;
 	};
 
 	struct PaletteInfo {
@@ -67,45 +70,64 @@ private:
 		// there are 4 bytes per color: 3 for RGB 8-bit values, and a last, unused byte
 	};
 
-	struct GroupInfo {
-		std::unordered_map<size_t, size_t> i;
-	};
 public:
     Sffv2(const char* filename);
     ~Sffv2();
     void load();
     void load(std::vector<Spriteref>::iterator first, std::vector<Spriteref>::iterator last);
+    Sprite * loadSprite(const Spriteref & ref, size_t palette);
+    Sprite * drawSprite(const Spriteref & ref, size_t palette, SpriteTarget & target);
+    int findPalette(uint16_t group, uint16_t item);
 protected:
     void loadSffFile();
-    SpriteInfo readSprite(std::ifstream & fileobj);
-    PaletteInfo readPalette(std::ifstream & fileobj);
-    SDL_Surface * renderToSurface(size_t spriteNumber, size_t currentPaletteId);
+    SpriteInfo readSprite(const uint8_t * node);
+    PaletteInfo readPalette(const uint8_t * node);
+    Palette readPaletteColors(size_t paletteNumber) const;
+    size_t displayedSprite(size_t spriteNumber) const;
+    Sprite renderRgba(size_t spriteNumber, size_t currentPaletteId, SpriteTarget * target = nullptr);
+    // palette forced by a sprite, -1 if it uses the selected one
+    int spritePaletteId(size_t spriteNumber) const;
+    Sprite renderIndexed(size_t spriteNumber, SpriteTarget * target = nullptr);
+    Spriteref spriteRef(size_t spriteNumber) const;
+    // geometry of a drawn sprite, with its axis
+    SpriteGeometry spriteGeometry(size_t spriteNumber, SpriteGeometry drawn) const;
+    void loadSelection(const std::vector<std::pair<Spriteref, size_t>> & selection);
 private:
 	class Drawer: public SurfaceDrawer {
 	public:
-		Drawer(const SpriteInfo& sprite, const PaletteInfo& palette, uint8_t * ldata, uint8_t * tdata);
+		Drawer(const SpriteInfo& sprite, const ColorTable * colors, const uint8_t * ldata, const uint8_t * tdata);
 		~Drawer() {};
 	protected:
-		void draw(uint32_t * pixelData, size_t width, size_t height);
+		void draw(uint8_t * indexData, size_t width, size_t height);
+		bool trueColor() const;
+		void drawColors(uint8_t * rgbaData, size_t width, size_t height);
 	private:
+		const uint8_t * spriteData() const;
 		const SpriteInfo& m_sprite;
-		const PaletteInfo& m_palette;
 		const uint8_t * m_ldata;
 		const uint8_t * m_tdata;
 	};
-    static const size_t READBUF_SIZE = 32;
+    static const size_t HEADER_SIZE = 512;
+    static const size_t SPRITE_NODE_SIZE = 28;
+    static const size_t PALETTE_NODE_SIZE = 16;
     std::string m_filename;
+    MappedFile m_file;
     std::vector<SpriteInfo> m_sffv2Container;
     std::vector<PaletteInfo> m_palettes;
-    std::unordered_map<size_t, GroupInfo> m_groups;
-    uint8_t * m_ldata;
+    // colors of each palette, with linked palettes already resolved
+    std::vector<Palette> m_paletteColors;
+    std::vector<ColorTable> m_colorTables;
+    // ldata and tdata point into the mapped sprite file
+    const uint8_t * m_ldata;
     uint32_t m_ldataLength;
-    uint8_t * m_tdata;
+    const uint8_t * m_tdata;
     uint32_t m_tdataLength;
     SDL_Texture * m_texture;
 	std::vector<std::unordered_map<Spriteref, Sprite>> m_sprites;
 public:
-	std::vector<std::unordered_map<Spriteref, Sprite>> sprites() { return m_sprites; };
+	std::vector<std::unordered_map<Spriteref, Sprite>> takeSprites() { return std::move(m_sprites); };
+	std::vector<Palette> palettes() { return m_paletteColors; };
+	size_t selectablePalettes() { return m_paletteColors.size(); };
 };
 
 }
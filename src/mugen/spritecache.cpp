@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "spritecache.hpp"
+
+namespace Nugem {
+namespace Mugen {
+
+SpriteCache::SpriteCache(size_t budget): m_budget(budget), m_usage(0)
+{
+}
+
+std::shared_ptr<const Sprite> SpriteCache::get(const Spriteref & ref, size_t palette)
+{
+	auto found = m_index.find({ ref, palette });
+	if (found == m_index.end())
+		return nullptr;
+	// move the entry to the front of the list
+	m_entries.splice(m_entries.begin(), m_entries, found->second);
+	return found->second->sprite;
+}
+
+void SpriteCache::insert(const Spriteref & ref, size_t palette, std::shared_ptr<const Sprite> sprite)
+{
+	if (!sprite)
+		return;
+	Key key { ref, palette };
+	auto found = m_index.find(key);
+	if (found != m_index.end()) {
+		m_usage -= found->second->cost;
+		m_entries.erase(found->second);
+		m_index.erase(found);
+	}
+	const size_t cost = spriteCost(*sprite);
+	m_entries.push_front({ key, std::move(sprite), cost });
+	m_index[key] = m_entries.begin();
+	m_usage += cost;
+	evict();
+}
+
+void SpriteCache::clear()
+{
+	m_entries.clear();
+	m_index.clear();
+	m_usage = 0;
+}
+
+void SpriteCache::setBudget(size_t budget)
+{
+	m_budget = budget;
+	evict();
+}
+
+size_t SpriteCache::spriteCost(const Sprite & sprite)
+{
+	const SDL_Surface * surface = sprite.surface();
+	size_t cost = sizeof(Sprite);
+	if (surface)
+		cost += surface->h * surface->pitch;
+	return cost;
+}
+
+void SpriteCache::evict()
+{
+	// the most recent sprite is kept even if it is over budget on its own
+	while (m_usage > m_budget && m_entries.size() > 1) {
+		Entry & entry = m_entries.back();
+		m_usage -= entry.cost;
+		m_index.erase(entry.key);
+		m_entries.pop_back();
+	}
+}
+
+}
+}
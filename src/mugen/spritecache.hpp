@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPRITECACHE_HPP
+#define SPRITECACHE_HPP
+
+#include "sprites.hpp"
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+namespace Nugem {
+namespace Mugen {
+
+/**
+ * Least recently used cache of decoded sprites, keyed by sprite reference and palette.
+ *
+ * The cache holds at most budget() bytes of pixel data: the least recently requested sprites are dropped first.
+ * A sprite dropped from the cache stays alive as long as someone else holds it.
+ */
+class SpriteCache {
+public:
+	SpriteCache(size_t budget = DEFAULT_BUDGET);
+	// nullptr if the sprite is not in the cache
+	std::shared_ptr<const Sprite> get(const Spriteref & ref, size_t palette);
+	void insert(const Spriteref & ref, size_t palette, std::shared_ptr<const Sprite> sprite);
+	void clear();
+	void setBudget(size_t budget);
+	size_t budget() const { return m_budget; };
+	// bytes currently held by the cache
+	size_t usage() const { return m_usage; };
+	size_t count() const { return m_entries.size(); };
+	static size_t spriteCost(const Sprite & sprite);
+	static const size_t DEFAULT_BUDGET = 64 * 1024 * 1024;
+private:
+	struct Key {
+		Spriteref ref;
+		size_t palette;
+		bool operator==(const Key & key) const { return ref == key.ref && palette == key.palette; }
+	};
+	struct KeyHash {
+		size_t operator()(const Key & key) const { return std::hash<Spriteref>()(key.ref) ^ (std::hash<size_t>()(key.palette) << 3); }
+	};
+	struct Entry {
+		Key key;
+		std::shared_ptr<const Sprite> sprite;
+		size_t cost;
+	};
+	void evict();
+	// most recently used first
+	std::list<Entry> m_entries;
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+	size_t m_budget;
+	size_t m_usage;
+};
+
+}
+}
+
+#endif // SPRITECACHE_HPP
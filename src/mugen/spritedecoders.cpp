@@ -0,0 +1,504 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "spritedecoders.hpp"
+
+#include "inflate.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace Nugem {
+namespace Mugen {
+
+// Writes a run of one color, clipped to the sprite
+static inline void fillRun(uint8_t * indexData, size_t & indexPixel, size_t nPixels, uint8_t color, size_t runLength)
+{
+    runLength = std::min(runLength, nPixels - indexPixel);
+    memset(indexData + indexPixel, color, runLength);
+    indexPixel += runLength;
+}
+
+void decodePcx(const uint8_t * data, size_t dataLength, uint8_t * indexData, size_t nPixels)
+{
+    size_t indexPixel = 0;
+    for (size_t i_byte = 0; indexPixel < nPixels && i_byte < dataLength; i_byte++) {
+        if ((data[i_byte] & 0xC0) == 0xC0) { // RLE byte
+            if (i_byte + 1 >= dataLength)
+                return;
+            const size_t runLength = data[i_byte] & 0x3F;
+            i_byte++;
+            fillRun(indexData, indexPixel, nPixels, data[i_byte], runLength);
+        }
+        else // simple pixel byte
+            indexData[indexPixel++] = data[i_byte];
+    }
+}
+
+void decodeRle8(const uint8_t * data, size_t dataLength, uint8_t * indexData, size_t nPixels)
+{
+    size_t indexPixel = 0;
+    // first 4 bytes are the size of uncompressed data
+    for (size_t i_byte = 4; i_byte < dataLength && indexPixel < nPixels; i_byte++) {
+        const uint8_t first_byte = data[i_byte];
+        if ((first_byte & 0xC0) == 0x40) { // in the case of a RLE control packet, the color is the next byte
+            if (i_byte + 1 >= dataLength)
+                return;
+            i_byte++;
+            fillRun(indexData, indexPixel, nPixels, data[i_byte], first_byte & 0x3F);
+        }
+        else
+            indexData[indexPixel++] = first_byte;
+    }
+}
+
+void decodeRle5(const uint8_t * data, size_t dataLength, uint8_t * indexData, size_t nPixels)
+{
+    size_t indexPixel = 0;
+    // first 4 bytes are the size of uncompressed data
+    size_t i_byte = 4;
+    while (i_byte + 1 < dataLength && indexPixel < nPixels) {
+        const uint8_t run_length = data[i_byte++];
+        const uint8_t data_length = data[i_byte++];
+        uint8_t color = 0;
+        if (data_length & 0x80) { // testing the color bit
+            if (i_byte >= dataLength)
+                return;
+            color = data[i_byte++];
+        }
+        fillRun(indexData, indexPixel, nPixels, color, run_length);
+        // then (data_length - 1) bytes of 3-bit run length and 5-bit color
+        for (int bytes_processed = 0; bytes_processed < (data_length & 0x7F) - 1; bytes_processed++) {
+            if (i_byte >= dataLength)
+                return;
+            const uint8_t byte = data[i_byte++];
+            fillRun(indexData, indexPixel, nPixels, byte & 0x1F, byte >> 5);
+        }
+    }
+}
+
+void decodeLz5(const uint8_t * data, size_t dataLength, uint8_t * indexData, size_t nPixels)
+{
+    uint32_t shortlzpackets = 1;
+    uint8_t recycledbits = 0;
+    size_t indexPixel = 0;
+    // first 4 bytes are the size of uncompressed data
+    // so we skip them
+    size_t i_byte = 4;
+    while (i_byte < dataLength && indexPixel < nPixels) {
+        const uint8_t control_packet = data[i_byte++];
+        for (int i_data_packet = 0; i_data_packet < 8 && i_byte < dataLength && indexPixel < nPixels; i_data_packet++) {
+            const uint8_t packet = data[i_byte++];
+            if (!(control_packet & (1 << i_data_packet))) { // RLE packet (short or long)
+                const uint8_t color = packet & 0x1F;
+                size_t run_length = packet >> 5; // short RLE packet: the color runs in 1 to 7 pixels
+                if (!run_length) { // long RLE packet: the color runs in 8 to 263 pixels
+                    if (i_byte >= dataLength)
+                        return;
+                    run_length = data[i_byte++] + 8;
+                }
+                fillRun(indexData, indexPixel, nPixels, color, run_length);
+                continue;
+            }
+            // LZ packet (short or long)
+            size_t copylength = packet & 0x3F; // bits 0-5
+            size_t offset;
+            if (copylength) { // short LZ packet, if initial copy length is not null
+                copylength += 1;
+                // How recycled bits work:
+                // bits 6-7: recycled bits of short LZ packet 4k + 1
+                // bits 4-5: recycled bits of short LZ packet 4k + 2
+                // bits 2-3: recycled bits of short LZ packet 4k + 3
+                // bits 0-1: recycled bits of short LZ packet 4k + 4
+                if (shortlzpackets % 4 == 0) { // use the recycled bits as the offset
+                    recycledbits |= (packet & 0xC0) >> 6;
+                    offset = recycledbits + 1;
+                    // new recycled bits cycle
+                    recycledbits = 0;
+                }
+                else { // read the extra byte
+                    if (i_byte >= dataLength)
+                        return;
+                    recycledbits |= (packet & 0xC0) >> (2 * ((shortlzpackets - 1) % 4));
+                    offset = data[i_byte++] + 1;
+                }
+                shortlzpackets++;
+            }
+            else { // long LZ packet: 10-bit offset, high 2 bits in the packet
+                if (i_byte + 1 >= dataLength)
+                    return;
+                offset = (((packet & 0xC0) << 2) | data[i_byte]) + 1;
+                copylength = data[i_byte + 1] + 3;
+                i_byte += 2;
+            }
+            copylength = std::min(copylength, nPixels - indexPixel);
+            uint8_t * output = indexData + indexPixel;
+            if (offset > indexPixel) // reference before the start of the sprite: the data is corrupt
+                memset(output, 0, copylength);
+            else if (offset >= copylength) // no overlap
+                memcpy(output, output - offset, copylength);
+            else if (offset == 1)
+                memset(output, output[-1], copylength);
+            else {
+                // the copy overlaps its source: the last offset pixels repeat,
+                // so the pattern is laid down once and then doubled
+                memcpy(output, output - offset, offset);
+                size_t copied = offset;
+                while (copied < copylength) {
+                    size_t chunk = std::min(copied, copylength - copied);
+                    memcpy(output + copied, output, chunk);
+                    copied += chunk;
+                }
+            }
+            indexPixel += copylength;
+        }
+    }
+}
+
+namespace {
+
+const uint8_t PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+enum PngColorType {
+    PNG_GRAY = 0,
+    PNG_RGB = 2,
+    PNG_PALETTE = 3,
+    PNG_GRAY_ALPHA = 4,
+    PNG_RGBA = 6
+};
+
+// Adam7 interlacing: first column, first row, column step and row step of each pass
+const uint8_t ADAM7_PASSES[7][4] = { { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+
+struct PngImage {
+    uint32_t width;
+    uint32_t height;
+    uint8_t depth;
+    uint8_t colorType;
+    bool interlaced;
+    unsigned channels;
+    // PLTE and tRNS chunks
+    const uint8_t * palette;
+    size_t paletteSize;
+    uint8_t paletteAlpha[256];
+    bool hasColorKey;
+    uint16_t colorKey[3];
+    // the compressed data is split in IDAT chunks
+    std::vector<std::pair<const uint8_t *, size_t>> compressed;
+};
+
+// Rows of one pass of the image, one row for a non-interlaced image
+struct PngPass {
+    size_t x0;
+    size_t y0;
+    size_t dx;
+    size_t dy;
+    size_t width;
+    size_t height;
+    size_t rowBytes;
+};
+
+inline uint32_t readBigEndian32(const uint8_t * data)
+{
+    return static_cast<uint32_t>(data[0]) << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+// Reads the chunks, false if the image is invalid or not supported
+bool readPng(const uint8_t * data, size_t dataLength, PngImage & image)
+{
+    if (dataLength < 8 + 25 || memcmp(data, PNG_SIGNATURE, 8))
+        return false;
+    image.palette = nullptr;
+    image.paletteSize = 0;
+    memset(image.paletteAlpha, 0xFF, sizeof(image.paletteAlpha));
+    image.hasColorKey = false;
+    bool header = false;
+    size_t offset = 8;
+    while (offset + 12 <= dataLength) {
+        const uint32_t length = readBigEndian32(data + offset);
+        const uint8_t * type = data + offset + 4;
+        const uint8_t * chunk = data + offset + 8;
+        if (length > dataLength - offset - 12)
+            break;
+        offset += 12 + length;
+        if (!memcmp(type, "IHDR", 4)) {
+            if (length < 13)
+                return false;
+            image.width = readBigEndian32(chunk);
+            image.height = readBigEndian32(chunk + 4);
+            image.depth = chunk[8];
+            image.colorType = chunk[9];
+            image.interlaced = chunk[12] == 1;
+            // compression and filter methods
+            if (chunk[10] || chunk[11] || chunk[12] > 1)
+                return false;
+            switch (image.colorType) {
+            case PNG_GRAY:
+                image.channels = 1;
+                header = image.depth == 1 || image.depth == 2 || image.depth == 4 || image.depth == 8 || image.depth == 16;
+                break;
+            case PNG_PALETTE:
+                image.channels = 1;
+                header = image.depth == 1 || image.depth == 2 || image.depth == 4 || image.depth == 8;
+                break;
+            case PNG_RGB:
+            case PNG_GRAY_ALPHA:
+            case PNG_RGBA:
+                image.channels = image.colorType == PNG_RGB ? 3 : image.colorType == PNG_RGBA ? 4 : 2;
+                header = image.depth == 8 || image.depth == 16;
+                break;
+            }
+            if (!header)
+                return false;
+        }
+        else if (!header) {
+            // IHDR comes first
+            return false;
+        }
+        else if (!memcmp(type, "PLTE", 4)) {
+            image.palette = chunk;
+            image.paletteSize = std::min<size_t>(length / 3, 256);
+        }
+        else if (!memcmp(type, "tRNS", 4)) {
+            if (image.colorType == PNG_PALETTE)
+                memcpy(image.paletteAlpha, chunk, std::min<size_t>(length, 256));
+            else if (image.colorType == PNG_GRAY && length >= 2) {
+                image.hasColorKey = true;
+                image.colorKey[0] = chunk[0] << 8 | chunk[1];
+            }
+            else if (image.colorType == PNG_RGB && length >= 6) {
+                image.hasColorKey = true;
+                for (int i = 0; i < 3; i++)
+                    image.colorKey[i] = chunk[2 * i] << 8 | chunk[2 * i + 1];
+            }
+        }
+        else if (!memcmp(type, "IDAT", 4)) {
+            image.compressed.emplace_back(chunk, length);
+        }
+        else if (!memcmp(type, "IEND", 4)) {
+            break;
+        }
+    }
+    return header && !image.compressed.empty();
+}
+
+inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+// Undoes the filter of a row, given the previous one: the bytes before the first pixel count as zero.
+// false for an unknown filter.
+bool unfilter(uint8_t filter, uint8_t * row, const uint8_t * previous, size_t rowBytes, size_t pixelBytes)
+{
+    switch (filter) {
+    case 0: // none
+        break;
+    case 1: // sub
+        for (size_t i = pixelBytes; i < rowBytes; i++)
+            row[i] += row[i - pixelBytes];
+        break;
+    case 2: // up
+        for (size_t i = 0; i < rowBytes; i++)
+            row[i] += previous[i];
+        break;
+    case 3: // average
+        for (size_t i = 0; i < pixelBytes && i < rowBytes; i++)
+            row[i] += previous[i] >> 1;
+        for (size_t i = pixelBytes; i < rowBytes; i++)
+            row[i] += (row[i - pixelBytes] + previous[i]) >> 1;
+        break;
+    case 4: // paeth
+        for (size_t i = 0; i < pixelBytes && i < rowBytes; i++)
+            row[i] += previous[i];
+        for (size_t i = pixelBytes; i < rowBytes; i++)
+            row[i] += paeth(row[i - pixelBytes], previous[i], previous[i - pixelBytes]);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Sample number i of a row, of depth bits
+inline unsigned sample(const uint8_t * row, size_t i, unsigned depth)
+{
+    switch (depth) {
+    case 8:
+        return row[i];
+    case 16:
+        return row[2 * i] << 8 | row[2 * i + 1];
+    default:
+        return (row[i * depth / 8] >> (8 - depth - i * depth % 8)) & ((1 << depth) - 1);
+    }
+}
+
+// Inflates and unfilters the rows of an image, handing them one by one to writeRow(row, pass, y)
+template <typename RowWriter>
+void inflateRows(const PngImage & image, RowWriter writeRow)
+{
+    const size_t bitsPerPixel = image.channels * image.depth;
+    const size_t pixelBytes = std::max<size_t>(1, bitsPerPixel / 8);
+    std::vector<PngPass> passes;
+    for (int i = 0; i < (image.interlaced ? 7 : 1); i++) {
+        PngPass pass;
+        pass.x0 = image.interlaced ? ADAM7_PASSES[i][0] : 0;
+        pass.y0 = image.interlaced ? ADAM7_PASSES[i][1] : 0;
+        pass.dx = image.interlaced ? ADAM7_PASSES[i][2] : 1;
+        pass.dy = image.interlaced ? ADAM7_PASSES[i][3] : 1;
+        pass.width = image.width > pass.x0 ? (image.width - pass.x0 + pass.dx - 1) / pass.dx : 0;
+        pass.height = image.height > pass.y0 ? (image.height - pass.y0 + pass.dy - 1) / pass.dy : 0;
+        pass.rowBytes = (pass.width * bitsPerPixel + 7) / 8;
+        // empty passes have no rows at all, not even their filter bytes
+        if (pass.width && pass.height)
+            passes.push_back(pass);
+    }
+    if (passes.empty())
+        return;
+    // the filter byte, then the row, twice: the row being filled and the previous one, zero before the first row of a pass
+    size_t rowStride = 0;
+    for (const PngPass & pass : passes)
+        rowStride = std::max(rowStride, pass.rowBytes + 1);
+    std::vector<uint8_t> rows(2 * rowStride, 0);
+    uint8_t * row = rows.data();
+    uint8_t * previous = rows.data() + rowStride;
+    size_t passNumber = 0;
+    size_t y = 0;
+    size_t filled = 0;
+    size_t chunk = 0;
+    Inflater inflater([&](const uint8_t * & data, size_t & size) {
+        if (chunk == image.compressed.size())
+            return false;
+        data = image.compressed[chunk].first;
+        size = image.compressed[chunk].second;
+        chunk++;
+        return true;
+    }, [&](const uint8_t * data, size_t size) {
+        while (size) {
+            const PngPass & pass = passes[passNumber];
+            const size_t copied = std::min(pass.rowBytes + 1 - filled, size);
+            memcpy(row + filled, data, copied);
+            filled += copied;
+            data += copied;
+            size -= copied;
+            if (filled < pass.rowBytes + 1)
+                break;
+            if (!unfilter(row[0], row + 1, previous + 1, pass.rowBytes, pixelBytes))
+                return false;
+            writeRow(row + 1, pass, y);
+            std::swap(row, previous);
+            filled = 0;
+            if (++y < pass.height)
+                continue;
+            y = 0;
+            if (++passNumber == passes.size())
+                return false;
+            // the first row of a pass has no previous row
+            memset(previous, 0, rowStride);
+        }
+        return true;
+    });
+    inflater.inflateZlib();
+}
+
+}
+
+void decodePng8(const uint8_t * data, size_t dataLength, uint8_t * indexData, size_t width, size_t height)
+{
+    PngImage image;
+    if (!readPng(data, dataLength, image) || (image.colorType != PNG_PALETTE && image.colorType != PNG_GRAY))
+        return;
+    inflateRows(image, [&](const uint8_t * row, const PngPass & pass, size_t y) {
+        const size_t imageY = pass.y0 + y * pass.dy;
+        if (imageY >= height)
+            return;
+        uint8_t * indexRow = indexData + imageY * width;
+        if (pass.dx == 1 && image.depth == 8) {
+            memcpy(indexRow, row, std::min<size_t>(pass.width, width));
+            return;
+        }
+        // 16-bit samples keep their high byte
+        const unsigned shift = image.depth == 16 ? 8 : 0;
+        for (size_t x = 0, imageX = pass.x0; x < pass.width && imageX < width; x++, imageX += pass.dx)
+            indexRow[imageX] = sample(row, x, image.depth) >> shift;
+    });
+}
+
+void decodePngRgba(const uint8_t * data, size_t dataLength, uint8_t * rgbaData, size_t width, size_t height)
+{
+    PngImage image;
+    if (!readPng(data, dataLength, image))
+        return;
+    const unsigned depth = image.depth;
+    const unsigned maximum = (1 << depth) - 1;
+    inflateRows(image, [&](const uint8_t * row, const PngPass & pass, size_t y) {
+        const size_t imageY = pass.y0 + y * pass.dy;
+        if (imageY >= height)
+            return;
+        uint8_t * rgbaRow = rgbaData + imageY * width * 4;
+        // the usual 8-bit colors, without a color key
+        if (depth == 8 && (image.colorType == PNG_RGBA || (image.colorType == PNG_RGB && !image.hasColorKey))) {
+            const unsigned channels = image.channels;
+            for (size_t x = 0, imageX = pass.x0; x < pass.width && imageX < width; x++, imageX += pass.dx) {
+                const uint8_t * pixel = row + x * channels;
+                if (channels == 4 && !pixel[3])
+                    continue;
+                uint8_t * rgba = rgbaRow + imageX * 4;
+                memcpy(rgba, pixel, 3);
+                rgba[3] = channels == 4 ? pixel[3] : 0xFF;
+            }
+            return;
+        }
+        for (size_t x = 0, imageX = pass.x0; x < pass.width && imageX < width; x++, imageX += pass.dx) {
+            uint8_t rgba[4] = { 0, 0, 0, 0xFF };
+            if (image.colorType == PNG_PALETTE) {
+                const unsigned index = sample(row, x, depth);
+                if (index >= image.paletteSize)
+                    continue;
+                memcpy(rgba, image.palette + 3 * index, 3);
+                rgba[3] = image.paletteAlpha[index];
+            }
+            else {
+                unsigned samples[4];
+                for (unsigned channel = 0; channel < image.channels; channel++)
+                    samples[channel] = sample(row, x * image.channels + channel, depth);
+                const bool gray = image.colorType == PNG_GRAY || image.colorType == PNG_GRAY_ALPHA;
+                for (unsigned channel = 0; channel < 3; channel++)
+                    rgba[channel] = samples[gray ? 0 : channel] * 255 / maximum;
+                if (image.colorType == PNG_GRAY_ALPHA || image.colorType == PNG_RGBA)
+                    rgba[3] = samples[image.channels - 1] * 255 / maximum;
+                else if (image.hasColorKey && samples[0] == image.colorKey[0] && (gray || (samples[1] == image.colorKey[1] && samples[2] == image.colorKey[2])))
+                    rgba[3] = 0;
+            }
+            if (rgba[3])
+                memcpy(rgbaRow + imageX * 4, rgba, 4);
+        }
+    });
+}
+
+}
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPRITEDECODERS_HPP
+#define SPRITEDECODERS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Nugem {
+namespace Mugen {
+
+/**
+ * Decoders of the compressed sprite formats, writing 8-bit color indices, or RGBA pixels for the true color PNG sprites.
+ *
+ * The input is read within [data, data + dataLength), and at most nPixels indices are written.
+ * Pixels that the data does not cover are left untouched.
+ */
+
+// PCX run-length encoding (SFFv1), data starting after the 128-byte PCX header
+void decodePcx(const uint8_t * data, size_t dataLength, uint8_t * indexData, size_t nPixels);
+
+// RLE8 (SFFv2 format 2)
+void decodeRle8(const uint8_t * data, size_t dataLength, uint8_t * indexData, size_t nPixels);
+
+// RLE5 (SFFv2 format 3)
+void decodeRle5(const uint8_t * data, size_t dataLength, uint8_t * indexData, size_t nPixels);
+
+// LZ5 (SFFv2 format 4): https://web.archive.org/web/20141230125932/http://elecbyte.com/wiki/index.php/LZ5
+void decodeLz5(const uint8_t * data, size_t dataLength, uint8_t * indexData, size_t nPixels);
+
+// PNG (SFFv2 formats 10 to 12), data starting at the PNG signature.
+// The rows are inflated and unfiltered as they come, straight into the width * height pixels of the sprite:
+// the parts of the image outside of the sprite are dropped.
+
+// Color indices of a palette or grayscale image (format 10)
+void decodePng8(const uint8_t * data, size_t dataLength, uint8_t * indexData, size_t width, size_t height);
+
+// RGBA pixels of any image (formats 11 and 12), 4 bytes each in R, G, B, A order; the fully transparent pixels are left untouched
+void decodePngRgba(const uint8_t * data, size_t dataLength, uint8_t * rgbaData, size_t width, size_t height);
+
+}
+}
+
+#endif // SPRITEDECODERS_HPP
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "spritediskcache.hpp"
+
+#include "pixelexpand.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace Nugem {
+namespace Mugen {
+
+const char SpriteDiskCache::MAGIC[8] = { 'N', 'U', 'G', 'E', 'M', 'S', 'P', 'R' };
+
+namespace {
+
+uint64_t read_uint64(const uint8_t * data)
+{
+	return read_uint32(data) | (static_cast<uint64_t>(read_uint32(data + 4)) << 32);
+}
+
+void write_uint32(vector<uint8_t> & buffer, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		buffer.push_back((value >> (8 * i)) & 0xFF);
+}
+
+void write_uint64(vector<uint8_t> & buffer, uint64_t value)
+{
+	write_uint32(buffer, value & 0xFFFFFFFF);
+	write_uint32(buffer, value >> 32);
+}
+
+}
+
+string SpriteDiskCache::cachePath(const string & directory, const string & sffPath)
+{
+	// the file name keeps the cache readable, the hash of the path tells apart sprite files with the same name
+	size_t nameStart = sffPath.find_last_of("/\\");
+	string name = nameStart == string::npos ? sffPath : sffPath.substr(nameStart + 1);
+	char pathHash[17];
+	snprintf(pathHash, sizeof(pathHash), "%016llx", static_cast<unsigned long long>(hashBytes(reinterpret_cast<const uint8_t *>(sffPath.data()), sffPath.size())));
+	return directory + "/" + name + "." + pathHash + ".cache";
+}
+
+bool SpriteDiskCache::stamp(const string & path, SourceStamp & sourceStamp, bool withHash)
+{
+	struct stat fileStatus;
+	if (stat(path.c_str(), &fileStatus) != 0)
+		return false;
+	sourceStamp.size = fileStatus.st_size;
+	sourceStamp.mtime = fileStatus.st_mtime;
+	sourceStamp.hash = 0;
+	if (withHash) {
+		MappedFile file(path);
+		if (!file && sourceStamp.size > 0)
+			return false;
+		sourceStamp.hash = hashBytes(file.data(), file.size());
+	}
+	return true;
+}
+
+bool SpriteDiskCache::write(const string & cachePath, const vector<string> & sources, const unordered_map<Spriteref, Sprite> & sprites, const vector<Palette> & palettes, size_t selectablePalettes, bool trimmed)
+{
+	vector<SourceStamp> stamps(sources.size());
+	for (size_t i = 0; i < sources.size(); i++) {
+		if (!stamp(sources[i], stamps[i], true))
+			return false;
+	}
+	vector<const Sprite *> sorted;
+	sorted.reserve(sprites.size());
+	for (auto & entry: sprites) {
+		const int bytesPerPixel = entry.second.surface()->format->BytesPerPixel;
+		if (bytesPerPixel != 1 && bytesPerPixel != 4)
+			return false;
+		sorted.push_back(&entry.second);
+	}
+	sort(sorted.begin(), sorted.end(), [](const Sprite * a, const Sprite * b) { return a->ref().packed() < b->ref().packed(); });
+
+	vector<uint8_t> head(MAGIC, MAGIC + sizeof(MAGIC));
+	write_uint32(head, VERSION);
+	write_uint32(head, stamps.size());
+	write_uint32(head, sorted.size());
+	write_uint32(head, palettes.size());
+	write_uint32(head, trimmed ? TRIMMED : 0);
+	write_uint32(head, min(selectablePalettes, palettes.size()));
+	for (const SourceStamp & sourceStamp: stamps) {
+		write_uint64(head, sourceStamp.size);
+		write_uint64(head, sourceStamp.mtime);
+		write_uint64(head, sourceStamp.hash);
+	}
+	// each surface is stored once, at an aligned offset, even when several sprites share it
+	auto align = [](uint64_t offset) { return (offset + PIXEL_ALIGNMENT - 1) / PIXEL_ALIGNMENT * PIXEL_ALIGNMENT; };
+	const uint64_t tableSize = HEADER_SIZE + stamps.size() * STAMP_SIZE + sorted.size() * RECORD_SIZE + palettes.size() * PALETTE_NCOLORS * 4;
+	uint64_t pixelOffset = align(tableSize);
+	unordered_map<const SDL_Surface *, uint64_t> surfaceOffsets;
+	vector<pair<const SDL_Surface *, uint64_t>> blocks;
+	for (const Sprite * sprite: sorted) {
+		const SDL_Surface * surface = sprite->surface();
+		const SpriteGeometry & geometry = sprite->geometry();
+		auto surfaceOffset = surfaceOffsets.find(surface);
+		if (surfaceOffset == surfaceOffsets.end()) {
+			surfaceOffset = surfaceOffsets.insert({ surface, pixelOffset }).first;
+			blocks.push_back({ surface, pixelOffset });
+			pixelOffset = align(pixelOffset + static_cast<uint64_t>(surface->w) * surface->h * surface->format->BytesPerPixel);
+		}
+		write_uint32(head, sprite->ref().packed());
+		write_uint32(head, surface->w);
+		write_uint32(head, surface->h);
+		write_uint32(head, static_cast<uint32_t>(sprite->palette()));
+		write_uint64(head, surfaceOffset->second);
+		for (int value: { geometry.axisX, geometry.axisY, geometry.xOffset, geometry.yOffset, geometry.width, geometry.height })
+			write_uint32(head, static_cast<uint32_t>(value));
+		// 1 for color indices, 4 for the RGBA pixels of true color sprites (PNG)
+		write_uint32(head, surface->format->BytesPerPixel);
+	}
+	for (const Palette & palette: palettes) {
+		for (const SDL_Color & color: palette) {
+			head.push_back(color.r);
+			head.push_back(color.g);
+			head.push_back(color.b);
+			head.push_back(color.a);
+		}
+	}
+
+	// written next to the cache then renamed, so that a cache is never seen half-written
+	string temporaryPath = cachePath + ".tmp";
+	{
+		ofstream file(temporaryPath, ios::binary | ios::trunc);
+		file.write(reinterpret_cast<const char *>(head.data()), head.size());
+		uint64_t written = head.size();
+		const char padding[PIXEL_ALIGNMENT] = {};
+		for (auto & block: blocks) {
+			file.write(padding, block.second - written);
+			const SDL_Surface * surface = block.first;
+			const char * row = static_cast<const char *>(surface->pixels);
+			const size_t rowSize = surface->w * surface->format->BytesPerPixel;
+			for (int y = 0; y < surface->h; y++, row += surface->pitch)
+				file.write(row, rowSize);
+			written = block.second + static_cast<uint64_t>(rowSize) * surface->h;
+		}
+		if (!file) {
+			file.close();
+			remove(temporaryPath.c_str());
+			return false;
+		}
+	}
+	if (rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+		// rename does not replace an existing file everywhere
+		remove(cachePath.c_str());
+		if (rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+			remove(temporaryPath.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+bool SpriteDiskCache::open(const string & cachePath, const vector<string> & sources, bool trimmed)
+{
+	if (!openFile(cachePath))
+		return false;
+	if (m_nSources != sources.size() || m_trimmed != trimmed) {
+		close();
+		return false;
+	}
+	// size and modification time first, the content is only hashed when they match
+	for (size_t i = 0; i < m_nSources; i++) {
+		SourceStamp sourceStamp;
+		if (!stamp(sources[i], sourceStamp, false) || sourceStamp.size != read_uint64(m_stamps + i * STAMP_SIZE) || sourceStamp.mtime != static_cast<int64_t>(read_uint64(m_stamps + i * STAMP_SIZE + 8))) {
+			close();
+			return false;
+		}
+	}
+	for (size_t i = 0; i < m_nSources; i++) {
+		SourceStamp sourceStamp;
+		if (!stamp(sources[i], sourceStamp, true) || sourceStamp.hash != read_uint64(m_stamps + i * STAMP_SIZE + 16)) {
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool SpriteDiskCache::openPacked(const string & path)
+{
+	if (!openFile(path))
+		return false;
+	if (m_nSources) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool SpriteDiskCache::openFile(const string & path)
+{
+	close();
+	MappedFile file(path);
+	if (!file || file.size() < HEADER_SIZE || memcmp(file.data(), MAGIC, sizeof(MAGIC)) || read_uint32(file.data() + 8) != VERSION)
+		return false;
+	const uint8_t * data = file.data();
+	const size_t nSources = read_uint32(data + 12);
+	const size_t nSprites = read_uint32(data + 16);
+	const size_t nPalettes = read_uint32(data + 20);
+	const uint32_t flags = read_uint32(data + 24);
+	const size_t selectablePalettes = read_uint32(data + 28);
+	const uint64_t tableSize = HEADER_SIZE + static_cast<uint64_t>(nSources) * STAMP_SIZE + static_cast<uint64_t>(nSprites) * RECORD_SIZE + static_cast<uint64_t>(nPalettes) * PALETTE_NCOLORS * 4;
+	if (tableSize > file.size() || (flags & ~TRIMMED) || selectablePalettes > nPalettes)
+		return false;
+
+	const uint8_t * stamps = data + HEADER_SIZE;
+	const uint8_t * records = stamps + nSources * STAMP_SIZE;
+	SpriteIndex index;
+	index.reserve(nSprites);
+	for (size_t i = 0; i < nSprites; i++) {
+		const uint8_t * record = records + i * RECORD_SIZE;
+		const uint32_t width = read_uint32(record + 4);
+		const uint32_t height = read_uint32(record + 8);
+		const uint32_t bytesPerPixel = read_uint32(record + 48);
+		const uint64_t pixelSize = static_cast<uint64_t>(width) * height * bytesPerPixel;
+		const int32_t palette = static_cast<int32_t>(read_uint32(record + 12));
+		const uint64_t pixelOffset = read_uint64(record + 16);
+		if ((bytesPerPixel != 1 && bytesPerPixel != 4) || pixelOffset < tableSize || pixelOffset > file.size() || pixelSize > file.size() - pixelOffset || palette < -1 || palette >= static_cast<int32_t>(nPalettes))
+			return false;
+		// the stored pixels lie within the whole image
+		const int64_t xOffset = static_cast<int32_t>(read_uint32(record + 32));
+		const int64_t yOffset = static_cast<int32_t>(read_uint32(record + 36));
+		const int64_t imageWidth = static_cast<int32_t>(read_uint32(record + 40));
+		const int64_t imageHeight = static_cast<int32_t>(read_uint32(record + 44));
+		if (xOffset < 0 || yOffset < 0 || xOffset + width > imageWidth || yOffset + height > imageHeight)
+			return false;
+		uint32_t key = read_uint32(record);
+		index.add(Spriteref(key >> 16, key & 0xFFFF), i);
+	}
+	index.build();
+
+	const uint8_t * colors = records + nSprites * RECORD_SIZE;
+	vector<Palette> palettes(nPalettes);
+	for (Palette & palette: palettes) {
+		for (SDL_Color & color: palette) {
+			color = { colors[0], colors[1], colors[2], colors[3] };
+			colors += 4;
+		}
+	}
+
+	m_file = std::move(file);
+	m_stamps = stamps;
+	m_records = records;
+	m_nSources = nSources;
+	m_trimmed = flags & TRIMMED;
+	m_selectablePalettes = selectablePalettes;
+	m_index = std::move(index);
+	m_palettes = std::move(palettes);
+	return true;
+}
+
+void SpriteDiskCache::close()
+{
+	m_file.close();
+	m_stamps = nullptr;
+	m_records = nullptr;
+	m_nSources = 0;
+	m_trimmed = false;
+	m_selectablePalettes = 0;
+	m_index.clear();
+	m_palettes.clear();
+}
+
+uint64_t SpriteDiskCache::pixelOffset(size_t recordNumber) const
+{
+	return read_uint64(m_records + recordNumber * RECORD_SIZE + 16);
+}
+
+SpriteGeometry SpriteDiskCache::storedGeometry(size_t recordNumber) const
+{
+	const uint8_t * record = m_records + recordNumber * RECORD_SIZE;
+	SpriteGeometry geometry;
+	int * geometryValues[] = { &geometry.axisX, &geometry.axisY, &geometry.xOffset, &geometry.yOffset, &geometry.width, &geometry.height };
+	for (size_t i = 0; i < 6; i++)
+		*geometryValues[i] = static_cast<int32_t>(read_uint32(record + 24 + 4 * i));
+	return geometry;
+}
+
+int SpriteDiskCache::storedPalette(size_t recordNumber) const
+{
+	return static_cast<int32_t>(read_uint32(m_records + recordNumber * RECORD_SIZE + 12));
+}
+
+size_t SpriteDiskCache::storedBytesPerPixel(size_t recordNumber) const
+{
+	return read_uint32(m_records + recordNumber * RECORD_SIZE + 48);
+}
+
+Sprite * SpriteDiskCache::makeSprite(size_t recordNumber, SpriteTarget * target, const SpriteDrawing & drawing) const
+{
+	const uint8_t * record = m_records + recordNumber * RECORD_SIZE;
+	const uint32_t key = read_uint32(record);
+	const size_t width = read_uint32(record + 4);
+	const size_t height = read_uint32(record + 8);
+	int palette = storedPalette(recordNumber);
+	const uint8_t * pixels = m_file.data() + pixelOffset(recordNumber);
+	SpriteGeometry geometry = storedGeometry(recordNumber);
+	// the sprite is drawn at this place of its surface
+	size_t surfaceWidth = width, surfaceHeight = height, left = 0, top = 0;
+	if (drawing.whole) {
+		surfaceWidth = geometry.width;
+		surfaceHeight = geometry.height;
+		left = geometry.xOffset;
+		top = geometry.yOffset;
+		geometry.xOffset = 0;
+		geometry.yOffset = 0;
+	}
+	// true color pixels are stored as they are drawn
+	const size_t storedBytes = storedBytesPerPixel(recordNumber);
+	const ColorTable * colors = nullptr;
+	if (drawing.colorTables) {
+		if (storedBytes == 1)
+			colors = &(*drawing.colorTables)[palette >= 0 ? palette : drawing.selectedPalette];
+		palette = drawing.selectedPalette;
+	}
+	const size_t bytesPerPixel = colors ? 4 : storedBytes;
+	SurfaceTarget surfaceTarget;
+	size_t pitch;
+	uint8_t * rows = (target ? *target : surfaceTarget).pixels(surfaceWidth, surfaceHeight, bytesPerPixel, pitch);
+	if (surfaceWidth != width || surfaceHeight != height) {
+		for (size_t y = 0; y < surfaceHeight; y++)
+			memset(rows + y * pitch, 0, surfaceWidth * bytesPerPixel);
+	}
+	uint8_t * row = rows + top * pitch + left * bytesPerPixel;
+	for (size_t y = 0; y < height; y++, row += pitch, pixels += width * storedBytes) {
+		if (colors)
+			expandIndices(pixels, width, colors->data(), reinterpret_cast<uint32_t *>(row));
+		else
+			memcpy(row, pixels, width * storedBytes);
+	}
+	return new Sprite(Spriteref(key >> 16, key & 0xFFFF), surfaceTarget.release(), palette, geometry);
+}
+
+unordered_map<Spriteref, Sprite> SpriteDiskCache::sprites(const SpriteDrawing & drawing) const
+{
+	vector<Spriteref> refs;
+	if (m_records) {
+		const size_t nSprites = read_uint32(m_file.data() + 16);
+		refs.reserve(nSprites);
+		for (size_t i = 0; i < nSprites; i++) {
+			const uint32_t key = read_uint32(m_records + i * RECORD_SIZE);
+			refs.push_back(Spriteref(key >> 16, key & 0xFFFF));
+		}
+	}
+	return sprites(refs.begin(), refs.end(), drawing);
+}
+
+unordered_map<Spriteref, Sprite> SpriteDiskCache::sprites(vector<Spriteref>::iterator first, vector<Spriteref>::iterator last, const SpriteDrawing & drawing) const
+{
+	unordered_map<Spriteref, Sprite> sprites;
+	// sprites stored with the same pixels, and drawn with the same colors, share their surface
+	map<pair<uint64_t, int>, SpritePixels> drawnPixels;
+	for (auto ref = first; ref != last; ref++) {
+		size_t recordNumber = m_index.find(*ref);
+		if (recordNumber == SpriteIndex::npos || sprites.count(*ref))
+			continue;
+		const uint8_t * record = m_records + recordNumber * RECORD_SIZE;
+		if (!read_uint32(record + 4) || !read_uint32(record + 8)) {
+			// nothing stored: its offset may be that of the next pixels
+			sprites.insert({ *ref, std::move(*unique_ptr<Sprite>(makeSprite(recordNumber, nullptr, drawing))) });
+			continue;
+		}
+		const int palette = storedPalette(recordNumber);
+		SpritePixels & pixels = drawnPixels[{ pixelOffset(recordNumber), drawing.colorTables ? palette : 0 }];
+		if (pixels) {
+			// only the geometry and palette are read, as makeSprite would give them
+			SpriteGeometry geometry = storedGeometry(recordNumber);
+			if (drawing.whole) {
+				geometry.xOffset = 0;
+				geometry.yOffset = 0;
+			}
+			sprites.insert({ *ref, Sprite(*ref, pixels, drawing.colorTables ? static_cast<int>(drawing.selectedPalette) : palette, geometry) });
+			continue;
+		}
+		unique_ptr<Sprite> sprite(makeSprite(recordNumber, nullptr, drawing));
+		pixels = sprite->pixels();
+		sprites.insert({ *ref, std::move(*sprite) });
+	}
+	return sprites;
+}
+
+Sprite * SpriteDiskCache::loadSprite(const Spriteref & ref, const SpriteDrawing & drawing) const
+{
+	size_t recordNumber = m_index.find(ref);
+	if (recordNumber == SpriteIndex::npos)
+		return nullptr;
+	return makeSprite(recordNumber, nullptr, drawing);
+}
+
+Sprite * SpriteDiskCache::drawSprite(const Spriteref & ref, SpriteTarget & target, const SpriteDrawing & drawing) const
+{
+	size_t recordNumber = m_index.find(ref);
+	if (recordNumber == SpriteIndex::npos)
+		return nullptr;
+	return makeSprite(recordNumber, &target, drawing);
+}
+
+}
+}
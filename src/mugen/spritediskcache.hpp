@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPRITEDISKCACHE_HPP
+#define SPRITEDISKCACHE_HPP
+
+#include "sprites.hpp"
+#include "mappedfile.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Nugem {
+namespace Mugen {
+
+// How to draw the sprites of a SpriteDiskCache
+struct SpriteDrawing {
+	// pads the trimmed sprites back to their whole image
+	bool whole = false;
+	// with color tables, the color indices become the colors of the palette a sprite forces, or else of the selected one
+	const std::vector<ColorTable> * colorTables = nullptr;
+	size_t selectedPalette = 0;
+};
+
+/**
+ * File holding the decoded 8-bit sprites of a sprite file, with their index and palettes.
+ * Its true color sprites are kept as their RGBA pixels, as the 8-bit sprite handlers give them.
+ *
+ * The file records the size, modification time and content hash of the files it was made from,
+ * and is only used while they all match. It is read through a MappedFile, so a warm start
+ * copies the color indices of the sprites without decoding anything.
+ *
+ * Made from no source file at all, the same file is a packed sprite file, see SpritePack.
+ */
+class SpriteDiskCache {
+public:
+	// Path of the cache of a sprite file in a cache directory
+	static std::string cachePath(const std::string & directory, const std::string & sffPath);
+	// Writes the cache of the sprites decoded from sources (the sprite file, then its palette files).
+	// The first selectablePalettes palettes are those the sprites can be drawn with in the Rgba32 format.
+	static bool write(const std::string & cachePath, const std::vector<std::string> & sources, const std::unordered_map<Spriteref, Sprite> & sprites, const std::vector<Palette> & palettes, size_t selectablePalettes, bool trimmed);
+	// false if the cache is missing, damaged, older than one of the sources, or trimmed differently
+	bool open(const std::string & cachePath, const std::vector<std::string> & sources, bool trimmed);
+	// false if the file is not a packed sprite file, made from no source
+	bool openPacked(const std::string & path);
+	void close();
+	bool isOpen() const { return m_file; };
+	bool trimmed() const { return m_trimmed; };
+	size_t selectablePalettes() const { return m_selectablePalettes; };
+	std::unordered_map<Spriteref, Sprite> sprites(const SpriteDrawing & drawing = SpriteDrawing()) const;
+	std::unordered_map<Spriteref, Sprite> sprites(std::vector<Spriteref>::iterator first, std::vector<Spriteref>::iterator last, const SpriteDrawing & drawing = SpriteDrawing()) const;
+	const std::vector<Palette> & palettes() const { return m_palettes; };
+	const SpriteIndex & index() const { return m_index; };
+	// nullptr if there is no such sprite
+	Sprite * loadSprite(const Spriteref & ref, const SpriteDrawing & drawing = SpriteDrawing()) const;
+	// Copies the pixels of a sprite into a target: the sprite returned has none of its own
+	Sprite * drawSprite(const Spriteref & ref, SpriteTarget & target, const SpriteDrawing & drawing = SpriteDrawing()) const;
+	static const char MAGIC[8];
+private:
+	struct SourceStamp {
+		uint64_t size;
+		int64_t mtime;
+		uint64_t hash;
+	};
+	// false if the file cannot be read; the hash is only computed when withHash is set
+	static bool stamp(const std::string & path, SourceStamp & sourceStamp, bool withHash);
+	// checks the layout of the file, and reads its index and palettes
+	bool openFile(const std::string & path);
+	// into a new surface without a target
+	Sprite * makeSprite(size_t recordNumber, SpriteTarget * target, const SpriteDrawing & drawing) const;
+	// pixels of a record, shared by the records stored with the same pixels
+	uint64_t pixelOffset(size_t recordNumber) const;
+	// as stored: the place of the pixels within the whole image
+	SpriteGeometry storedGeometry(size_t recordNumber) const;
+	// as stored: -1 for the selected palette
+	int storedPalette(size_t recordNumber) const;
+	// as stored: 1 for color indices, 4 for RGBA pixels
+	size_t storedBytesPerPixel(size_t recordNumber) const;
+	static const uint32_t VERSION = 4;
+	static const uint32_t TRIMMED = 1;
+	static const size_t HEADER_SIZE = 32;
+	static const size_t STAMP_SIZE = 24;
+	static const size_t RECORD_SIZE = 52;
+	// of the pixels of each sprite in the file
+	static const size_t PIXEL_ALIGNMENT = 16;
+	MappedFile m_file;
+	const uint8_t * m_stamps = nullptr;
+	const uint8_t * m_records = nullptr;
+	size_t m_nSources = 0;
+	bool m_trimmed = false;
+	size_t m_selectablePalettes = 0;
+	SpriteIndex m_index;
+	std::vector<Palette> m_palettes;
+};
+
+}
+}
+
+#endif // SPRITEDISKCACHE_HPP
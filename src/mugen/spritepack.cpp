@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "spritepack.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace Nugem {
+namespace Mugen {
+
+SpritePack::SpritePack(const char * filename)
+{
+	if (!m_file.openPacked(filename))
+		throw std::runtime_error(std::string("Not a packed sprite file: ") + filename);
+	for (const Palette & palette: m_file.palettes())
+		m_colorTables.push_back(makeColorTable(palette));
+}
+
+bool SpritePack::isPacked(const uint8_t * header, size_t size)
+{
+	return size >= sizeof(SpriteDiskCache::MAGIC) && !memcmp(header, SpriteDiskCache::MAGIC, sizeof(SpriteDiskCache::MAGIC));
+}
+
+SpriteDrawing SpritePack::drawing(size_t palette) const
+{
+	SpriteDrawing drawing;
+	// the sprites are stored trimmed
+	drawing.whole = !m_trimming;
+	if (m_format == SpriteFormat::Rgba32) {
+		drawing.colorTables = &m_colorTables;
+		drawing.selectedPalette = palette;
+	}
+	return drawing;
+}
+
+std::vector<size_t> SpritePack::loadedPalettes() const
+{
+	// 8-bit sprites do not depend on the palette
+	if (m_format == SpriteFormat::Indexed8)
+		return { 0 };
+	std::vector<size_t> palettes;
+	const size_t nPalettes = m_file.selectablePalettes();
+	for (size_t palette = firstLoadedPalette(nPalettes); palette < lastLoadedPalette(nPalettes); palette++)
+		palettes.push_back(palette);
+	return palettes;
+}
+
+void SpritePack::load()
+{
+	m_sprites.clear();
+	for (size_t palette: loadedPalettes())
+		m_sprites.push_back(m_file.sprites(drawing(palette)));
+}
+
+void SpritePack::load(std::vector<Spriteref>::iterator first, std::vector<Spriteref>::iterator last)
+{
+	m_sprites.clear();
+	for (size_t palette: loadedPalettes())
+		m_sprites.push_back(m_file.sprites(first, last, drawing(palette)));
+}
+
+Sprite * SpritePack::loadSprite(const Spriteref & ref, size_t palette)
+{
+	if (m_format == SpriteFormat::Rgba32 && palette >= m_file.selectablePalettes())
+		return nullptr;
+	return m_file.loadSprite(ref, drawing(palette));
+}
+
+Sprite * SpritePack::drawSprite(const Spriteref & ref, size_t palette, SpriteTarget & target)
+{
+	if (m_format == SpriteFormat::Rgba32 && palette >= m_file.selectablePalettes())
+		return nullptr;
+	return m_file.drawSprite(ref, target, drawing(palette));
+}
+
+}
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPRITEPACK_HPP
+#define SPRITEPACK_HPP
+
+#include "sprites.hpp"
+#include "spritediskcache.hpp"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Nugem {
+namespace Mugen {
+
+/**
+ * Packed sprite file, as written by nugem-pack: the sprites of a sprite file already decoded to trimmed color indices,
+ * with their links resolved and their palettes, in the layout of a SpriteDiskCache.
+ *
+ * The file is mapped, and drawing a sprite only copies or expands its pixels.
+ */
+class SpritePack: public SpriteHandler {
+public:
+	SpritePack(const char * filename);
+	void load();
+	void load(std::vector<Spriteref>::iterator first, std::vector<Spriteref>::iterator last);
+	Sprite * loadSprite(const Spriteref & ref, size_t palette);
+	Sprite * drawSprite(const Spriteref & ref, size_t palette, SpriteTarget & target);
+	std::vector<std::unordered_map<Spriteref, Sprite>> takeSprites() { return std::move(m_sprites); };
+	std::vector<Palette> palettes() { return m_file.palettes(); };
+	size_t selectablePalettes() { return m_file.selectablePalettes(); };
+	const SpriteIndex & index() { return m_file.index(); };
+	// true if the file starts like a packed sprite file
+	static bool isPacked(const uint8_t * header, size_t size);
+private:
+	// how to draw the sprites in the current format, for a selectable palette
+	SpriteDrawing drawing(size_t palette) const;
+	// palettes load() draws the sprites for
+	std::vector<size_t> loadedPalettes() const;
+	SpriteDiskCache m_file;
+	std::vector<ColorTable> m_colorTables;
+	std::vector<std::unordered_map<Spriteref, Sprite>> m_sprites;
+};
+
+}
+}
+
+#endif // SPRITEPACK_HPP
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "spriteregistry.hpp"
+#include "../workerpool.hpp"
+
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+
+namespace Nugem {
+namespace Mugen {
+
+SharedSpriteLoader::SharedSpriteLoader(const std::string & sffPath, const std::vector<std::string> & palettesFiles, SpriteFormat format, bool trimming): m_format(format), m_trimming(trimming), m_diskCacheQueued(false)
+{
+	m_loader.initialize(sffPath, palettesFiles);
+	m_loader.setFormat(format);
+	m_loader.setTrimming(trimming);
+}
+
+std::shared_ptr<const Sprite> SharedSpriteLoader::sprite(const Spriteref & ref, size_t palette) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_loader.sprite(ref, palette);
+}
+
+std::unique_ptr<Sprite> SharedSpriteLoader::draw(const Spriteref & ref, SpriteTarget & target, size_t palette) const
+{
+	std::unique_ptr<Sprite> drawn;
+	bool fillCache = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		drawn = m_loader.draw(ref, target, palette);
+		// what is drawn into targets, such as the atlases of the stage and the menu, is what a warm start reads back
+		if (!m_diskCacheQueued && m_loader.missesDiskCache())
+			m_diskCacheQueued = fillCache = true;
+	}
+	if (fillCache)
+		DiskCacheWriter::instance().add(weak_from_this());
+	return drawn;
+}
+
+bool SharedSpriteLoader::contains(const Spriteref & ref) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_loader.contains(ref);
+}
+
+bool SharedSpriteLoader::usesPaletteFiles() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_loader.usesPaletteFiles();
+}
+
+int SharedSpriteLoader::findPalette(uint16_t group, uint16_t item) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_loader.findPalette(group, item);
+}
+
+std::vector<Palette> SharedSpriteLoader::palettes() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_loader.palettes();
+}
+
+void SharedSpriteLoader::fillDiskCache() const
+{
+	m_loader.fillDiskCache();
+}
+
+DiskCacheWriter & DiskCacheWriter::instance()
+{
+	static DiskCacheWriter writer;
+	return writer;
+}
+
+DiskCacheWriter::DiskCacheWriter(): m_stopping(false)
+{
+	// the writer decodes with the worker pool: the pool is to outlive it
+	WorkerPool::instance();
+	m_thread = std::thread(&DiskCacheWriter::writerLoop, this);
+}
+
+DiskCacheWriter::~DiskCacheWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wakeup.notify_all();
+	m_thread.join();
+}
+
+void DiskCacheWriter::add(const std::weak_ptr<const SharedSpriteLoader> & loader)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending.push_back(loader);
+	}
+	m_wakeup.notify_all();
+}
+
+void DiskCacheWriter::writerLoop()
+{
+	while (true) {
+		std::shared_ptr<const SharedSpriteLoader> loader;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wakeup.wait(lock, [&]() { return m_stopping || !m_pending.empty(); });
+			if (m_stopping)
+				return;
+			loader = m_pending.front().lock();
+			m_pending.pop_front();
+		}
+		if (!loader)
+			continue;
+		try {
+			loader->fillDiskCache();
+		}
+		catch (std::exception & error) {
+			std::cerr << "Could not fill the sprite cache: " << error.what() << std::endl;
+		}
+	}
+}
+
+std::mutex SpriteRegistry::s_mutex;
+std::map<SpriteRegistry::Key, std::weak_ptr<const SharedSpriteLoader>> SpriteRegistry::s_loaders;
+
+std::shared_ptr<const SharedSpriteLoader> SpriteRegistry::loader(const std::string & sffPath, const std::vector<std::string> & palettesFiles, SpriteFormat format, bool trimming)
+{
+	std::vector<std::string> palettes;
+	for (const std::string & palettesFile: palettesFiles)
+		palettes.push_back(canonicalPath(palettesFile));
+	Key key(canonicalPath(sffPath), palettes, format, trimming);
+	std::lock_guard<std::mutex> lock(s_mutex);
+	std::shared_ptr<const SharedSpriteLoader> loader = s_loaders[key].lock();
+	if (loader)
+		return loader;
+	// forget the loaders that were dropped
+	for (auto entry = s_loaders.begin(); entry != s_loaders.end();) {
+		if (entry->second.expired())
+			entry = s_loaders.erase(entry);
+		else
+			entry++;
+	}
+	loader = std::make_shared<const SharedSpriteLoader>(sffPath, palettesFiles, format, trimming);
+	s_loaders[key] = loader;
+	return loader;
+}
+
+size_t SpriteRegistry::size()
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	size_t alive = 0;
+	for (auto & entry : s_loaders) {
+		if (!entry.second.expired())
+			alive++;
+	}
+	return alive;
+}
+
+std::string SpriteRegistry::canonicalPath(const std::string & path)
+{
+#if defined(_WIN32)
+	char resolved[_MAX_PATH];
+	if (_fullpath(resolved, path.c_str(), sizeof(resolved)))
+		return resolved;
+#else
+	char resolved[PATH_MAX];
+	if (realpath(path.c_str(), resolved))
+		return resolved;
+#endif
+	return path;
+}
+
+}
+}
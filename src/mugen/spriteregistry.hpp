@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPRITEREGISTRY_HPP
+#define SPRITEREGISTRY_HPP
+
+#include "sprites.hpp"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace Nugem {
+namespace Mugen {
+
+/**
+ * Sprites of a sprite file, shared between their users through the SpriteRegistry.
+ *
+ * The sprite file, palettes, format and trimming are set once for all, and only reading the sprites is offered.
+ * The decoded sprites and palettes are kept by a SpriteLoader underneath: its calls are serialized, so users on several threads can share it.
+ * The first draw that finds no disk cache has the DiskCacheWriter fill it for the next runs.
+ */
+class SharedSpriteLoader: public std::enable_shared_from_this<SharedSpriteLoader> {
+public:
+	SharedSpriteLoader(const std::string & sffPath, const std::vector<std::string> & palettesFiles, SpriteFormat format, bool trimming);
+	SpriteFormat format() const { return m_format; };
+	bool trimmed() const { return m_trimming; };
+	// See SpriteLoader::sprite, SpriteLoader::draw and SpriteLoader::contains
+	std::shared_ptr<const Sprite> sprite(const Spriteref & ref, size_t palette = 0) const;
+	std::unique_ptr<Sprite> draw(const Spriteref & ref, SpriteTarget & target, size_t palette = 0) const;
+	bool contains(const Spriteref & ref) const;
+	// See SpriteLoader::usesPaletteFiles and SpriteLoader::findPalette
+	bool usesPaletteFiles() const;
+	int findPalette(uint16_t group, uint16_t item) const;
+	// a copy, as drawing sprites can bring in palettes
+	std::vector<Palette> palettes() const;
+	// See SpriteLoader::fillDiskCache: it does not wait for the other calls
+	void fillDiskCache() const;
+private:
+	const SpriteFormat m_format;
+	const bool m_trimming;
+	mutable std::mutex m_mutex;
+	mutable SpriteLoader m_loader;
+	mutable bool m_diskCacheQueued;
+};
+
+/**
+ * Thread filling the disk caches of the shared loaders one after the other, away from the loading of the scenes.
+ *
+ * Only one sprite file is decoded at a time. The loaders dropped before their turn are skipped,
+ * and the caches still waiting when the program ends are left for the next run.
+ */
+class DiskCacheWriter {
+public:
+	static DiskCacheWriter & instance();
+	void add(const std::weak_ptr<const SharedSpriteLoader> & loader);
+	~DiskCacheWriter();
+private:
+	DiskCacheWriter();
+	DiskCacheWriter(const DiskCacheWriter &) = delete;
+	DiskCacheWriter & operator=(const DiskCacheWriter &) = delete;
+	void writerLoop();
+	std::mutex m_mutex;
+	std::condition_variable m_wakeup;
+	std::deque<std::weak_ptr<const SharedSpriteLoader>> m_pending;
+	bool m_stopping;
+	std::thread m_thread;
+};
+
+/**
+ * Process-wide registry of sprite loaders, keyed by the canonical path of the sprite file, its palettes and the settings of the loader.
+ *
+ * Everyone asking for the same sprites gets the same loader, with its index and decoded sprites.
+ * The registry does not keep loaders alive: a loader is dropped as soon as no one holds it anymore.
+ */
+class SpriteRegistry {
+public:
+	static std::shared_ptr<const SharedSpriteLoader> loader(const std::string & sffPath, const std::vector<std::string> & palettesFiles = std::vector<std::string>(), SpriteFormat format = SpriteFormat::Indexed8, bool trimming = false);
+	// loaders still held by someone
+	static size_t size();
+private:
+	typedef std::tuple<std::string, std::vector<std::string>, SpriteFormat, bool> Key;
+	// the path itself if it cannot be resolved
+	static std::string canonicalPath(const std::string & path);
+	static std::mutex s_mutex;
+	static std::map<Key, std::weak_ptr<const SharedSpriteLoader>> s_loaders;
+};
+
+}
+}
+
+#endif // SPRITEREGISTRY_HPP
@@ -23,14 +23,40 @@
 
 #include "sffv2.hpp"
 
+#include "pixelexpand.hpp"
+
+#include "spritecache.hpp"
+
+#include "spritediskcache.hpp"
+
+#include "spritepack.hpp"
+
 #include "../character.hpp"
 
+#include "../workerpool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
 using namespace std;
 
 namespace Nugem {
 
-SurfaceDrawer::SurfaceDrawer(size_t width, size_t height)
+SurfaceTarget::~SurfaceTarget()
 {
+	if (m_surface)
+		SDL_FreeSurface(m_surface);
+}
+
+uint8_t * SurfaceTarget::pixels(size_t width, size_t height, size_t bytesPerPixel, size_t & pitch)
+{
+	if (m_surface)
+		SDL_FreeSurface(m_surface);
+	if (bytesPerPixel == 1) {
+		m_surface = SDL_CreateRGBSurface(0, width, height, 8, 0, 0, 0, 0);
+	}
+	else {
     Uint32 rmask, gmask, bmask, amask;
 #if SDL_BYTEORDER == SDL_BIG_ENDIAN
     rmask = 0xff000000;
@@ -43,148 +69,414 @@ SurfaceDrawer::SurfaceDrawer(size_t width, size_t height)
     bmask = 0x00ff0000;
     amask = 0xff000000;
 #endif
-	m_surface = SDL_CreateRGBSurface(0, width, height, 32, rmask, gmask, bmask, amask);
+		m_surface = SDL_CreateRGBSurface(0, width, height, 32, rmask, gmask, bmask, amask);
+	}
 	SDL_LockSurface(m_surface);
+	pitch = m_surface->pitch;
+	return static_cast<uint8_t *>(m_surface->pixels);
+}
+
+SDL_Surface * SurfaceTarget::release()
+{
+	SDL_Surface * surface = m_surface;
+	if (surface)
+		SDL_UnlockSurface(surface);
+	m_surface = nullptr;
+	return surface;
+}
+
+SurfaceDrawer::SurfaceDrawer(size_t width, size_t height, const Mugen::ColorTable * colors): m_width(width), m_height(height), m_colors(colors)
+{
 }
 
 SurfaceDrawer::~SurfaceDrawer()
 {
-	SDL_UnlockSurface(m_surface);
 }
 
-uint32_t SurfaceDrawer::rgba(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha) const
+SDL_Surface * SurfaceDrawer::operator()(bool trim)
 {
-	return SDL_MapRGBA(m_surface->format, red, green, blue, alpha);
+	SurfaceTarget target;
+	drawTo(target, trim);
+	return target.release();
+}
+
+// Bounding box of the non-zero pixels, empty for a fully transparent sprite
+template <typename Pixel>
+static void findBounds(const Pixel * pixels, size_t width, size_t height, size_t & left, size_t & top, size_t & right, size_t & bottom)
+{
+	left = width;
+	right = 0;
+	bottom = 0;
+	top = height;
+	const Pixel * row = pixels;
+	for (size_t y = 0; y < height; y++, row += width) {
+		size_t first = 0;
+		while (first < width && !row[first])
+			first++;
+		if (first == width)
+			continue;
+		size_t last = width;
+		while (!row[last - 1])
+			last--;
+		left = min(left, first);
+		right = max(right, last);
+		top = min(top, y);
+		bottom = y + 1;
+	}
+	// nothing left of a fully transparent sprite
+	if (top >= bottom)
+		left = right = top = bottom = 0;
 }
 
-SDL_Surface * SurfaceDrawer::operator()()
+void SurfaceDrawer::drawTo(SpriteTarget & target, bool trim)
 {
-	draw(static_cast<uint32_t *>(m_surface->pixels), m_surface->w, m_surface->h);
-	return m_surface;
+	m_geometry = Mugen::SpriteGeometry();
+	m_geometry.width = m_width;
+	m_geometry.height = m_height;
+	const bool colored = trueColor();
+	const size_t bytesPerPixel = m_colors || colored ? 4 : 1;
+	size_t pitch = 0;
+	if (m_width * m_height == 0) {
+		target.pixels(m_width, m_height, bytesPerPixel, pitch);
+		return;
+	}
+	uint8_t * destination = nullptr;
+	if (!trim && (!m_colors || colored)) {
+		// untrimmed pixels go straight to the target, unless its rows are padded
+		destination = target.pixels(m_width, m_height, bytesPerPixel, pitch);
+		if (pitch == m_width * bytesPerPixel) {
+			memset(destination, 0, m_width * m_height * bytesPerPixel);
+			if (colored)
+				drawColors(destination, m_width, m_height);
+			else
+				draw(destination, m_width, m_height);
+			return;
+		}
+	}
+	// The decoders produce color indices, or RGBA pixels for true color: the palette is applied afterwards, if there is one.
+	// The buffer stays with the drawing thread, so decoding the next sprite does not allocate again.
+	static thread_local vector<uint8_t> pixelData;
+	const size_t drawnBytes = colored ? 4 : 1;
+	pixelData.assign(m_width * m_height * drawnBytes, 0);
+	if (colored)
+		drawColors(pixelData.data(), m_width, m_height);
+	else
+		draw(pixelData.data(), m_width, m_height);
+	// transparent pixels are zero in both cases
+	size_t left = 0, top = 0, right = m_width, bottom = m_height;
+	if (trim) {
+		if (colored)
+			findBounds(reinterpret_cast<const uint32_t *>(pixelData.data()), m_width, m_height, left, top, right, bottom);
+		else
+			findBounds(pixelData.data(), m_width, m_height, left, top, right, bottom);
+		m_geometry.xOffset = left;
+		m_geometry.yOffset = top;
+	}
+	const size_t width = right - left;
+	const size_t height = bottom - top;
+	if (!destination)
+		destination = target.pixels(width, height, bytesPerPixel, pitch);
+	const uint8_t * pixelRow = pixelData.data() + (top * m_width + left) * drawnBytes;
+	for (size_t y = 0; y < height; y++, destination += pitch, pixelRow += m_width * drawnBytes) {
+		if (colored || !m_colors) {
+			memcpy(destination, pixelRow, width * drawnBytes);
+			continue;
+		}
+		Mugen::expandIndices(pixelRow, width, m_colors->data(), reinterpret_cast<uint32_t *>(destination));
+	}
 }
 
 namespace Mugen {
 
-array<uint8_t, 4> extract_version(ifstream & fileobj)
+array<uint8_t, 4> extract_version(const uint8_t * data)
 {
 	array<uint8_t, 4> version;
 	for (int i = 0; i < 4; i++)
-		fileobj >> version[3 - i];
+		version[3 - i] = data[i];
 	return version;
 }
 
-uint32_t read_uint32(ifstream & fileobj)
+ColorTable makeColorTable(const Palette & palette)
 {
-	uint32_t e = 0;
-	// Little endian reading
- 	for (int i = 0; i < 8 * 4; i += 8)
- 		e |= fileobj.get() << i;
-	return e;
+	// the byte order of the RGBA sprite surfaces
+	static SDL_PixelFormat * format = SDL_AllocFormat(SDL_PIXELFORMAT_RGBA32);
+	ColorTable colors;
+	colors[0] = 0;
+	for (size_t i = 1; i < PALETTE_NCOLORS; i++)
+		colors[i] = SDL_MapRGBA(format, palette[i].r, palette[i].g, palette[i].b, palette[i].a);
+	return colors;
 }
 
-uint16_t read_uint16(ifstream & fileobj)
+uint64_t hashBytes(const uint8_t * data, size_t size)
 {
-	return fileobj.get() | (fileobj.get() << 8);
+	uint64_t hash = 14695981039346656037ull;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	return hash;
 }
 
-Sprite::Sprite(Spriteref reference, SDL_Surface * surface, int palette): m_ref(reference), m_npalette(palette), m_surface(surface)
+vector<size_t> findIdenticalPayloads(const vector<SpritePayload> & payloads)
 {
+	vector<uint64_t> hashes(payloads.size());
+	WorkerPool::instance().parallelFor(payloads.size(), [&](size_t i) {
+		hashes[i] = hashBytes(payloads[i].data, payloads[i].size) ^ (payloads[i].layout * 0x9E3779B97F4A7C15ull);
+	});
+	// the hashes only find the candidates, the payloads are then compared
+	auto identical = [](const SpritePayload & a, const SpritePayload & b) {
+		return a.layout == b.layout && a.size == b.size && (a.data == b.data || a.size == 0 || !memcmp(a.data, b.data, a.size));
+	};
+	vector<size_t> firsts(payloads.size());
+	unordered_map<uint64_t, vector<size_t>> distinctPayloads;
+	for (size_t i = 0; i < payloads.size(); i++) {
+		firsts[i] = i;
+		vector<size_t> & candidates = distinctPayloads[hashes[i]];
+		for (size_t candidate: candidates) {
+			if (identical(payloads[candidate], payloads[i])) {
+				firsts[i] = candidate;
+				break;
+			}
+		}
+		if (firsts[i] == i)
+			candidates.push_back(i);
+	}
+	return firsts;
 }
 
-Sprite::~Sprite()
+Sprite::Sprite(Spriteref reference, SDL_Surface * surface, int palette, const SpriteGeometry & geometry): Sprite(reference, SpritePixels(surface, SDL_FreeSurface), palette, geometry)
 {
-	if (m_surface != nullptr) {
-		SDL_FreeSurface(m_surface);
-		m_surface = nullptr;
+}
+
+Sprite::Sprite(Spriteref reference, SpritePixels pixels, int palette, const SpriteGeometry & geometry): m_ref(reference), m_npalette(palette), m_pixels(std::move(pixels)), m_geometry(geometry)
+{
+	// untrimmed surface
+	if (m_pixels && !m_geometry.width && !m_geometry.height) {
+		m_geometry.width = m_pixels->w;
+		m_geometry.height = m_pixels->h;
 	}
 }
 
-Sprite::Sprite(const Sprite & originalSprite): m_surface(nullptr)
+Sprite::~Sprite()
+{
+}
+
+void SpriteIndex::add(const Spriteref & ref, size_t spriteNumber)
+{
+	m_entries.push_back({ ref.packed(), static_cast<uint32_t>(spriteNumber) });
+}
+
+void SpriteIndex::build(bool keepFirst)
 {
-	m_ref = originalSprite.ref();
-	m_surface = copySurface(originalSprite.m_surface);
+	stable_sort(m_entries.begin(), m_entries.end(), [](const Entry & a, const Entry & b) { return a.key < b.key; });
+	size_t nUnique = 0;
+	for (size_t i = 0; i < m_entries.size(); i++) {
+		if (nUnique > 0 && m_entries[nUnique - 1].key == m_entries[i].key) {
+			if (!keepFirst)
+				m_entries[nUnique - 1] = m_entries[i];
+		} else {
+			m_entries[nUnique++] = m_entries[i];
+		}
+	}
+	m_entries.resize(nUnique);
 }
 
-Sprite::Sprite(Sprite && originalSprite): m_surface(nullptr)
+size_t SpriteHandler::firstLoadedPalette(size_t nPalettes) const
 {
-	swap(m_ref, originalSprite.m_ref);
-	swap(m_surface, originalSprite.m_surface);
+	if (m_selectedPalette < 0)
+		return 0;
+	return min(static_cast<size_t>(m_selectedPalette), nPalettes);
 }
 
-Sprite & Sprite::operator=(const Sprite & originalSprite)
+size_t SpriteHandler::lastLoadedPalette(size_t nPalettes) const
 {
-	m_ref = originalSprite.ref();
-	m_surface = copySurface(originalSprite.m_surface);
-	return *this;
+	if (m_selectedPalette < 0)
+		return nPalettes;
+	return min(static_cast<size_t>(m_selectedPalette) + 1, nPalettes);
 }
 
-Sprite & Sprite::operator=(Sprite && originalSprite)
+size_t SpriteIndex::find(const Spriteref & ref) const
 {
-	swap(m_ref, originalSprite.m_ref);
-	swap(m_surface, originalSprite.m_surface);
-	return *this;
+	const uint32_t key = ref.packed();
+	auto found = lower_bound(m_entries.begin(), m_entries.end(), key, [](const Entry & entry, uint32_t key) { return entry.key < key; });
+	if (found == m_entries.end() || found->key != key)
+		return npos;
+	return found->spriteNumber;
 }
 
-SDL_Surface * Sprite::copySurface(SDL_Surface * surface)
+string SpriteLoader::s_diskCacheDirectory;
+
+SpriteLoader::SpriteLoader(): m_packed(false), m_format(SpriteFormat::Rgba32), m_trimming(false), m_cache(new SpriteCache()), m_diskCacheChecked(false)
 {
-	return SDL_ConvertSurface(surface, surface->format, 0);
 }
 
-SpriteLoader::SpriteLoader()
+SpriteLoader::SpriteLoader(SpriteLoader && spriteLoader) = default;
+
+SpriteLoader::~SpriteLoader()
 {
 }
 
-void SpriteLoader::initialize(const std::string & sffpath, const std::string & palettesFile)
+SpriteLoader & SpriteLoader::operator=(SpriteLoader && spriteLoader) = default;
+
+void SpriteLoader::initialize(const std::string & sffpath, const std::vector<std::string> & palettesFiles)
 {
 	m_sffFile = sffpath;
-	m_palettesFile = palettesFile;
+	m_palettesFiles = palettesFiles;
+	m_handler.reset();
+	m_cache->clear();
+	m_diskCache.reset();
+	m_diskCacheChecked = false;
+	m_packed = false;
 	
 	// Determining sprite version
 	{
-		char readbuf[12];
-		ifstream spritefile(sffpath);
-		spritefile.read(readbuf, 12);
-		if (strcmp(readbuf, "ElecbyteSpr")) {
+		uint8_t header[16];
+		ifstream spritefile(sffpath, ios::binary);
+		if (!spritefile.read(reinterpret_cast<char *>(header), sizeof(header)))
+			return;
+		// packed sprite files come with their palettes
+		if (SpritePack::isPacked(header, sizeof(header))) {
+			m_packed = true;
 			return;
 		}
-		m_sffVersion = extract_version(spritefile);
-		spritefile.close();
+		if (memcmp(header, "ElecbyteSpr", 12))
+			return;
+		m_sffVersion = extract_version(header + 12);
 	}
 }
 
 vector< unordered_map< Spriteref, Sprite > > SpriteLoader::load()
 {
+	if (SpriteDiskCache * cached = diskCache()) {
+		m_palettes = cached->palettes();
+		return { cached->sprites() };
+	}
 	SpriteHandler * handler = createHandler();
 	handler->load();
-	vector< unordered_map< Spriteref, Sprite > > s = handler->sprites();
+	vector< unordered_map< Spriteref, Sprite > > s = handler->takeSprites();
+	m_palettes = handler->palettes();
+	const size_t selectablePalettes = handler->selectablePalettes();
 	delete handler;
+	if (usesDiskCache() && !s.empty())
+		writeDiskCache(s[0], m_palettes, selectablePalettes);
 	return s;
 }
 
 vector< unordered_map< Spriteref, Sprite > > SpriteLoader::load(vector< Spriteref >::iterator first, vector< Spriteref >::iterator last)
 {
+	if (SpriteDiskCache * cached = diskCache()) {
+		m_palettes = cached->palettes();
+		return { cached->sprites(first, last) };
+	}
 	SpriteHandler * handler = createHandler();
 	handler->load(first, last);
-	vector< unordered_map< Spriteref, Sprite > > s = handler->sprites();
+	vector< unordered_map< Spriteref, Sprite > > s = handler->takeSprites();
+	m_palettes = handler->palettes();
 	delete handler;
 	return s;
 }
 
 unordered_map< Spriteref, Sprite > SpriteLoader::loadForPalette(int palette)
 {
+	// 8-bit sprites do not depend on the palette
+	if (m_format == SpriteFormat::Indexed8)
+		return std::move(load()[0]);
 	SpriteHandler * handler = createHandler();
+	handler->selectPalette(palette);
 	handler->load();
-	vector< unordered_map< Spriteref, Sprite > > s = handler->sprites();
+	vector< unordered_map< Spriteref, Sprite > > s = handler->takeSprites();
+	m_palettes = handler->palettes();
 	delete handler;
-	return s[palette];
+	if (s.empty())
+		return unordered_map< Spriteref, Sprite >();
+	return std::move(s[0]);
 }
 
-SpriteHandler * SpriteLoader::createHandler()
+SpriteHandler * SpriteLoader::createHandler() const
 {
-	if (m_sffVersion[0] >= 2)
-		return new Sffv2(m_sffFile.c_str());
+	SpriteHandler * handler;
+	if (m_packed)
+		handler = new SpritePack(m_sffFile.c_str());
+	else if (m_sffVersion[0] >= 2)
+		handler = new Sffv2(m_sffFile.c_str());
 	else
-		return new Sffv1(m_sffFile.c_str(), m_palettesFile.c_str());
+		handler = new Sffv1(m_sffFile.c_str(), m_palettesFiles);
+	handler->setFormat(m_format);
+	handler->setTrimming(m_trimming);
+	return handler;
+}
+
+SpriteHandler & SpriteLoader::lazyHandler()
+{
+	if (!m_handler) {
+		m_handler.reset(createHandler());
+		m_palettes = m_handler->palettes();
+	}
+	return *m_handler;
+}
+
+bool SpriteLoader::usesDiskCache() const
+{
+	// a packed sprite file is mapped already
+	return m_format == SpriteFormat::Indexed8 && !s_diskCacheDirectory.empty() && !m_packed;
+}
+
+SpriteDiskCache * SpriteLoader::diskCache()
+{
+	if (!usesDiskCache())
+		return nullptr;
+	if (!m_diskCacheChecked) {
+		m_diskCacheChecked = true;
+		m_diskCache.reset(new SpriteDiskCache());
+		if (m_diskCache->open(SpriteDiskCache::cachePath(s_diskCacheDirectory, m_sffFile), sourceFiles(), m_trimming))
+			m_palettes = m_diskCache->palettes();
+		else
+			m_diskCache.reset();
+	}
+	return m_diskCache.get();
+}
+
+void SpriteLoader::writeDiskCache(const unordered_map<Spriteref, Sprite> & sprites, const vector<Palette> & palettes, size_t selectablePalettes)
+{
+	string cachePath = SpriteDiskCache::cachePath(s_diskCacheDirectory, m_sffFile);
+	if (!SpriteDiskCache::write(cachePath, sourceFiles(), sprites, palettes, selectablePalettes, m_trimming)) {
+		cerr << "Could not write the sprite cache " << cachePath << endl;
+		return;
+	}
+	// the sprites asked for next come from the new cache, with its palette numbers
+	m_cache->clear();
+	m_diskCache.reset();
+	m_diskCacheChecked = false;
+}
+
+bool SpriteLoader::missesDiskCache()
+{
+	return usesDiskCache() && !diskCache();
+}
+
+void SpriteLoader::fillDiskCache() const
+{
+	// only the settings of the loader are read: its sprites, palettes and caches are left to the other calls
+	unique_ptr<SpriteHandler> handler(createHandler());
+	handler->load();
+	vector< unordered_map< Spriteref, Sprite > > s = handler->takeSprites();
+	if (s.empty())
+		return;
+	string cachePath = SpriteDiskCache::cachePath(s_diskCacheDirectory, m_sffFile);
+	if (!SpriteDiskCache::write(cachePath, sourceFiles(), s[0], handler->palettes(), handler->selectablePalettes(), m_trimming))
+		cerr << "Could not write the sprite cache " << cachePath << endl;
+}
+
+vector<string> SpriteLoader::sourceFiles() const
+{
+	vector<string> files { m_sffFile };
+	if (m_sffVersion[0] < 2)
+		files.insert(files.end(), m_palettesFiles.begin(), m_palettesFiles.end());
+	return files;
 }
 
 bool SpriteLoader::isInitialized() const
@@ -192,6 +484,107 @@ bool SpriteLoader::isInitialized() const
 	return (m_sffFile.length() > 0);
 }
 
+void SpriteLoader::setFormat(SpriteFormat format)
+{
+	if (format != m_format) {
+		m_cache->clear();
+		if (m_handler)
+			m_handler->setFormat(format);
+	}
+	m_format = format;
+}
+
+SpriteFormat SpriteLoader::format() const
+{
+	return m_format;
+}
+
+void SpriteLoader::setTrimming(bool trimming)
+{
+	if (trimming != m_trimming) {
+		m_cache->clear();
+		if (m_handler)
+			m_handler->setTrimming(trimming);
+		// the sprites kept on disk were trimmed or not
+		m_diskCache.reset();
+		m_diskCacheChecked = false;
+	}
+	m_trimming = trimming;
+}
+
+const vector<Palette> & SpriteLoader::palettes() const
+{
+	return m_palettes;
+}
+
+shared_ptr<const Sprite> SpriteLoader::sprite(const Spriteref & ref, size_t palette)
+{
+	// 8-bit sprites are the same whatever the palette
+	if (m_format == SpriteFormat::Indexed8)
+		palette = 0;
+	shared_ptr<const Sprite> cached = m_cache->get(ref, palette);
+	if (cached)
+		return cached;
+	shared_ptr<const Sprite> decoded;
+	if (SpriteDiskCache * cached = diskCache()) {
+		decoded.reset(cached->loadSprite(ref));
+	} else {
+		decoded.reset(lazyHandler().loadSprite(ref, palette));
+		// decoding an indexed sprite can bring in a palette of its own
+		if (decoded && decoded->palette() >= static_cast<int>(m_palettes.size()))
+			m_palettes = m_handler->palettes();
+	}
+	if (!decoded)
+		return nullptr;
+	m_cache->insert(ref, palette, decoded);
+	return decoded;
+}
+
+unique_ptr<Sprite> SpriteLoader::draw(const Spriteref & ref, SpriteTarget & target, size_t palette)
+{
+	if (m_format == SpriteFormat::Indexed8)
+		palette = 0;
+	if (SpriteDiskCache * cached = diskCache())
+		return unique_ptr<Sprite>(cached->drawSprite(ref, target));
+	unique_ptr<Sprite> drawn(lazyHandler().drawSprite(ref, palette, target));
+	if (drawn && drawn->palette() >= static_cast<int>(m_palettes.size()))
+		m_palettes = m_handler->palettes();
+	return drawn;
+}
+
+bool SpriteLoader::contains(const Spriteref & ref)
+{
+	if (SpriteDiskCache * cached = diskCache())
+		return cached->index().contains(ref);
+	return lazyHandler().index().contains(ref);
+}
+
+bool SpriteLoader::usesPaletteFiles() const
+{
+	return !m_packed && m_sffVersion[0] < 2;
+}
+
+int SpriteLoader::findPalette(uint16_t group, uint16_t item)
+{
+	// the palettes of a disk cache are in the order of the sprite file, as those of the handler
+	return lazyHandler().findPalette(group, item);
+}
+
+void SpriteLoader::setCacheBudget(size_t bytes)
+{
+	m_cache->setBudget(bytes);
+}
+
+const SpriteCache & SpriteLoader::cache() const
+{
+	return *m_cache;
+}
+
+void SpriteLoader::setDiskCacheDirectory(const string & directory)
+{
+	s_diskCacheDirectory = directory;
+}
+
 }
 }
 
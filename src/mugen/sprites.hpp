@@ -26,6 +26,9 @@
 #include <vector>
 #include <fstream>
 #include <functional>
+#include <memory>
+
+#define PALETTE_NCOLORS 256
 
 namespace Nugem {
 namespace Mugen {
@@ -36,6 +39,32 @@ struct Spriteref {
 	Spriteref(): group(0), image(0) {}
 	Spriteref(int g, int i): group(g), image(i) {}
 	bool operator==(const Spriteref & ref) const { return group == ref.group && image == ref.image; }
+	// group in the high 16 bits, image in the low 16 bits, as stored in the sprite files
+	uint32_t packed() const { return (static_cast<uint32_t>(group & 0xFFFF) << 16) | static_cast<uint32_t>(image & 0xFFFF); }
+};
+
+// Colors of a sprite palette, ready to be uploaded as RGBA. Index 0 is the transparent color.
+typedef std::array<SDL_Color, PALETTE_NCOLORS> Palette;
+
+// A palette converted to the 32-bit pixels of the RGBA sprite surfaces, with index 0 fully transparent
+typedef std::array<uint32_t, PALETTE_NCOLORS> ColorTable;
+
+// Where the surface of a sprite lies, in the image of the sprite as stored in its file
+struct SpriteGeometry {
+	// axis, from the top-left corner of the image
+	int axisX = 0;
+	int axisY = 0;
+	// top-left corner of the surface, once the transparent borders of the image are trimmed
+	int xOffset = 0;
+	int yOffset = 0;
+	// size of the image
+	int width = 0;
+	int height = 0;
+};
+
+enum class SpriteFormat {
+	Rgba32, // one 32-bit surface per sprite and per palette
+	Indexed8 // one 8-bit surface of color indices per sprite, the palettes are applied when rendering
 };
 
 }
@@ -48,11 +77,9 @@ namespace std {
   {
     std::size_t operator()(const Nugem::Mugen::Spriteref & k) const
     {
-      using std::size_t;
-      using std::hash;
-      using std::string;
-
-      return (hash<int>()(k.group)) ^ (hash<int>()(k.image) << 1);
+      // Fibonacci hashing of the packed reference, folded to spread the group bits over the low bits too
+      uint64_t h = k.packed() * 0x9E3779B97F4A7C15ull;
+      return static_cast<std::size_t>(h ^ (h >> 32));
     }
   };
 
@@ -62,36 +89,101 @@ namespace Nugem {
 
 class Character;
 
+// Memory a drawer writes the pixels of a sprite to, such as a new surface or a slice of an atlas
+class SpriteTarget {
+public:
+	virtual ~SpriteTarget() {};
+	// Called once per sprite drawn: room for height rows of width pixels, whose first bytes are pitch bytes apart
+	virtual uint8_t * pixels(size_t width, size_t height, size_t bytesPerPixel, size_t & pitch) = 0;
+};
+
+// Draws into a new surface: 8-bit for color indices, RGBA32 otherwise
+class SurfaceTarget: public SpriteTarget {
+public:
+	SurfaceTarget(): m_surface(nullptr) {};
+	~SurfaceTarget();
+	uint8_t * pixels(size_t width, size_t height, size_t bytesPerPixel, size_t & pitch);
+	// The surface drawn, now owned by the caller
+	SDL_Surface * release();
+private:
+	SDL_Surface * m_surface;
+};
+
 class SurfaceDrawer {
 public:
-	SurfaceDrawer(size_t width, size_t height);
+	// Without colors, the surface is an 8-bit surface holding the color indices, unless the sprite is true color
+	SurfaceDrawer(size_t width, size_t height, const Mugen::ColorTable * colors);
 	virtual ~SurfaceDrawer();
-	uint32_t rgba(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha) const;
-	SDL_Surface * operator()();
+	// With trim, the surface only keeps the smallest rectangle holding all the non-transparent pixels
+	SDL_Surface * operator()(bool trim = false);
+	// Same, drawing into the memory of a target instead of a new surface
+	void drawTo(SpriteTarget & target, bool trim = false);
+	// Where the last surface drawn lies in the image, without any axis
+	const Mugen::SpriteGeometry & geometry() const { return m_geometry; };
 protected:
-	virtual void draw(uint32_t * pixelData, size_t width, size_t height) = 0;
+	// Writes the color indices of the width * height pixels of the sprite, into zeroed memory
+	virtual void draw(uint8_t * indexData, size_t width, size_t height) = 0;
+	// True color sprites are drawn by drawColors instead, into RGBA surfaces whatever the colors
+	virtual bool trueColor() const { return false; }
+	// Writes the RGBA pixels of the sprite, 4 bytes each in R, G, B, A order, into zeroed memory: the fully transparent pixels stay zero
+	virtual void drawColors(uint8_t *, size_t, size_t) {}
 private:
-	SDL_Surface * m_surface;
+	size_t m_width;
+	size_t m_height;
+	const Mugen::ColorTable * m_colors;
+	Mugen::SpriteGeometry m_geometry;
 };
 
 namespace Mugen {
 	
+// Pixels of a decoded sprite, never modified once drawn
+typedef std::shared_ptr<const SDL_Surface> SpritePixels;
+
+// A view on shared pixels: copying a sprite does not copy its surface
 class Sprite {
 public:
-	Sprite(Spriteref reference, SDL_Surface * surface, int palette = -1);
+	// The sprite takes ownership of the surface.
+	// palette: the palette the surface was drawn with, or for an 8-bit surface, the palette it must be drawn with (-1: the selected one)
+	// Without a geometry, the surface is the whole image and the axis is its top-left corner.
+	Sprite(Spriteref reference, SDL_Surface * surface, int palette = -1, const SpriteGeometry & geometry = SpriteGeometry());
+	Sprite(Spriteref reference, SpritePixels pixels, int palette = -1, const SpriteGeometry & geometry = SpriteGeometry());
 	virtual ~Sprite();
-	Sprite(const Sprite & originalSprite);
-	Sprite(Sprite && originalSprite);
-	Sprite & operator=(const Sprite & originalSprite);
-	Sprite & operator=(Sprite && originalSprite);
+	Sprite(const Sprite & originalSprite) = default;
+	Sprite(Sprite && originalSprite) = default;
+	Sprite & operator=(const Sprite & originalSprite) = default;
+	Sprite & operator=(Sprite && originalSprite) = default;
 	const Spriteref ref() const { return m_ref; };
-	const SDL_Surface * surface() const { return m_surface; };
+	const SDL_Surface * surface() const { return m_pixels.get(); };
+	const SpritePixels & pixels() const { return m_pixels; };
 	const int palette() const { return m_npalette; };
+	const SpriteGeometry & geometry() const { return m_geometry; };
 protected:
 	Spriteref m_ref;
 	int m_npalette;
-	SDL_Surface * m_surface;
-	static SDL_Surface * copySurface(SDL_Surface * surface);
+	SpritePixels m_pixels;
+	SpriteGeometry m_geometry;
+};
+
+// Sprite numbers of a sprite file, in a flat array sorted by packed reference
+class SpriteIndex {
+public:
+	static const size_t npos = static_cast<size_t>(-1);
+	void clear() { m_entries.clear(); };
+	void reserve(size_t nSprites) { m_entries.reserve(nSprites); };
+	void add(const Spriteref & ref, size_t spriteNumber);
+	// Sorts the references, once they are all added.
+	// When a reference is added twice, the last sprite wins, or the first one with keepFirst.
+	void build(bool keepFirst = false);
+	// npos if there is no such sprite
+	size_t find(const Spriteref & ref) const;
+	bool contains(const Spriteref & ref) const { return find(ref) != npos; };
+	size_t size() const { return m_entries.size(); };
+private:
+	struct Entry {
+		uint32_t key;
+		uint32_t spriteNumber;
+	};
+	std::vector<Entry> m_entries;
 };
 
 class SpriteHandler {
@@ -99,30 +191,131 @@ public:
 	virtual ~SpriteHandler() {};
 	virtual void load() = 0;
 	virtual void load(std::vector<Spriteref>::iterator first, std::vector<Spriteref>::iterator last) = 0;
-	virtual std::vector<std::unordered_map<Spriteref, Sprite>> sprites() = 0;
+	// Moves the loaded sprites out of the handler: one map per palette, or a single one in the Indexed8 format
+	virtual std::vector<std::unordered_map<Spriteref, Sprite>> takeSprites() = 0;
+	// Palettes the 8-bit sprites refer to, once loaded: the selectable palettes come first
+	virtual std::vector<Palette> palettes() = 0;
+	// How many of these palettes the sprites can be drawn with in the Rgba32 format
+	virtual size_t selectablePalettes() = 0;
+	// Decodes a single sprite, nullptr if the file has no such sprite or palette
+	virtual Sprite * loadSprite(const Spriteref & ref, size_t palette) = 0;
+	// Decodes a single sprite into a target: the sprite returned has no pixels of its own
+	virtual Sprite * drawSprite(const Spriteref & ref, size_t palette, SpriteTarget & target) = 0;
+	void setFormat(SpriteFormat format) { m_format = format; };
+	// In the Rgba32 format, load() only draws the sprites for this palette (-1: all of them, the default)
+	void selectPalette(int palette) { m_selectedPalette = palette; };
+	// Trims the transparent borders of the sprites, see SpriteGeometry
+	void setTrimming(bool trimming) { m_trimming = trimming; };
+	// Every sprite of the file
+	virtual const SpriteIndex & index() { return m_index; };
+	// Index in palettes() of the palette numbered group, item in the file, -1 if there is none or the palettes have no number
+	virtual int findPalette(uint16_t, uint16_t) { return -1; }
+protected:
+	// range of the palettes load() draws the sprites for, out of nPalettes
+	size_t firstLoadedPalette(size_t nPalettes) const;
+	size_t lastLoadedPalette(size_t nPalettes) const;
+	SpriteFormat m_format = SpriteFormat::Rgba32;
+	int m_selectedPalette = -1;
+	bool m_trimming = false;
+	SpriteIndex m_index;
 };
 
 // Function for both SFFv1 and SFFv2 sprites
-std::array<uint8_t, 4> extract_version(std::ifstream & fileobj);
+std::array<uint8_t, 4> extract_version(const uint8_t * data);
 
-// Little endian to big endian
-uint32_t read_uint32(std::ifstream & fileobj);
+ColorTable makeColorTable(const Palette & palette);
+
+// FNV-1a hash of a block of bytes, folding 8 bytes at a time
+uint64_t hashBytes(const uint8_t * data, size_t size);
+
+// Payload of a sprite, as it is stored in its file
+struct SpritePayload {
+	const uint8_t * data;
+	size_t size;
+	// what else the decoded pixels depend on, such as the dimensions or the compression
+	uint64_t layout;
+};
+
+// Position of the first payload identical to each payload: identical payloads decode to the same pixels
+std::vector<size_t> findIdenticalPayloads(const std::vector<SpritePayload> & payloads);
+
+// Little endian loads from an in-memory buffer
+inline uint32_t read_uint32(const uint8_t * data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+inline uint16_t read_uint16(const uint8_t * data)
+{
+	return data[0] | (data[1] << 8);
+}
 
-uint16_t read_uint16(std::ifstream & fileobj);
+class SpriteCache;
+class SpriteDiskCache;
 
 class SpriteLoader {
 public:
 	SpriteLoader();
-	void initialize(const std::string & sffpath, const std::string & palettesFile = "");
+	SpriteLoader(SpriteLoader && spriteLoader);
+	~SpriteLoader();
+	SpriteLoader & operator=(SpriteLoader && spriteLoader);
+	// The palette files give the selectable palettes of a SFFv1, one per file
+	void initialize(const std::string & sffpath, const std::vector<std::string> & palettesFiles = std::vector<std::string>());
 	std::vector<std::unordered_map<Spriteref, Sprite>> load();
 	std::vector<std::unordered_map<Spriteref, Sprite>> load(std::vector<Spriteref>::iterator first, std::vector<Spriteref>::iterator last);
 	std::unordered_map<Spriteref, Sprite> loadForPalette(int palette);
 	bool isInitialized() const;
+	// In the Indexed8 format, load() gives a single set of 8-bit sprites, drawn with palettes()
+	void setFormat(SpriteFormat format);
+	SpriteFormat format() const;
+	// Trimmed sprites only keep their non-transparent pixels: their geometry tells where to draw them
+	void setTrimming(bool trimming);
+	const std::vector<Palette> & palettes() const;
+	// Lazy loading: the sprite file is only indexed once, and each sprite is decoded the first time it is requested.
+	// Decoded sprites are kept in a cache of limited size, nullptr if there is no such sprite.
+	std::shared_ptr<const Sprite> sprite(const Spriteref & ref, size_t palette = 0);
+	// Decodes a sprite straight into a target, without going through the cache.
+	// The sprite returned has no pixels, only its palette and geometry; nullptr if there is no such sprite.
+	std::unique_ptr<Sprite> draw(const Spriteref & ref, SpriteTarget & target, size_t palette = 0);
+	// true if the sprite file has this sprite, from the index of the lazy loading
+	bool contains(const Spriteref & ref);
+	// The selectable palettes come from the palette files (SFFv1), or else from the sprite file, where they are numbered
+	bool usesPaletteFiles() const;
+	// Index in palettes() of the palette numbered group, item in the sprite file (SFFv2), -1 if there is none
+	int findPalette(uint16_t group, uint16_t item);
+	void setCacheBudget(size_t bytes);
+	const SpriteCache & cache() const;
+	// Directory where the 8-bit sprites are kept decoded between runs, empty to disable it (the default)
+	static void setDiskCacheDirectory(const std::string & directory);
+	// true if the sprites are to be kept on disk, and there is no up to date cache of them yet
+	bool missesDiskCache();
+	// Decodes the whole sprite file into a disk cache, for the next runs: the loader keeps drawing its sprites as before.
+	// It only reads the settings of the loader, so it can run on another thread while the loader is used.
+	void fillDiskCache() const;
 protected:
-	SpriteHandler * createHandler();
+	SpriteHandler * createHandler() const;
+	// the 8-bit sprites are kept decoded on disk
+	bool usesDiskCache() const;
+	// decoded sprites of a previous run, nullptr if there are none or they are out of date
+	SpriteDiskCache * diskCache();
+	void writeDiskCache(const std::unordered_map<Spriteref, Sprite> & sprites, const std::vector<Palette> & palettes, size_t selectablePalettes);
+	// files the sprites are made from
+	std::vector<std::string> sourceFiles() const;
+	// handler that stays open for lazy loading
+	SpriteHandler & lazyHandler();
 	std::string m_sffFile;
-	std::string m_palettesFile;
+	std::vector<std::string> m_palettesFiles;
 	std::array<uint8_t, 4> m_sffVersion;
+	// the sprite file is a packed sprite file, see SpritePack
+	bool m_packed;
+	SpriteFormat m_format;
+	bool m_trimming;
+	std::vector<Palette> m_palettes;
+	std::unique_ptr<SpriteHandler> m_handler;
+	std::unique_ptr<SpriteCache> m_cache;
+	std::unique_ptr<SpriteDiskCache> m_diskCache;
+	bool m_diskCacheChecked;
+	static std::string s_diskCacheDirectory;
 };
 
 }
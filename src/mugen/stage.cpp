@@ -20,10 +20,15 @@
 #include "stage.hpp"
 
 #include "mugenutils.hpp"
+#include "spriteregistry.hpp"
 
-#include <regex>
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
-#include <sstream>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
 
 namespace Nugem {
 namespace Mugen {
@@ -49,344 +54,302 @@ enum class DefSection {
 	Shadow,
 	Reflection,
 	Music,
-	BGDef
+	BGDef,
+	// a BG element, after the BGDef section
+	BG
 };
 
-void Stage::initialize() {
-    MugenTextFile definitionFile(std::string(folder) + "/" + m_loadingName + ".def");
-    MugenTextKeyValue kv;
-	DefSection defSection = DefSection::None;
-    auto setString = [&](std::string &result) {
-        result = kv.value();
-    };
-    auto setInt = [&](int &result) {
-        result = std::stoi(kv.value());
+namespace {
+
+// Case-insensitive order of a name against a lowercase one
+constexpr int compareName(std::string_view name, std::string_view lowercase)
+{
+    for (size_t i = 0; i < name.size() && i < lowercase.size(); i++) {
+        const char c = name[i] >= 'A' && name[i] <= 'Z' ? name[i] - 'A' + 'a' : name[i];
+        if (c != lowercase[i])
+            return c < lowercase[i] ? -1 : 1;
+    }
+    return name.size() < lowercase.size() ? -1 : name.size() > lowercase.size();
+}
+
+bool startsWith(std::string_view text, std::string_view lowercase)
+{
+    return text.size() >= lowercase.size() && compareName(text.substr(0, lowercase.size()), lowercase) == 0;
+}
+
+// Number at the start of text, as std::stoi or std::stod would read it, text moving past it
+template<typename Number>
+Number readNumber(std::string_view & text)
+{
+    char buffer[64];
+    const size_t size = std::min(text.size(), sizeof(buffer) - 1);
+    std::copy(text.data(), text.data() + size, buffer);
+    buffer[size] = '\0';
+    char * end;
+    const Number value = std::is_integral<Number>::value ? std::strtol(buffer, &end, 10) : std::strtod(buffer, &end);
+    if (end == buffer)
+        throw std::runtime_error("Invalid stage value: " + std::string(text));
+    text.remove_prefix(end - buffer);
+    return value;
+}
+
+template<typename Number>
+Number toNumber(std::string_view text)
+{
+    return readNumber<Number>(text);
+}
+
+// "x, y": the second value is left as it is if there is none
+template<typename Number>
+void readPair(std::string_view text, Number pair[2])
+{
+    pair[0] = readNumber<Number>(text);
+    const size_t comma = text.find(',');
+    if (comma == std::string_view::npos || text.find_first_not_of(" \t", comma + 1) == std::string_view::npos)
+        return;
+    text.remove_prefix(comma + 1);
+    pair[1] = readNumber<Number>(text);
+}
+
+}
+
+// Reads the keys of the stage definition file into the stage, through a table sorted at compile time
+struct StageParser {
+    typedef void (*Setter)(StageParser & parser, std::string_view value);
+    struct Key {
+        DefSection section;
+        std::string_view name;
+        Setter set;
     };
-    auto setDouble = [&](double &result) {
-        result = std::stod(kv.value());
+    struct Section {
+        std::string_view name;
+        DefSection section;
     };
-    std::string newBgSectionName = "";
-    std::unique_ptr<BgElement> currentBgSection;
-    std::unordered_map<DefSection,std::unordered_map<std::string, std::function<void(void)>>> kvEntryExecutor {
-        {   DefSection::Info, {
-                {"name", [&]() {
-                        setString(m_name);
-                    }
-                },
-                {"displayname", [&]() {
-                        setString(m_displayName);
-                    }
-                },
-                {"versiondate", [&]() {
-                        setString(m_versionDate);
-                    }
-                },
-                {"mugenversion", [&]() {
-                        setString(m_mugenVersion);
-                    }
-                },
-                {"author", [&]() {
-                        setString(m_author);
-                    }
-                }
-            }
-        },
-        {   DefSection::Camera, {
-                {"startx", [&]() {
-                        setInt(m_start[0]);
-                    }
-                },
-                {"starty", [&]() {
-                        setInt(m_start[1]);
-                    }
-                },
-                {"boundleft", [&]() {
-                        setInt(m_boundleft);
-                    }
-                },
-                {"boundright", [&]() {
-                        setInt(m_boundright);
-                    }
-                },
-                {"boundhigh", [&]() {
-                        setInt(m_boundhigh);
-                    }
-                },
-                {"boundlow", [&]() {
-                        setInt(m_boundlow);
-                    }
-                },
-                {"tension", [&]() {
-                        setInt(m_tension);
-                    }
-                },
-                {"tensionhigh", [&]() {
-                        setInt(m_tensionhigh);
-                    }
-                },
-                {"tensionlow", [&]() {
-                        setInt(m_tensionlow);
-                    }
-                },
-                {"verticalfollow", [&]() {
-                        setDouble(m_verticalfollow);
-                    }
-                },
-                {"floortension", [&]() {
-                        setInt(m_floortension);
-                    }
-                },
-                {"overdrawhigh", [&]() {
-                        setInt(m_overdrawhigh);
-                    }
-                },
-                {"overdrawlow", [&]() {
-                        setInt(m_overdrawlow);
-                    }
-                },
-                {"cuthigh", [&]() {
-                        setInt(m_cuthigh);
-                    }
-                },
-                {"cutlow", [&]() {
-                        setInt(m_cutlow);
-                    }
-                },
-                {"startzoom", [&]() {
-                        setDouble(m_startzoom);
-                    }
-                },
-                {"zoomout", [&]() {
-                        setDouble(m_zoomout);
-                    }
-                },
-                {"zoomin", [&]() {
-                        setDouble(m_zoomin);
-                    }
-                },
-            }
-        },
-        {   DefSection::PlayerInfo, {
-                {"p1startx", [&]() {
-                        setInt(m_p1start[0]);
-                    }
-                },
-                {"p1starty", [&]() {
-                        setInt(m_p1start[1]);
-                    }
-                },
-                {"p2startx", [&]() {
-                        setInt(m_p2start[0]);
-                    }
-                },
-                {"p2starty", [&]() {
-                        setInt(m_p2start[1]);
-                    }
-                },
-                {"p1facing", [&]() {
-                        int val;
-                        setInt(val);
-                        m_p1facing = (val > 0);
-                    }
-                },
-                {"p2facing", [&]() {
-                        int val;
-                        setInt(val);
-                        m_p2facing = (val > 0);
-                    }
-                },
-                {"leftbound", [&]() {
-                        setInt(m_playerleftbound);
-                    }
-                },
-                {"rightbound", [&]() {
-                        setInt(m_playerrightbound);
-                    }
-                }
-            }
-        },
-        {   DefSection::Bound, {
-                {"screenleft", [&]() {
-                        setInt(m_screenleft);
-                    }
-                },
-                {"screeenright", [&]() {
-                        setInt(m_screenright);
-                    }
-                }
-            }
-        },
-        {   DefSection::StageInfo, {
-                {"zoffset", [&]() {
-                        setInt(m_vDist);
-                    }
-                },
-                {"zoffsetlink", [&]() {
-                        setInt(m_vDistElemId);
-                    }
-                },
-                //{"autoturn", [&]() { setInt() }},
-                {"resetBG", [&]() {
-                        int resetBG;
-                        setInt(resetBG);
-                        m_resetFlag = resetBG;
-                    }
-                },
-                {   "localcoord", [&]() {
-                        std::string str;
-                        setString(str);
-                        std::stringstream ss(str);
-                        ss >> m_localCoord[0];
-                        ss.ignore(1);
-                        ss >> m_localCoord[1];
-                    }
-                },
-                {"xscale", [&]() {
-                        setDouble(m_scale[0]);
-                    }
-                },
-                {"yscale", [&]() {
-                        setDouble(m_scale[1]);
-                    }
-                }
-            }
-        },
-        {   DefSection::Shadow, {
-            }
-        },
-        {   DefSection::Reflection, {
-            }
-        },
-        {   DefSection::Music, {
-            }
-        },
-        {   DefSection::BGDef, {
-                {   "spr", [&]() {
-                        m_spriteLoader.initialize(std::string(folder) + "/" + kv.value());
-                    }
-                },
-                {"debugbg", [&]() {
-                        int val;
-                        setInt(val);
-                        m_debugbg = val;
-                    }
-                },
-                {   "type", [&]() {
-                        std::string type;
-                        setString(type);
-                        if (type == "normal")
-                            currentBgSection.reset(new StaticBgElement);
-                        else if (type == "animated")
-                            currentBgSection.reset(new AnimatedBgElement);
-                        else if (type == "parallax")
-                            currentBgSection.reset(new ParallaxBgElement);
-                        currentBgSection->name = newBgSectionName;
-                    }
-                },
-                {   "spriteno", [&]() {
-                        if (StaticBgElement *staticBgElement = dynamic_cast<StaticBgElement *>(currentBgSection.get())) {
-                            std::string str;
-                            setString(str);
-                            std::stringstream ss(str);
-                            ss >> staticBgElement->spriteref.group;
-                            ss.ignore(1);
-                            ss >> staticBgElement->spriteref.image;
-                        }
-                    }
-                },
-                {   "layerno", [&]() {
-                        if (StaticBgElement *staticBgElement = dynamic_cast<StaticBgElement *>(currentBgSection.get())) {
-                            setInt(staticBgElement->layer);
-                        }
-                    }
-                },
-                {   "start", [&]() {
-                        if (StaticBgElement *staticBgElement = dynamic_cast<StaticBgElement *>(currentBgSection.get())) {
-                            std::string str;
-                            setString(str);
-                            std::stringstream ss(str);
-                            ss >> staticBgElement->start[0];
-                            ss.ignore(1);
-                            ss >> staticBgElement->start[0];
-                        }
-                    }
-                },
-                {   "delta", [&]() {
-                        if (StaticBgElement *staticBgElement = dynamic_cast<StaticBgElement *>(currentBgSection.get())) {
-                            std::string str;
-                            setString(str);
-                            std::stringstream ss(str);
-                            ss >> staticBgElement->delta[0];
-                            ss.ignore(1);
-                            ss >> staticBgElement->delta[0];
-                        }
-                    }
-                },
-                {   "mask", [&]() {
-                        if (StaticBgElement *staticBgElement = dynamic_cast<StaticBgElement *>(currentBgSection.get())) {
-                            int val;
-                            setInt(val);
-                            staticBgElement->mask = val;
-                        }
-                    }
-                }
-            }
+
+    static const Section sections[];
+    // sorted by section, then name
+    static const Key keys[];
+
+    static constexpr bool sorted();
+
+    StageParser(Stage & stage): stage(stage) {}
+
+    void startSection(std::string_view name);
+    void set(std::string_view name, std::string_view value);
+
+    void setBgType(std::string_view type) {
+        staticElement = nullptr;
+        if (compareName(type, "normal") == 0) {
+            staticElement = new Stage::StaticBgElement;
+            bgElement.reset(staticElement);
         }
-    };
-    std::regex bgSection("BG (.*)");
-    std::unordered_map<std::string, DefSection> sectionMap = {
-        {"info", DefSection::Info},
-        {"camera", DefSection::Camera},
-        {"playerinfo", DefSection::PlayerInfo},
-        {"bound", DefSection::Bound},
-        {"stageinfo", DefSection::StageInfo},
-        {"shadow", DefSection::Shadow},
-        {"reflection", DefSection::Reflection},
-        {"music", DefSection::Music},
-        {"bgdef", DefSection::BGDef}
-    };
-    while ((kv = definitionFile.nextValue())) {
-        if (definitionFile.newSection()) {
-            if (defSection != DefSection::BGDef) {
-                std::string section = definitionFile.section();
-                std::transform(section.begin(), section.end(), section.begin(), ::tolower);
-                if (sectionMap.count(section))
-                    defSection = sectionMap.at(section);
-                else
-                    defSection = DefSection::None;
-            }
-            else {
-                // If it's a bgdef sub-section
-                std::smatch sm;
-                if (std::regex_match(definitionFile.section(), sm, bgSection)) {
-                    if (currentBgSection)
-                        m_bgElements.emplace_back(currentBgSection.release());
-                    newBgSectionName = sm[1];
-                }
-            }
+        else if (compareName(type, "animated") == 0)
+            bgElement.reset(new Stage::AnimatedBgElement);
+        else if (compareName(type, "parallax") == 0)
+            bgElement.reset(new Stage::ParallaxBgElement);
+        else
+            bgElement.reset();
+        if (bgElement)
+            bgElement->name = bgName;
+    }
+
+    void finishBgElement() {
+        if (bgElement)
+            stage.m_bgElements.push_back(std::move(bgElement));
+        staticElement = nullptr;
+    }
+
+    Stage & stage;
+    DefSection section = DefSection::None;
+    // whether the BGDef section was reached
+    bool background = false;
+    std::string bgName;
+    std::unique_ptr<Stage::BgElement> bgElement;
+    // bgElement, if it is a static one
+    Stage::StaticBgElement * staticElement = nullptr;
+};
+
+
+constexpr StageParser::Section StageParser::sections[] = {
+    { "bgdef", DefSection::BGDef },
+    { "bound", DefSection::Bound },
+    { "camera", DefSection::Camera },
+    { "info", DefSection::Info },
+    { "music", DefSection::Music },
+    { "playerinfo", DefSection::PlayerInfo },
+    { "reflection", DefSection::Reflection },
+    { "shadow", DefSection::Shadow },
+    { "stageinfo", DefSection::StageInfo },
+};
+
+constexpr StageParser::Key StageParser::keys[] = {
+    { DefSection::Info, "author", [](StageParser & parser, std::string_view value) { parser.stage.m_author = value; } },
+    { DefSection::Info, "displayname", [](StageParser & parser, std::string_view value) { parser.stage.m_displayName = value; } },
+    { DefSection::Info, "mugenversion", [](StageParser & parser, std::string_view value) { parser.stage.m_mugenVersion = value; } },
+    { DefSection::Info, "name", [](StageParser & parser, std::string_view value) { parser.stage.m_name = value; } },
+    { DefSection::Info, "versiondate", [](StageParser & parser, std::string_view value) { parser.stage.m_versionDate = value; } },
+    { DefSection::Camera, "boundhigh", [](StageParser & parser, std::string_view value) { parser.stage.m_boundhigh = toNumber<int>(value); } },
+    { DefSection::Camera, "boundleft", [](StageParser & parser, std::string_view value) { parser.stage.m_boundleft = toNumber<int>(value); } },
+    { DefSection::Camera, "boundlow", [](StageParser & parser, std::string_view value) { parser.stage.m_boundlow = toNumber<int>(value); } },
+    { DefSection::Camera, "boundright", [](StageParser & parser, std::string_view value) { parser.stage.m_boundright = toNumber<int>(value); } },
+    { DefSection::Camera, "cuthigh", [](StageParser & parser, std::string_view value) { parser.stage.m_cuthigh = toNumber<int>(value); } },
+    { DefSection::Camera, "cutlow", [](StageParser & parser, std::string_view value) { parser.stage.m_cutlow = toNumber<int>(value); } },
+    { DefSection::Camera, "floortension", [](StageParser & parser, std::string_view value) { parser.stage.m_floortension = toNumber<int>(value); } },
+    { DefSection::Camera, "overdrawhigh", [](StageParser & parser, std::string_view value) { parser.stage.m_overdrawhigh = toNumber<int>(value); } },
+    { DefSection::Camera, "overdrawlow", [](StageParser & parser, std::string_view value) { parser.stage.m_overdrawlow = toNumber<int>(value); } },
+    { DefSection::Camera, "startx", [](StageParser & parser, std::string_view value) { parser.stage.m_start[0] = toNumber<int>(value); } },
+    { DefSection::Camera, "starty", [](StageParser & parser, std::string_view value) { parser.stage.m_start[1] = toNumber<int>(value); } },
+    { DefSection::Camera, "startzoom", [](StageParser & parser, std::string_view value) { parser.stage.m_startzoom = toNumber<double>(value); } },
+    { DefSection::Camera, "tension", [](StageParser & parser, std::string_view value) { parser.stage.m_tension = toNumber<int>(value); } },
+    { DefSection::Camera, "tensionhigh", [](StageParser & parser, std::string_view value) { parser.stage.m_tensionhigh = toNumber<int>(value); } },
+    { DefSection::Camera, "tensionlow", [](StageParser & parser, std::string_view value) { parser.stage.m_tensionlow = toNumber<int>(value); } },
+    { DefSection::Camera, "verticalfollow", [](StageParser & parser, std::string_view value) { parser.stage.m_verticalfollow = toNumber<double>(value); } },
+    { DefSection::Camera, "zoomin", [](StageParser & parser, std::string_view value) { parser.stage.m_zoomin = toNumber<double>(value); } },
+    { DefSection::Camera, "zoomout", [](StageParser & parser, std::string_view value) { parser.stage.m_zoomout = toNumber<double>(value); } },
+    { DefSection::PlayerInfo, "leftbound", [](StageParser & parser, std::string_view value) { parser.stage.m_playerleftbound = toNumber<int>(value); } },
+    { DefSection::PlayerInfo, "p1facing", [](StageParser & parser, std::string_view value) { parser.stage.m_p1facing = toNumber<int>(value) > 0; } },
+    { DefSection::PlayerInfo, "p1startx", [](StageParser & parser, std::string_view value) { parser.stage.m_p1start[0] = toNumber<int>(value); } },
+    { DefSection::PlayerInfo, "p1starty", [](StageParser & parser, std::string_view value) { parser.stage.m_p1start[1] = toNumber<int>(value); } },
+    { DefSection::PlayerInfo, "p2facing", [](StageParser & parser, std::string_view value) { parser.stage.m_p2facing = toNumber<int>(value) > 0; } },
+    { DefSection::PlayerInfo, "p2startx", [](StageParser & parser, std::string_view value) { parser.stage.m_p2start[0] = toNumber<int>(value); } },
+    { DefSection::PlayerInfo, "p2starty", [](StageParser & parser, std::string_view value) { parser.stage.m_p2start[1] = toNumber<int>(value); } },
+    { DefSection::PlayerInfo, "rightbound", [](StageParser & parser, std::string_view value) { parser.stage.m_playerrightbound = toNumber<int>(value); } },
+    { DefSection::Bound, "screenleft", [](StageParser & parser, std::string_view value) { parser.stage.m_screenleft = toNumber<int>(value); } },
+    { DefSection::Bound, "screenright", [](StageParser & parser, std::string_view value) { parser.stage.m_screenright = toNumber<int>(value); } },
+    { DefSection::StageInfo, "localcoord", [](StageParser & parser, std::string_view value) { readPair(value, parser.stage.m_localCoord); } },
+    { DefSection::StageInfo, "resetbg", [](StageParser & parser, std::string_view value) { parser.stage.m_resetFlag = toNumber<int>(value); } },
+    { DefSection::StageInfo, "xscale", [](StageParser & parser, std::string_view value) { parser.stage.m_scale[0] = toNumber<double>(value); } },
+    { DefSection::StageInfo, "yscale", [](StageParser & parser, std::string_view value) { parser.stage.m_scale[1] = toNumber<double>(value); } },
+    { DefSection::StageInfo, "zoffset", [](StageParser & parser, std::string_view value) { parser.stage.m_vDist = toNumber<int>(value); } },
+    { DefSection::StageInfo, "zoffsetlink", [](StageParser & parser, std::string_view value) { parser.stage.m_vDistElemId = toNumber<int>(value); } },
+    { DefSection::BGDef, "debugbg", [](StageParser & parser, std::string_view value) { parser.stage.m_debugbg = toNumber<int>(value); } },
+    { DefSection::BGDef, "spr", [](StageParser & parser, std::string_view value) {
+        // indexed and trimmed: the transparent borders take no room in the atlas
+        parser.stage.m_spriteLoader = SpriteRegistry::loader(std::string(Stage::folder) + "/" + std::string(value), {}, SpriteFormat::Indexed8, true);
+    } },
+    { DefSection::BG, "delta", [](StageParser & parser, std::string_view value) {
+        if (parser.staticElement)
+            readPair(value, parser.staticElement->delta);
+    } },
+    { DefSection::BG, "layerno", [](StageParser & parser, std::string_view value) {
+        if (parser.staticElement)
+            parser.staticElement->layer = toNumber<int>(value);
+    } },
+    { DefSection::BG, "mask", [](StageParser & parser, std::string_view value) {
+        if (parser.staticElement)
+            parser.staticElement->mask = toNumber<int>(value);
+    } },
+    { DefSection::BG, "spriteno", [](StageParser & parser, std::string_view value) {
+        if (parser.staticElement) {
+            int spriteno[2] = { parser.staticElement->spriteref.group, parser.staticElement->spriteref.image };
+            readPair(value, spriteno);
+            parser.staticElement->spriteref = Spriteref(spriteno[0], spriteno[1]);
         }
-        if (kvEntryExecutor[defSection].count(kv.name()))
-            kvEntryExecutor[defSection][kv.name()]();
+    } },
+    { DefSection::BG, "start", [](StageParser & parser, std::string_view value) {
+        if (parser.staticElement)
+            readPair(value, parser.staticElement->start);
+    } },
+    { DefSection::BG, "type", [](StageParser & parser, std::string_view value) { parser.setBgType(value); } },
+};
+
+constexpr bool StageParser::sorted()
+{
+    for (size_t i = 1; i < sizeof(sections) / sizeof(sections[0]); i++) {
+        if (compareName(sections[i - 1].name, sections[i].name) >= 0)
+            return false;
     }
-    if (currentBgSection)
-        m_bgElements.emplace_back(currentBgSection.release());
-    GlSpriteCollectionBuilder atlasBuilder;
+    for (size_t i = 1; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (keys[i - 1].section > keys[i].section || (keys[i - 1].section == keys[i].section && compareName(keys[i - 1].name, keys[i].name) >= 0))
+            return false;
+    }
+    return true;
+}
+
+static_assert(StageParser::sorted(), "The stage keys must be sorted by section, then name");
+
+void StageParser::startSection(std::string_view name)
+{
+    finishBgElement();
+    // after the BGDef section, the sections are BG elements
+    if (section == DefSection::BGDef || section == DefSection::BG || (section == DefSection::None && background)) {
+        section = DefSection::None;
+        if (startsWith(name, "bg ")) {
+            section = DefSection::BG;
+            bgName = name.substr(3);
+        }
+        return;
+    }
+    auto known = std::lower_bound(std::begin(sections), std::end(sections), name, [](const Section & section, std::string_view name) {
+        return compareName(name, section.name) > 0;
+    });
+    section = known != std::end(sections) && compareName(name, known->name) == 0 ? known->section : DefSection::None;
+    background = section == DefSection::BGDef;
+}
+
+void StageParser::set(std::string_view name, std::string_view value)
+{
+    auto key = std::lower_bound(std::begin(keys), std::end(keys), name, [this](const Key & key, std::string_view name) {
+        return key.section < section || (key.section == section && compareName(name, key.name) > 0);
+    });
+    if (key != std::end(keys) && key->section == section && compareName(name, key->name) == 0)
+        key->set(*this, value);
+}
+
+void Stage::initialize() {
+    MugenTextFile definitionFile(std::string(folder) + "/" + m_loadingName + ".def");
+    MugenTextKeyValue kv;
+    StageParser parser(*this);
+    while ((kv = definitionFile.nextValue())) {
+        if (definitionFile.newSection())
+            parser.startSection(definitionFile.section());
+        parser.set(kv.name(), kv.value());
+    }
+    parser.finishBgElement();
+    GlSpriteCollectionBuilder atlasBuilder(true);
     {
-        auto allsprites = m_spriteLoader.load();
+        if (!m_spriteLoader)
+            throw std::runtime_error("The stage has no sprite file");
+        // only the sprites of the elements are decoded, straight into the atlas, and once each
+        std::unordered_map<Mugen::Spriteref, StaticBgElement *> drawnElements;
+        std::vector<std::pair<size_t, int>> spritePalettes;
         for (auto &bgSection: m_bgElements) {
             if (StaticBgElement *staticElement = dynamic_cast<StaticBgElement *>(bgSection.get())) {
-                staticElement->atlasid = atlasBuilder.addSprite(allsprites[0].at(staticElement->spriteref).surface());
+                auto drawnElement = drawnElements.find(staticElement->spriteref);
+                if (drawnElement != drawnElements.end()) {
+                    staticElement->atlasid = drawnElement->second->atlasid;
+                    staticElement->atlasOffset[0] = drawnElement->second->atlasOffset[0];
+                    staticElement->atlasOffset[1] = drawnElement->second->atlasOffset[1];
+                    continue;
+                }
+                std::unique_ptr<Mugen::Sprite> sprite = m_spriteLoader->draw(staticElement->spriteref, atlasBuilder);
+                if (!sprite)
+                    throw std::out_of_range("Stage sprite not found in the sprite file");
+                staticElement->atlasid = atlasBuilder.lastSprite();
+                staticElement->atlasOffset[0] = sprite->geometry().xOffset;
+                staticElement->atlasOffset[1] = sprite->geometry().yOffset;
+                spritePalettes.push_back({ staticElement->atlasid, sprite->palette() });
+                drawnElements[staticElement->spriteref] = staticElement;
             }
         }
+        // drawing the sprites brings in their palettes
+        int paletteBase = -1;
+        for (const Mugen::Palette &palette: m_spriteLoader->palettes()) {
+            size_t row = atlasBuilder.addPalette(palette.data(), palette.size());
+            if (paletteBase < 0)
+                paletteBase = row;
+        }
+        for (auto &spritePalette: spritePalettes)
+            atlasBuilder.setSpritePalette(spritePalette.first, paletteBase, spritePalette.second);
     }
     m_textureAtlas.reset(atlasBuilder.build());
     m_camera[0] = m_start[0];
     m_camera[1] = m_start[0];
 }
 
-Mugen::SpriteLoader &Stage::spriteLoader()
+const Mugen::SharedSpriteLoader &Stage::spriteLoader() const
 {
-    return m_spriteLoader;
+    return *m_spriteLoader;
 }
 
 void Stage::renderBackground(GlGraphics &glGraphics) {
@@ -396,8 +359,8 @@ void Stage::renderBackground(GlGraphics &glGraphics) {
 		for (auto &bgSection: m_bgElements) {
 			SDL_Rect currentPosition;
 			if (StaticBgElement *staticElement = dynamic_cast<StaticBgElement *>(bgSection.get())) {
-				currentPosition.x = staticElement->start[0];
-				currentPosition.y = staticElement->start[1];
+				currentPosition.x = staticElement->start[0] + staticElement->atlasOffset[0];
+				currentPosition.y = staticElement->start[1] + staticElement->atlasOffset[1];
 				auto &spr = m_textureAtlas->sprites()[staticElement->atlasid];
 				currentPosition.w = spr.w;
 				currentPosition.h = spr.h;
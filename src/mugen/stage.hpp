@@ -21,6 +21,7 @@
 #define STAGE_HPP
 
 #include "sprites.hpp"
+#include "spriteregistry.hpp"
 #include "def.hpp"
 #include "../glgraphics.hpp"
 #include "../glsprite.hpp"
@@ -34,9 +35,10 @@ class Stage {
 public:
 	Stage(const std::string &);
 	void initialize();
-	Mugen::SpriteLoader &spriteLoader();
+	const Mugen::SharedSpriteLoader &spriteLoader() const;
 	void renderBackground(GlGraphics &glGraphics);
 private:
+	friend struct StageParser;
 	constexpr static const char *folder = "stages";
 	const std::string m_loadingName;
 	// ============================
@@ -95,7 +97,7 @@ private:
 	std::string m_bgmusic;
 	int m_bgvolume;
 	// Background definition elements
-    	Mugen::SpriteLoader m_spriteLoader;
+    	std::shared_ptr<const Mugen::SharedSpriteLoader> m_spriteLoader;
 	bool m_debugbg;
 	struct BgElement {
 		std::string name;
@@ -110,6 +112,8 @@ private:
 		int tile[2] = {0, 0};
 		int tilespacing[2] = {0, 0};
         size_t atlasid;
+		// where the trimmed sprite lies in its image
+		int atlasOffset[2] = {0, 0};
 	};
 	struct AnimatedBgElement: public BgElement {};
 	struct ParallaxBgElement: public BgElement {};
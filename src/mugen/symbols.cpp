@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "symbols.hpp"
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Nugem {
+namespace Mugen {
+
+namespace {
+
+const char * const PREDEFINED_NAMES[] = {
+	"",
+	"info",
+	"files",
+	"arcade",
+	"name",
+	"displayname",
+	"versiondate",
+	"mugenversion",
+	"author",
+	"localcoord",
+	"cmd",
+	"cns",
+	"st",
+	"stcommon",
+	"sprite",
+	"anim",
+	"sound",
+	"ai",
+	"pal1",
+	"pal2",
+	"pal3",
+	"pal4",
+	"pal5",
+	"pal6",
+	"pal7",
+	"pal8",
+	"pal9",
+	"pal10",
+	"pal11",
+	"pal12",
+	"intro.storyboard",
+	"ending.storyboard",
+};
+static_assert(sizeof(PREDEFINED_NAMES) / sizeof(PREDEFINED_NAMES[0]) == sym::PREDEFINED_COUNT, "a predefined symbol has no name");
+
+char lower(char c)
+{
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+bool sameName(std::string_view name, const std::string & lowercased)
+{
+	if (name.size() != lowercased.size())
+		return false;
+	for (size_t i = 0; i < name.size(); i++) {
+		if (lower(name[i]) != lowercased[i])
+			return false;
+	}
+	return true;
+}
+
+// Open addressing table of the symbols, by hash
+struct Pool {
+	std::mutex mutex;
+	// the names do not move as the pool grows
+	std::deque<std::string> names;
+	std::vector<uint32_t> hashes;
+	std::vector<Symbol> slots;
+
+	Pool(): slots(256, SymbolTable::NONE) {
+		for (const char * name: PREDEFINED_NAMES)
+			intern(name, SymbolTable::hash(name));
+	}
+
+	Symbol find(std::string_view name, uint32_t hash) const {
+		for (size_t slot = hash & (slots.size() - 1); slots[slot] != SymbolTable::NONE; slot = (slot + 1) & (slots.size() - 1)) {
+			if (hashes[slots[slot]] == hash && sameName(name, names[slots[slot]]))
+				return slots[slot];
+		}
+		return SymbolTable::NONE;
+	}
+
+	Symbol intern(std::string_view name, uint32_t hash) {
+		Symbol symbol = find(name, hash);
+		if (symbol != SymbolTable::NONE)
+			return symbol;
+		symbol = names.size();
+		std::string lowercased(name);
+		for (char & c: lowercased)
+			c = lower(c);
+		names.push_back(lowercased);
+		hashes.push_back(hash);
+		// kept at most half full
+		if (2 * names.size() > slots.size()) {
+			slots.assign(2 * slots.size(), SymbolTable::NONE);
+			for (Symbol known = 0; known < symbol; known++)
+				place(known);
+		}
+		place(symbol);
+		return symbol;
+	}
+
+	void place(Symbol symbol) {
+		size_t slot = hashes[symbol] & (slots.size() - 1);
+		while (slots[slot] != SymbolTable::NONE)
+			slot = (slot + 1) & (slots.size() - 1);
+		slots[slot] = symbol;
+	}
+};
+
+Pool & pool()
+{
+	static Pool s_pool;
+	return s_pool;
+}
+
+}
+
+Symbol SymbolTable::intern(std::string_view name)
+{
+	const uint32_t nameHash = hash(name);
+	Pool & symbols = pool();
+	std::lock_guard<std::mutex> lock(symbols.mutex);
+	return symbols.intern(name, nameHash);
+}
+
+Symbol SymbolTable::find(std::string_view name)
+{
+	const uint32_t nameHash = hash(name);
+	Pool & symbols = pool();
+	std::lock_guard<std::mutex> lock(symbols.mutex);
+	return symbols.find(name, nameHash);
+}
+
+std::string_view SymbolTable::name(Symbol symbol)
+{
+	Pool & symbols = pool();
+	std::lock_guard<std::mutex> lock(symbols.mutex);
+	if (symbol >= symbols.names.size())
+		return std::string_view();
+	return symbols.names[symbol];
+}
+
+uint32_t SymbolTable::hash(std::string_view name)
+{
+	// FNV-1a of the lowercased name
+	uint32_t value = 2166136261u;
+	for (char c: name) {
+		value ^= static_cast<uint8_t>(lower(c));
+		value *= 16777619u;
+	}
+	return value;
+}
+
+}
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYMBOLS_HPP
+#define SYMBOLS_HPP
+
+#include <cstdint>
+#include <string_view>
+
+namespace Nugem {
+namespace Mugen {
+
+// Interned, case-folded name: equal names, whatever their case, get the same symbol
+typedef uint32_t Symbol;
+
+// Names known in advance, usable as constants: SymbolTable::intern("Files") == sym::files
+namespace sym {
+enum : Symbol {
+	empty,
+	// sections
+	info,
+	files,
+	arcade,
+	// [Info]
+	name,
+	displayname,
+	versiondate,
+	mugenversion,
+	author,
+	localcoord,
+	// [Files]
+	cmd,
+	cns,
+	st,
+	stcommon,
+	sprite,
+	anim,
+	sound,
+	ai,
+	pal1,
+	pal2,
+	pal3,
+	pal4,
+	pal5,
+	pal6,
+	pal7,
+	pal8,
+	pal9,
+	pal10,
+	pal11,
+	pal12,
+	// [Arcade]
+	intro_storyboard,
+	ending_storyboard,
+	PREDEFINED_COUNT
+};
+}
+
+/**
+ * Process-wide pool of the names of the definition files, lowercased.
+ *
+ * Each name is stored once, with its hash, and is found again without allocating.
+ */
+class SymbolTable {
+public:
+	static constexpr Symbol NONE = static_cast<Symbol>(-1);
+	// Symbol of the name, added if it is new
+	static Symbol intern(std::string_view name);
+	// Symbol of the name, NONE if it was never interned
+	static Symbol find(std::string_view name);
+	// Lowercased name of the symbol
+	static std::string_view name(Symbol symbol);
+	// Case-insensitive hash
+	static uint32_t hash(std::string_view name);
+};
+
+}
+}
+
+#endif // SYMBOLS_HPP
@@ -33,12 +33,14 @@ bool SceneMenu::render(GlGraphics & glGraphics)
 			int squareside = 50;
 			SDL_Rect location{ 100, 100, squareside, squareside};
 			for (size_t i = 0; i < m_characters.size(); i ++) {
+				spriteDisplay.setPalette(m_characters[i].charObject().palette());
 				spriteDisplay.addSprite(m_characters[i].spriteIndex, location);
 				location.y += squareside + 10;
 			}
 		}
 		{
 			SDL_Rect bigLoc { 350, 100, 250, 250};
+			spriteDisplay.setPalette(m_characters[m_selectedCharacter].charObject().palette());
 			spriteDisplay.addSprite(m_characters[m_selectedCharacter].bigSpriteIndex, bigLoc);
 		}
 		spriteDisplay.display(glGraphics);
@@ -71,14 +73,34 @@ void SceneMenu::findCharacters()
 bool SceneMenu::loading()
 {
 	findCharacters();
-	GlSpriteCollectionBuilder textureAtlasBuilder;
+	GlSpriteCollectionBuilder textureAtlasBuilder(true);
 	std::vector<Mugen::Spriteref> menurefs { Mugen::Spriteref(9000, 0), Mugen::Spriteref(9000, 1) };
 	for (auto & chara : m_characters) {
-		auto menusprites = chara.charObject().spriteLoader().load(menurefs.begin(), menurefs.end());
-		if (!menusprites.empty() && menusprites[0].count(menurefs[0]) && menusprites[0].count(menurefs[1])) {
-			chara.spriteIndex = textureAtlasBuilder.addSprite(menusprites[0].at(menurefs[0]).surface());
-			chara.bigSpriteIndex = textureAtlasBuilder.addSprite(menusprites[0].at(menurefs[1]).surface());
+		const Mugen::SharedSpriteLoader & spriteLoader = chara.charObject().spriteLoader();
+		// only the two portraits get decoded, straight into the atlas
+		if (!spriteLoader.contains(menurefs[0]) || !spriteLoader.contains(menurefs[1]))
+			continue;
+		std::unique_ptr<Mugen::Sprite> sprite = spriteLoader.draw(menurefs[0], textureAtlasBuilder);
+		if (!sprite) {
+			std::cerr << "Couldn't draw the portrait of " << chara.charObject().name() << std::endl;
+			continue;
 		}
+		chara.spriteIndex = textureAtlasBuilder.lastSprite();
+		std::unique_ptr<Mugen::Sprite> bigSprite = spriteLoader.draw(menurefs[1], textureAtlasBuilder);
+		if (!bigSprite) {
+			std::cerr << "Couldn't draw the portrait of " << chara.charObject().name() << std::endl;
+			continue;
+		}
+		chara.bigSpriteIndex = textureAtlasBuilder.lastSprite();
+		// each character gets its own palette rows, the portraits are drawn with the palette of its colour
+		int paletteBase = -1;
+		for (const Mugen::Palette & palette : spriteLoader.palettes()) {
+			size_t row = textureAtlasBuilder.addPalette(palette.data(), palette.size());
+			if (paletteBase < 0)
+				paletteBase = row;
+		}
+		textureAtlasBuilder.setSpritePalette(chara.spriteIndex, paletteBase, sprite->palette());
+		textureAtlasBuilder.setSpritePalette(chara.bigSpriteIndex, paletteBase, bigSprite->palette());
 	}
 	m_textureAtlas.reset(textureAtlasBuilder.build());
 	m_selectedCharacter = 0;
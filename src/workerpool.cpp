@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "workerpool.hpp"
+
+namespace Nugem {
+
+struct WorkerPool::Job {
+	std::function<void(size_t)> task;
+	size_t count;
+	std::atomic<size_t> next;
+	std::atomic<size_t> finished;
+	std::mutex errorMutex;
+	std::exception_ptr error;
+};
+
+// set in the worker threads, so that a task asking for more parallelism runs it in place
+static thread_local bool insideWorker = false;
+
+WorkerPool & WorkerPool::instance()
+{
+	static WorkerPool pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0);
+	return pool;
+}
+
+WorkerPool::WorkerPool(size_t nworkers): m_generation(0), m_stopping(false)
+{
+	for (size_t i = 0; i < nworkers; i++)
+		m_threads.emplace_back(&WorkerPool::workerLoop, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wakeup.notify_all();
+	for (std::thread & thread : m_threads)
+		thread.join();
+}
+
+void WorkerPool::parallelFor(size_t count, const std::function<void(size_t)> & task)
+{
+	if (m_threads.empty() || count < 2 || insideWorker) {
+		for (size_t i = 0; i < count; i++)
+			task(i);
+		return;
+	}
+	std::lock_guard<std::mutex> jobLock(m_jobMutex);
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->task = task;
+	job->count = count;
+	job->next = 0;
+	job->finished = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = job;
+		m_generation++;
+	}
+	m_wakeup.notify_all();
+	run(*job);
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [&job]() { return job->finished == job->count; });
+		m_job.reset();
+	}
+	if (job->error)
+		std::rethrow_exception(job->error);
+}
+
+void WorkerPool::workerLoop()
+{
+	insideWorker = true;
+	size_t generation = 0;
+	while (true) {
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wakeup.wait(lock, [&]() { return m_stopping || (m_job && m_generation != generation); });
+			if (m_stopping)
+				return;
+			generation = m_generation;
+			job = m_job;
+		}
+		run(*job);
+	}
+}
+
+void WorkerPool::run(Job & job)
+{
+	size_t i;
+	while ((i = job.next++) < job.count) {
+		try {
+			job.task(i);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(job.errorMutex);
+			if (!job.error)
+				job.error = std::current_exception();
+		}
+		if (++job.finished == job.count) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_done.notify_all();
+		}
+	}
+}
+
+}
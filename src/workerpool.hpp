@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Nugem {
+
+/**
+ * Pool of worker threads shared by the whole program, for independent tasks such as decoding sprites.
+ */
+class WorkerPool {
+public:
+	static WorkerPool & instance();
+	// Runs task(0) to task(count - 1) on the workers and the calling thread, and returns once they are all done.
+	// The tasks may run in any order; the first exception thrown by a task is rethrown here.
+	void parallelFor(size_t count, const std::function<void(size_t)> & task);
+	size_t threadCount() const { return m_threads.size() + 1; };
+	~WorkerPool();
+private:
+	struct Job;
+	WorkerPool(size_t nworkers);
+	WorkerPool(const WorkerPool &) = delete;
+	WorkerPool & operator=(const WorkerPool &) = delete;
+	void workerLoop();
+	void run(Job & job);
+	std::vector<std::thread> m_threads;
+	// only one job at a time
+	std::mutex m_jobMutex;
+	std::mutex m_mutex;
+	std::condition_variable m_wakeup;
+	std::condition_variable m_done;
+	std::shared_ptr<Job> m_job;
+	size_t m_generation;
+	bool m_stopping;
+};
+
+}
+
+#endif // WORKERPOOL_HPP
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sffgenerator.hpp"
+#include "mugen/pixelexpand.hpp"
+#include "mugen/spritedecoders.hpp"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace Nugem::Mugen;
+
+namespace {
+
+// The per-pixel loops the decoders replaced, kept as they were to compare the output of the decoders with theirs
+
+void referencePcx(const uint8_t * dataStart, size_t dataLength, uint8_t * indexData, size_t nPixels)
+{
+	size_t i_pixel, i_byte;
+	for (i_pixel = 0, i_byte = 0; i_pixel < nPixels && i_byte < dataLength; i_byte++) {
+		uint16_t runLength;
+		uint8_t colorIndex;
+		if ((dataStart[i_byte] & 0xC0) == 0xC0) { // RLE byte
+			runLength = dataStart[i_byte] & 0x3F;
+			i_byte++;
+			colorIndex = dataStart[i_byte];
+		}
+		else { // simple pixel byte
+			runLength = 1;
+			colorIndex = dataStart[i_byte];
+		}
+		for (int runCount = runLength; runCount > 0 && i_pixel < nPixels; runCount--, i_pixel++)
+			*(indexData + i_pixel) = colorIndex;
+	}
+}
+
+void referenceRle8(const uint8_t * sdata, size_t dataLength, uint8_t * indexData, size_t nPixels)
+{
+	auto outputColoredPixel = [&](uint8_t color, const uint32_t indexPixel) {
+		if (indexPixel < nPixels)
+			* (indexData + indexPixel) = color;
+	};
+	uint64_t indexPixel = 0;
+	for (uint32_t i_byte = 4; i_byte < dataLength; i_byte++) {
+		uint8_t first_byte = sdata[i_byte];
+		if ((first_byte & 0xC0) == 0x40) {  // in the case of a RLE control packet
+			i_byte++;
+			uint8_t color = sdata[i_byte]; // <- the next byte
+			uint8_t run_length = (first_byte & 0x3F);
+			for (int run_count = 0; run_count < run_length; run_count++)
+				outputColoredPixel(color, indexPixel++);
+		}
+		else
+			outputColoredPixel(first_byte, indexPixel++);
+	}
+}
+
+void referenceRle5(const uint8_t * sdata, size_t dataLength, uint8_t * indexData, size_t nPixels)
+{
+	auto outputColoredPixel = [&](uint8_t color, const uint32_t indexPixel) {
+		if (indexPixel < nPixels)
+			* (indexData + indexPixel) = color;
+	};
+	uint64_t indexPixel = 0;
+	for (uint32_t i_byte = 4; i_byte < dataLength; i_byte++) {
+		uint8_t run_length = sdata[i_byte];
+		i_byte++;
+		uint8_t data_length = sdata[i_byte];
+		uint8_t color;
+		if (data_length & 0x80) // testing the color bit
+			color = sdata[++i_byte];
+		else
+			color = 0;
+		for (int run_count = 0; run_count < run_length; run_count++)
+			outputColoredPixel(color, indexPixel++);
+		for (int bytes_processed = 0; bytes_processed < (data_length & 0x7F) - 1; bytes_processed++) {
+			uint8_t byte = sdata[++i_byte];
+			color = byte & 0x1F;
+			run_length = byte >> 5;
+			for (uint8_t run_count = 0; run_count < run_length; run_count++)
+				outputColoredPixel(color, indexPixel++);
+		}
+	}
+}
+
+void referenceLz5(const uint8_t * sdata, size_t dataLength, uint8_t * indexData, size_t nPixels)
+{
+	auto outputColoredPixel = [&](uint8_t color, const uint32_t indexPixel) {
+		if (indexPixel < nPixels)
+			* (indexData + indexPixel) = color;
+	};
+	uint64_t indexPixel = 0;
+	uint32_t shortlzpackets = 1;
+	uint8_t recycledbits = 0;
+	for (uint32_t i_byte = 4; i_byte < dataLength; i_byte++) {
+		uint8_t control_packet = sdata[i_byte];
+		for (uint8_t i_data_packet = 0; i_data_packet < 8 && i_byte < dataLength; i_data_packet++) {
+			uint8_t flag = control_packet & (1 << i_data_packet); // value 0-> it is a RLE packet, value 1-> LZ packet
+			i_byte++;
+			if (!flag) { // RLE packet (short or long)
+				uint8_t color = sdata[i_byte] & 0x1F;
+				uint32_t run_length = sdata[i_byte] & 0xE0;
+				if (run_length > 0) // short RLE packet
+					run_length >>= 5;
+				else { // long RLE packet
+					i_byte++;
+					run_length = sdata[i_byte] + 8;
+				}
+				for (size_t run_count = 0; run_count < run_length; run_count++)
+					outputColoredPixel(color, indexPixel++);
+			}
+			else { // LZ packet (short or long)
+				uint32_t copylength = sdata[i_byte] & 0x3F; // bits 0-5
+				uint16_t offset = 0;
+				if (copylength) { // short LZ packet
+					copylength += 1;
+					if (shortlzpackets % 4 == 0) { // use the recycled bits
+						recycledbits |= (sdata[i_byte] & 0xC0) >> 6;
+						offset = recycledbits + 1;
+						recycledbits = 0;
+					}
+					else { // read the extra byte
+						recycledbits |= (sdata[i_byte] & 0xC0) >> (2 * ((shortlzpackets - 1) % 4));
+						i_byte++;
+						offset = sdata[i_byte] + 1;
+					}
+					shortlzpackets++;
+				}
+				else { // long LZ packet
+					offset = sdata[i_byte] << 2;
+					i_byte++;
+					offset |= sdata[i_byte];
+					offset += 1;
+					i_byte++;
+					copylength = sdata[i_byte] + 3;
+				}
+				for (uint32_t i_pixel = 0; i_pixel < copylength && indexPixel < nPixels; i_pixel++, indexPixel++) {
+					uint32_t offsetFromBeginning;
+					if (offset)
+						offsetFromBeginning = offset * (1 + i_pixel / offset);
+					else
+						offsetFromBeginning = i_pixel;
+					if (offsetFromBeginning <= indexPixel)
+						* (indexData + indexPixel) = * (indexData + indexPixel - offsetFromBeginning);
+				}
+			}
+		}
+	}
+}
+
+// The palette applied pixel by pixel, from its color components
+void referenceExpand(const uint8_t * indices, size_t count, const uint8_t (* palette)[4], uint32_t * pixels)
+{
+	for (size_t i = 0; i < count; i++) {
+		const uint8_t * color = palette[indices[i]];
+		pixels[i] = color[0] | color[1] << 8 | color[2] << 16 | static_cast<uint32_t>(color[3]) << 24;
+	}
+}
+
+typedef void (*Decoder)(const uint8_t *, size_t, uint8_t *, size_t);
+
+// Decodes the generated sprites with both decoders into buffers of the same initial content, and counts the sprites that differ
+size_t compareDecoders(const SyntheticSffOptions & options, Decoder decoder, Decoder reference, size_t headerSize, size_t & nSprites)
+{
+	size_t mismatches = 0;
+	const SyntheticSff sff(options);
+	for (const SyntheticSff::EncodedSprite & sprite: sff.sprites()) {
+		const size_t nPixels = sprite.width * sprite.height;
+		std::vector<uint8_t> expected(nPixels, 0xA5);
+		std::vector<uint8_t> actual(expected);
+		reference(sprite.data.data() + headerSize, sprite.data.size() - headerSize, expected.data(), nPixels);
+		decoder(sprite.data.data() + headerSize, sprite.data.size() - headerSize, actual.data(), nPixels);
+		nSprites++;
+		if (actual != expected)
+			mismatches++;
+	}
+	return mismatches;
+}
+
+}
+
+/**
+ * Checks that the sprite decoders and the palette expansion give the same output, bit for bit, as the per-pixel loops they replaced.
+ *
+ * The inputs are the generated sprites of nugem-bench-sff, in several sizes and seeds, and random indices and palettes.
+ */
+int main()
+{
+	struct Format {
+		const char * name;
+		int version;
+		SyntheticCompression compression;
+		Decoder decoder;
+		Decoder reference;
+		// bytes before the data the decoder reads
+		size_t headerSize;
+	};
+	const Format formats[] = {
+		{ "pcx", 1, SyntheticCompression::Pcx, decodePcx, referencePcx, 128 },
+		{ "rle8", 2, SyntheticCompression::Rle8, decodeRle8, referenceRle8, 0 },
+		{ "rle5", 2, SyntheticCompression::Rle5, decodeRle5, referenceRle5, 0 },
+		{ "lz5", 2, SyntheticCompression::Lz5, decodeLz5, referenceLz5, 0 },
+	};
+	const size_t sizes[][2] = { { 1, 1 }, { 7, 5 }, { 64, 48 }, { 129, 33 }, { 320, 240 } };
+	size_t failures = 0;
+	for (const Format & format: formats) {
+		size_t nSprites = 0;
+		size_t mismatches = 0;
+		for (const auto & size: sizes) {
+			for (uint32_t seed = 1; seed <= 3; seed++) {
+				SyntheticSffOptions options;
+				options.version = format.version;
+				options.sprites = 30;
+				options.width = size[0];
+				options.height = size[1];
+				options.compressions = { format.compression };
+				options.seed = seed;
+				mismatches += compareDecoders(options, format.decoder, format.reference, format.headerSize, nSprites);
+			}
+		}
+		printf("%-8s %zu/%zu sprites differ\n", format.name, mismatches, nSprites);
+		failures += mismatches;
+	}
+
+	const struct {
+		const char * name;
+		ExpandPath path;
+	} paths[] = { { "scalar", ExpandPath::Scalar }, { "sse2", ExpandPath::Sse2 }, { "avx2", ExpandPath::Avx2 } };
+	std::mt19937 random(1);
+	uint8_t palette[256][4];
+	uint32_t colors[256];
+	for (size_t i = 0; i < 256; i++) {
+		for (uint8_t & component: palette[i])
+			component = random();
+		colors[i] = palette[i][0] | palette[i][1] << 8 | palette[i][2] << 16 | static_cast<uint32_t>(palette[i][3]) << 24;
+	}
+	for (const auto & path: paths) {
+		const ExpandFunction expand = expandIndicesFunction(path.path);
+		if (!expand) {
+			printf("%-8s not supported here, skipped\n", path.name);
+			continue;
+		}
+		size_t runs = 0;
+		size_t mismatches = 0;
+		// every length up to a few vectors, from unaligned positions, so that the vector loops and their tails both run
+		for (size_t count = 0; count < 100; count++) {
+			for (size_t offset = 0; offset < 4; offset++) {
+				std::vector<uint8_t> indices(offset + count);
+				for (uint8_t & index: indices)
+					index = random();
+				std::vector<uint32_t> expected(offset + count + 1, 0xDEADBEEF);
+				std::vector<uint32_t> actual(expected);
+				referenceExpand(indices.data() + offset, count, palette, expected.data() + offset);
+				expand(indices.data() + offset, count, colors, actual.data() + offset);
+				runs++;
+				if (actual != expected)
+					mismatches++;
+			}
+		}
+		printf("%-8s %zu/%zu expansions differ\n", path.name, mismatches, runs);
+		failures += mismatches;
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sffgenerator.hpp"
+#include "mugen/sffv1.hpp"
+#include "mugen/sffv2.hpp"
+#include "mugen/spritedecoders.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace Nugem::Mugen;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void report(const std::string & name, size_t sprites, size_t bytes, double seconds)
+{
+	printf("  %-24s %10.0f sprites/s %10.1f MB/s\n", name.c_str(), sprites / seconds, bytes / seconds / (1 << 20));
+}
+
+// Decodes the sprites with the decoder of their format alone, on this thread
+void benchDecoder(const SyntheticSff & sff, size_t iterations)
+{
+	std::vector<uint8_t> pixels;
+	size_t nSprites = 0;
+	size_t nBytes = 0;
+	const Clock::time_point start = Clock::now();
+	for (size_t iteration = 0; iteration < iterations; iteration++) {
+		for (const SyntheticSff::EncodedSprite & sprite: sff.sprites()) {
+			const size_t nPixels = sprite.width * sprite.height;
+			pixels.resize(nPixels);
+			const uint8_t * data = sprite.data.data();
+			const size_t size = sprite.data.size();
+			switch (sprite.compression) {
+			case SyntheticCompression::Pcx:
+				decodePcx(data + 128, size - 128, pixels.data(), nPixels);
+				break;
+			case SyntheticCompression::Raw:
+				memcpy(pixels.data(), data + 4, nPixels);
+				break;
+			case SyntheticCompression::Rle8:
+				decodeRle8(data, size, pixels.data(), nPixels);
+				break;
+			case SyntheticCompression::Rle5:
+				decodeRle5(data, size, pixels.data(), nPixels);
+				break;
+			case SyntheticCompression::Lz5:
+				decodeLz5(data, size, pixels.data(), nPixels);
+				break;
+			case SyntheticCompression::Png8:
+				decodePng8(data + 4, size - 4, pixels.data(), sprite.width, sprite.height);
+				break;
+			}
+			nSprites++;
+			nBytes += nPixels;
+		}
+	}
+	report("decoder", nSprites, nBytes, secondsSince(start));
+}
+
+// Loads the whole file through its handler, as the game does
+void benchHandler(const SyntheticSffOptions & options, const std::string & path, const std::vector<std::string> & paletteFiles, SpriteFormat format, size_t iterations)
+{
+	size_t nSprites = 0;
+	size_t nBytes = 0;
+	const Clock::time_point start = Clock::now();
+	for (size_t iteration = 0; iteration < iterations; iteration++) {
+		std::unique_ptr<SpriteHandler> handler;
+		if (options.version == 1)
+			handler.reset(new Sffv1(path.c_str(), paletteFiles));
+		else
+			handler.reset(new Sffv2(path.c_str()));
+		handler->setFormat(format);
+		handler->load();
+		for (const auto & sprites: handler->takeSprites()) {
+			for (const auto & sprite: sprites) {
+				const SDL_Surface * surface = sprite.second.surface();
+				nSprites++;
+				nBytes += surface->w * surface->h * surface->format->BytesPerPixel;
+			}
+		}
+	}
+	report(format == SpriteFormat::Indexed8 ? "load, indexed" : "load, rgba", nSprites, nBytes, secondsSince(start));
+}
+
+void usage(const char * program)
+{
+	std::cerr << "Usage: " << program << " [options]" << std::endl
+	          << "  --version 1|2          sprite file version (default 2)" << std::endl
+	          << "  --sprites N            sprites per file (default 200)" << std::endl
+	          << "  --size WxH             sprite size (default 128x128)" << std::endl
+	          << "  --palettes N           palettes (default 1)" << std::endl
+	          << "  --formats a,b,...      compressions to measure, among pcx (SFFv1), raw, rle8, rle5, lz5, png8 (SFFv2)" << std::endl
+	          << "  --seed N               seed of the generated images (default 1)" << std::endl
+	          << "  --iterations N         times each measure is repeated (default 5)" << std::endl
+	          << "  --output FILE          generated sprite file, kept after the run (the one of the last format)" << std::endl;
+}
+
+}
+
+/**
+ * nugem-bench-sff: measures the sprite decoders on generated sprite files.
+ *
+ * For each compression, a file of sprites of this compression alone is generated, then decoded by the decoder alone and loaded by its handler.
+ */
+int main(int argc, char ** argv)
+{
+	SyntheticSffOptions options;
+	std::vector<SyntheticCompression> compressions;
+	size_t iterations = 5;
+	std::string output;
+	for (int i = 1; i < argc; i++) {
+		const std::string option = argv[i];
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		const std::string value = argv[++i];
+		if (option == "--version")
+			options.version = atoi(value.c_str());
+		else if (option == "--sprites")
+			options.sprites = strtoul(value.c_str(), nullptr, 10);
+		else if (option == "--size" && sscanf(value.c_str(), "%zux%zu", &options.width, &options.height) == 2)
+			continue;
+		else if (option == "--palettes")
+			options.palettes = strtoul(value.c_str(), nullptr, 10);
+		else if (option == "--seed")
+			options.seed = strtoul(value.c_str(), nullptr, 10);
+		else if (option == "--iterations")
+			iterations = strtoul(value.c_str(), nullptr, 10);
+		else if (option == "--output")
+			output = value;
+		else if (option == "--formats") {
+			std::istringstream list(value);
+			std::string name;
+			while (std::getline(list, name, ',')) {
+				SyntheticCompression compression;
+				if (!SyntheticSff::parse(name, compression)) {
+					std::cerr << "Unknown format " << name << std::endl;
+					return 1;
+				}
+				compressions.push_back(compression);
+			}
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (compressions.empty()) {
+		if (options.version == 1)
+			compressions = { SyntheticCompression::Pcx };
+		else
+			compressions = { SyntheticCompression::Raw, SyntheticCompression::Rle8, SyntheticCompression::Rle5, SyntheticCompression::Lz5, SyntheticCompression::Png8 };
+	}
+
+	const std::string path = output.empty() ? "nugem-bench-sff.sff" : output;
+	try {
+		printf("SFFv%d, %zu sprites of %zux%zu, %zu palettes, %zu iterations\n", options.version, options.sprites, options.width, options.height, options.palettes, iterations);
+		for (SyntheticCompression compression: compressions) {
+			options.compressions = { compression };
+			const SyntheticSff sff(options);
+			size_t compressedSize = 0;
+			for (const SyntheticSff::EncodedSprite & sprite: sff.sprites())
+				compressedSize += sprite.data.size();
+			printf("%s: %.1f KB compressed, %.1f%% of the pixels\n", SyntheticSff::name(compression), compressedSize / 1024.0,
+			       100.0 * compressedSize / std::max<size_t>(options.sprites * options.width * options.height, 1));
+			benchDecoder(sff, iterations);
+			const std::vector<std::string> paletteFiles = sff.write(path);
+			benchHandler(options, path, paletteFiles, SpriteFormat::Indexed8, iterations);
+			benchHandler(options, path, paletteFiles, SpriteFormat::Rgba32, iterations);
+			if (output.empty()) {
+				remove(path.c_str());
+				for (const std::string & paletteFile: paletteFiles)
+					remove(paletteFile.c_str());
+			}
+		}
+	}
+	catch (std::exception & error) {
+		std::cerr << error.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mugen/sffv1.hpp"
+#include "mugen/sffv2.hpp"
+#include "mugen/spritediskcache.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace Nugem::Mugen;
+
+/**
+ * nugem-pack: converts a SFFv1 or SFFv2 sprite file into a packed sprite file, which SpriteLoader maps and draws without decoding.
+ *
+ * The sprites are decoded once, trimmed, with their links resolved and their palettes, the palette files given to a SFFv1 included.
+ */
+int main(int argc, char ** argv)
+{
+	if (argc < 3) {
+		std::cerr << "Usage: " << argv[0] << " <sprites.sff> [palette1.act palette2.act ...] <output>" << std::endl;
+		return 1;
+	}
+	const std::string sffPath = argv[1];
+	const std::vector<std::string> palettesPaths(argv + 2, argv + argc - 1);
+	const std::string outputPath = argv[argc - 1];
+
+	uint8_t header[16];
+	std::ifstream sffFile(sffPath, std::ios::binary);
+	if (!sffFile.read(reinterpret_cast<char *>(header), sizeof(header)) || memcmp(header, "ElecbyteSpr", 12)) {
+		std::cerr << sffPath << " is not a sprite file" << std::endl;
+		return 1;
+	}
+	sffFile.close();
+	std::unique_ptr<SpriteHandler> handler;
+	try {
+		if (extract_version(header + 12)[0] >= 2)
+			handler.reset(new Sffv2(sffPath.c_str()));
+		else
+			handler.reset(new Sffv1(sffPath.c_str(), palettesPaths));
+	}
+	catch (std::exception & error) {
+		std::cerr << "Could not read " << sffPath << ": " << error.what() << std::endl;
+		return 1;
+	}
+	handler->setFormat(SpriteFormat::Indexed8);
+	handler->setTrimming(true);
+	handler->load();
+	std::vector<std::unordered_map<Spriteref, Sprite>> sprites = handler->takeSprites();
+	if (sprites.empty()) {
+		std::cerr << sffPath << " has no sprites" << std::endl;
+		return 1;
+	}
+
+	if (!SpriteDiskCache::write(outputPath, {}, sprites[0], handler->palettes(), handler->selectablePalettes(), true)) {
+		std::cerr << "Could not write " << outputPath << std::endl;
+		return 1;
+	}
+	std::unordered_set<const SDL_Surface *> surfaces;
+	for (auto & sprite: sprites[0])
+		surfaces.insert(sprite.second.surface());
+	std::cout << outputPath << ": " << sprites[0].size() << " sprites, " << surfaces.size() << " distinct, " << handler->palettes().size() << " palettes" << std::endl;
+	return 0;
+}
@@ -0,0 +1,617 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sffgenerator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+namespace Nugem {
+namespace Mugen {
+
+namespace {
+
+const size_t PALETTE_SIZE = 256;
+
+void write_uint16(std::vector<uint8_t> & out, uint16_t value)
+{
+	out.push_back(value);
+	out.push_back(value >> 8);
+}
+
+void write_uint32(std::vector<uint8_t> & out, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		out.push_back(value >> (8 * i));
+}
+
+void put_uint32(std::vector<uint8_t> & out, size_t offset, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		out[offset + i] = value >> (8 * i);
+}
+
+void write_bigEndian32(std::vector<uint8_t> & out, uint32_t value)
+{
+	for (int i = 3; i >= 0; i--)
+		out.push_back(value >> (8 * i));
+}
+
+// A transparent border, then an ellipse filled with short runs of color; about a quarter of the rows repeat the previous one
+std::vector<uint8_t> makeImage(std::mt19937 & random, size_t width, size_t height, unsigned nColors)
+{
+	std::vector<uint8_t> pixels(width * height, 0);
+	const double border = std::min(width, height) / 10;
+	const double radiusX = width / 2.0 - border;
+	const double radiusY = height / 2.0 - border;
+	for (size_t y = 0; y < height; y++) {
+		uint8_t * row = pixels.data() + y * width;
+		if (y > 0 && random() % 4 == 0) {
+			memcpy(row, row - width, width);
+			continue;
+		}
+		const double dy = (y + 0.5 - height / 2.0) / radiusY;
+		if (radiusX <= 0 || radiusY <= 0 || dy * dy >= 1)
+			continue;
+		const double halfSpan = radiusX * std::sqrt(1 - dy * dy);
+		size_t x = static_cast<size_t>(std::max(0.0, width / 2.0 - halfSpan));
+		const size_t end = std::min(width, static_cast<size_t>(width / 2.0 + halfSpan));
+		while (x < end) {
+			const size_t run = std::min<size_t>(1 + random() % 12, end - x);
+			memset(row + x, 1 + random() % (nColors - 1), run);
+			x += run;
+		}
+	}
+	return pixels;
+}
+
+std::vector<uint8_t> encodePcx(const std::vector<uint8_t> & pixels, size_t width, size_t height, const std::vector<uint8_t> * palette)
+{
+	std::vector<uint8_t> out(128, 0);
+	out[0] = 10; // manufacturer
+	out[1] = 5; // version
+	out[2] = 1; // run-length encoding
+	out[3] = 8; // bits per pixel
+	out[8] = (width - 1) & 0xFF;
+	out[9] = (width - 1) >> 8;
+	out[10] = (height - 1) & 0xFF;
+	out[11] = (height - 1) >> 8;
+	out[65] = 1; // planes
+	out[66] = width & 0xFF;
+	out[67] = width >> 8;
+	// runs stop at the end of the rows
+	for (size_t y = 0; y < height; y++) {
+		const uint8_t * row = pixels.data() + y * width;
+		for (size_t x = 0; x < width;) {
+			size_t run = 1;
+			while (x + run < width && row[x + run] == row[x] && run < 63)
+				run++;
+			if (run > 1 || row[x] >= 0xC0)
+				out.push_back(0xC0 | run);
+			out.push_back(row[x]);
+			x += run;
+		}
+	}
+	if (palette) {
+		out.push_back(0x0C);
+		out.insert(out.end(), palette->begin(), palette->end());
+	}
+	return out;
+}
+
+void encodeRle8(const std::vector<uint8_t> & pixels, std::vector<uint8_t> & out)
+{
+	for (size_t i = 0; i < pixels.size();) {
+		size_t run = 1;
+		while (i + run < pixels.size() && pixels[i + run] == pixels[i] && run < 63)
+			run++;
+		if (run > 1 || (pixels[i] & 0xC0) == 0x40)
+			out.push_back(0x40 | run);
+		out.push_back(pixels[i]);
+		i += run;
+	}
+}
+
+void encodeRle5(const std::vector<uint8_t> & pixels, std::vector<uint8_t> & out)
+{
+	for (size_t i = 0; i < pixels.size();) {
+		// a run of any color, then runs of up to 7 pixels of 5-bit colors
+		const uint8_t color = pixels[i];
+		size_t run = 1;
+		while (i + run < pixels.size() && pixels[i + run] == color && run < 255)
+			run++;
+		i += run;
+		std::vector<uint8_t> shortRuns;
+		while (i < pixels.size() && pixels[i] < 32 && shortRuns.size() < 126) {
+			size_t shortRun = 1;
+			while (i + shortRun < pixels.size() && pixels[i + shortRun] == pixels[i] && shortRun < 7)
+				shortRun++;
+			shortRuns.push_back(shortRun << 5 | pixels[i]);
+			i += shortRun;
+		}
+		out.push_back(run);
+		out.push_back((color ? 0x80 : 0) | (shortRuns.size() + 1));
+		if (color)
+			out.push_back(color);
+		out.insert(out.end(), shortRuns.begin(), shortRuns.end());
+	}
+}
+
+// Greedy LZ5: back references found through the previous row and a table of the last 3-byte sequences
+void encodeLz5(const std::vector<uint8_t> & pixels, size_t width, std::vector<uint8_t> & out)
+{
+	std::vector<int64_t> lastSeen(4096, -1);
+	size_t controlPosition = 0;
+	unsigned nPackets = 8;
+	unsigned nShortLz = 0;
+	// short LZ packets whose top bits hold the offset of the next fourth one
+	std::vector<size_t> recycling;
+	auto startPacket = [&](bool lz) {
+		if (nPackets == 8) {
+			controlPosition = out.size();
+			out.push_back(0);
+			nPackets = 0;
+		}
+		if (lz)
+			out[controlPosition] |= 1 << nPackets;
+		nPackets++;
+	};
+	auto matchLength = [&](size_t i, size_t offset) {
+		size_t length = 0;
+		while (i + length < pixels.size() && pixels[i + length] == pixels[i + length - offset] && length < 258)
+			length++;
+		return length;
+	};
+	for (size_t i = 0; i < pixels.size();) {
+		size_t run = 1;
+		while (i + run < pixels.size() && pixels[i + run] == pixels[i] && run < 263)
+			run++;
+		size_t bestLength = 0;
+		size_t bestOffset = 0;
+		if (i + 3 <= pixels.size()) {
+			const size_t hash = (pixels[i] * 2654435761u ^ pixels[i + 1] * 40503u ^ pixels[i + 2]) & 4095;
+			const int64_t seen = lastSeen[hash];
+			lastSeen[hash] = i;
+			for (size_t offset: { seen >= 0 ? i - seen : 0, width }) {
+				if (offset && offset <= i && offset <= 1024) {
+					const size_t length = matchLength(i, offset);
+					if (length > bestLength) {
+						bestLength = length;
+						bestOffset = offset;
+					}
+				}
+			}
+		}
+		if (bestLength >= 3 && bestLength > run) {
+			startPacket(true);
+			if (bestLength <= 64 && bestOffset <= 256) {
+				const unsigned offset = bestOffset - 1;
+				if (++nShortLz % 4 == 0) {
+					// the offset is spread over the top bits of the 3 previous short packets, and of this one
+					for (size_t k = 0; k < recycling.size(); k++)
+						out[recycling[k]] |= ((offset >> (6 - 2 * k)) & 3) << 6;
+					recycling.clear();
+					out.push_back((bestLength - 1) | (offset & 3) << 6);
+				}
+				else {
+					recycling.push_back(out.size());
+					out.push_back(bestLength - 1);
+					out.push_back(offset);
+				}
+			}
+			else {
+				const unsigned offset = bestOffset - 1;
+				out.push_back((offset >> 8) << 6);
+				out.push_back(offset & 0xFF);
+				out.push_back(bestLength - 3);
+			}
+			i += bestLength;
+			continue;
+		}
+		startPacket(false);
+		const uint8_t color = pixels[i] & 0x1F;
+		if (run <= 7) {
+			out.push_back(run << 5 | color);
+		}
+		else {
+			out.push_back(color);
+			out.push_back(run - 8);
+		}
+		i += run;
+	}
+}
+
+const uint16_t LENGTH_BASES[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t LENGTH_EXTRA_BITS[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t DISTANCE_BASES[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t DISTANCE_EXTRA_BITS[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+class BitWriter {
+public:
+	BitWriter(std::vector<uint8_t> & out): m_out(out), m_buffer(0), m_count(0) {};
+	void put(uint32_t value, unsigned nBits) {
+		m_buffer |= value << m_count;
+		m_count += nBits;
+		while (m_count >= 8) {
+			m_out.push_back(m_buffer);
+			m_buffer >>= 8;
+			m_count -= 8;
+		}
+	}
+	// Huffman codes go first bit first
+	void putCode(uint32_t code, unsigned length) {
+		uint32_t reversed = 0;
+		for (unsigned bit = 0; bit < length; bit++)
+			reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+		put(reversed, length);
+	}
+	void finish() {
+		if (m_count)
+			m_out.push_back(m_buffer);
+		m_buffer = 0;
+		m_count = 0;
+	}
+private:
+	std::vector<uint8_t> & m_out;
+	uint32_t m_buffer;
+	unsigned m_count;
+};
+
+void putLiteral(BitWriter & bits, unsigned symbol)
+{
+	if (symbol < 144)
+		bits.putCode(0x30 + symbol, 8);
+	else if (symbol < 256)
+		bits.putCode(0x190 + symbol - 144, 9);
+	else if (symbol < 280)
+		bits.putCode(symbol - 256, 7);
+	else
+		bits.putCode(0xC0 + symbol - 280, 8);
+}
+
+// zlib stream of a single block of fixed codes, with greedy matching
+std::vector<uint8_t> deflateFixed(const std::vector<uint8_t> & data)
+{
+	std::vector<uint8_t> out { 0x78, 0x01 };
+	BitWriter bits(out);
+	bits.put(1, 1);
+	bits.put(1, 2);
+	std::vector<int64_t> lastSeen(1 << 15, -1);
+	for (size_t i = 0; i < data.size();) {
+		size_t length = 0;
+		size_t distance = 0;
+		if (i + 3 <= data.size()) {
+			const size_t hash = ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & 0x7FFF;
+			const int64_t seen = lastSeen[hash];
+			lastSeen[hash] = i;
+			if (seen >= 0 && i - seen <= 32768) {
+				while (i + length < data.size() && data[i + length] == data[seen + length] && length < 258)
+					length++;
+				distance = i - seen;
+			}
+		}
+		if (length < 3) {
+			putLiteral(bits, data[i++]);
+			continue;
+		}
+		size_t code = 28;
+		while (LENGTH_BASES[code] > length)
+			code--;
+		putLiteral(bits, 257 + code);
+		bits.put(length - LENGTH_BASES[code], LENGTH_EXTRA_BITS[code]);
+		code = 29;
+		while (DISTANCE_BASES[code] > distance)
+			code--;
+		bits.putCode(code, 5);
+		bits.put(distance - DISTANCE_BASES[code], DISTANCE_EXTRA_BITS[code]);
+		i += length;
+	}
+	putLiteral(bits, 256);
+	bits.finish();
+	uint32_t a = 1, b = 0;
+	for (uint8_t byte: data) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	write_bigEndian32(out, b << 16 | a);
+	return out;
+}
+
+uint32_t crc32(const uint8_t * data, size_t size)
+{
+	static const struct Table {
+		uint32_t values[256];
+		Table() {
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++)
+					c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+				values[n] = c;
+			}
+		}
+	} table;
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; i++)
+		crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
+void writeChunk(std::vector<uint8_t> & out, const char * type, const std::vector<uint8_t> & data)
+{
+	write_bigEndian32(out, data.size());
+	const size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	write_bigEndian32(out, crc32(out.data() + start, out.size() - start));
+}
+
+// 8-bit palette PNG, each row unfiltered or, when it repeats the previous one, filtered by "up"
+void encodePng8(const std::vector<uint8_t> & pixels, size_t width, size_t height, const std::vector<uint8_t> & palette, std::vector<uint8_t> & out)
+{
+	const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	out.insert(out.end(), signature, signature + 8);
+	std::vector<uint8_t> header;
+	write_bigEndian32(header, width);
+	write_bigEndian32(header, height);
+	header.insert(header.end(), { 8, 3, 0, 0, 0 });
+	writeChunk(out, "IHDR", header);
+	writeChunk(out, "PLTE", palette);
+	std::vector<uint8_t> filtered;
+	filtered.reserve((width + 1) * height);
+	for (size_t y = 0; y < height; y++) {
+		const uint8_t * row = pixels.data() + y * width;
+		const bool repeated = y > 0 && !memcmp(row, row - width, width);
+		filtered.push_back(repeated ? 2 : 0);
+		if (repeated)
+			filtered.insert(filtered.end(), width, 0);
+		else
+			filtered.insert(filtered.end(), row, row + width);
+	}
+	writeChunk(out, "IDAT", deflateFixed(filtered));
+	writeChunk(out, "IEND", {});
+}
+
+uint8_t sffv2Format(SyntheticCompression compression)
+{
+	switch (compression) {
+	case SyntheticCompression::Raw:
+		return 0;
+	case SyntheticCompression::Rle8:
+		return 2;
+	case SyntheticCompression::Rle5:
+		return 3;
+	case SyntheticCompression::Lz5:
+		return 4;
+	case SyntheticCompression::Png8:
+		return 10;
+	default:
+		throw std::runtime_error("PCX sprites only exist in SFFv1");
+	}
+}
+
+}
+
+SyntheticSff::SyntheticSff(const SyntheticSffOptions & options): m_options(options)
+{
+	if (m_options.version != 1 && m_options.version != 2)
+		throw std::runtime_error("The sprite file version must be 1 or 2");
+	if (m_options.compressions.empty() || !m_options.width || !m_options.height || m_options.width > 0xFFFF || m_options.height > 0xFFFF)
+		throw std::runtime_error("Invalid sprite options");
+	for (SyntheticCompression compression: m_options.compressions) {
+		if ((m_options.version == 1) != (compression == SyntheticCompression::Pcx))
+			throw std::runtime_error(std::string(name(compression)) + " sprites cannot go in a SFFv" + std::to_string(m_options.version));
+	}
+	std::mt19937 random(m_options.seed);
+	for (size_t i = 0; i < std::max<size_t>(m_options.palettes, 1); i++) {
+		std::vector<uint8_t> palette(3 * PALETTE_SIZE);
+		for (uint8_t & component: palette)
+			component = random();
+		m_palettes.push_back(palette);
+	}
+	for (size_t i = 0; i < m_options.sprites; i++) {
+		EncodedSprite sprite;
+		sprite.compression = m_options.compressions[i % m_options.compressions.size()];
+		sprite.width = m_options.width;
+		sprite.height = m_options.height;
+		const bool fewColors = sprite.compression == SyntheticCompression::Rle5 || sprite.compression == SyntheticCompression::Lz5;
+		const std::vector<uint8_t> pixels = makeImage(random, sprite.width, sprite.height, fewColors ? 32 : 256);
+		if (sprite.compression == SyntheticCompression::Pcx) {
+			// the first sprite, then one in eight, come with their palette
+			std::vector<uint8_t> ownPalette;
+			m_ownPalettes.push_back(i % 8 == 0);
+			if (m_ownPalettes.back()) {
+				ownPalette.resize(3 * PALETTE_SIZE);
+				for (uint8_t & component: ownPalette)
+					component = random();
+			}
+			sprite.data = encodePcx(pixels, sprite.width, sprite.height, m_ownPalettes.back() ? &ownPalette : nullptr);
+			m_sprites.push_back(std::move(sprite));
+			continue;
+		}
+		write_uint32(sprite.data, pixels.size());
+		switch (sprite.compression) {
+		case SyntheticCompression::Raw:
+			sprite.data.insert(sprite.data.end(), pixels.begin(), pixels.end());
+			break;
+		case SyntheticCompression::Rle8:
+			encodeRle8(pixels, sprite.data);
+			break;
+		case SyntheticCompression::Rle5:
+			encodeRle5(pixels, sprite.data);
+			break;
+		case SyntheticCompression::Lz5:
+			encodeLz5(pixels, sprite.width, sprite.data);
+			break;
+		case SyntheticCompression::Png8:
+			encodePng8(pixels, sprite.width, sprite.height, m_palettes[0], sprite.data);
+			break;
+		default:
+			break;
+		}
+		m_sprites.push_back(std::move(sprite));
+	}
+}
+
+std::vector<uint8_t> SyntheticSff::sffv1() const
+{
+	std::vector<uint8_t> out(512, 0);
+	memcpy(out.data(), "ElecbyteSpr", 12);
+	out[13] = 1;
+	out[15] = 1;
+	put_uint32(out, 16, (m_sprites.size() + 9) / 10);
+	put_uint32(out, 20, m_sprites.size());
+	put_uint32(out, 24, m_sprites.empty() ? 0 : out.size());
+	put_uint32(out, 28, 32);
+	// the sprites without a palette of their own use the shared one
+	out[32] = 1;
+	for (size_t i = 0; i < m_sprites.size(); i++) {
+		const EncodedSprite & sprite = m_sprites[i];
+		const size_t next = i + 1 < m_sprites.size() ? out.size() + 32 + sprite.data.size() : 0;
+		write_uint32(out, next);
+		write_uint32(out, sprite.data.size());
+		write_uint16(out, sprite.width / 2);
+		write_uint16(out, sprite.height);
+		write_uint16(out, i / 10);
+		write_uint16(out, i % 10);
+		write_uint16(out, 0);
+		out.push_back(m_ownPalettes[i] ? 0 : 1);
+		out.insert(out.end(), 13, 0);
+		out.insert(out.end(), sprite.data.begin(), sprite.data.end());
+	}
+	return out;
+}
+
+std::vector<uint8_t> SyntheticSff::sffv2() const
+{
+	const size_t headerSize = 512;
+	const size_t spriteNodeSize = 28;
+	const size_t paletteNodeSize = 16;
+	// the palettes and the raw sprites are literal data, the compressed sprites are translated data
+	std::vector<uint8_t> ldata;
+	std::vector<uint8_t> tdata;
+	std::vector<uint8_t> paletteNodes;
+	for (size_t i = 0; i < m_palettes.size(); i++) {
+		write_uint16(paletteNodes, 1);
+		write_uint16(paletteNodes, i);
+		write_uint16(paletteNodes, PALETTE_SIZE);
+		write_uint16(paletteNodes, 0);
+		write_uint32(paletteNodes, ldata.size());
+		write_uint32(paletteNodes, 4 * PALETTE_SIZE);
+		for (size_t color = 0; color < PALETTE_SIZE; color++) {
+			ldata.insert(ldata.end(), m_palettes[i].begin() + 3 * color, m_palettes[i].begin() + 3 * color + 3);
+			ldata.push_back(0);
+		}
+	}
+	std::vector<uint8_t> spriteNodes;
+	for (size_t i = 0; i < m_sprites.size(); i++) {
+		const EncodedSprite & sprite = m_sprites[i];
+		const bool translated = sprite.compression != SyntheticCompression::Raw;
+		std::vector<uint8_t> & block = translated ? tdata : ldata;
+		write_uint16(spriteNodes, i / 10);
+		write_uint16(spriteNodes, i % 10);
+		write_uint16(spriteNodes, sprite.width);
+		write_uint16(spriteNodes, sprite.height);
+		write_uint16(spriteNodes, sprite.width / 2);
+		write_uint16(spriteNodes, sprite.height);
+		write_uint16(spriteNodes, 0);
+		spriteNodes.push_back(sffv2Format(sprite.compression));
+		spriteNodes.push_back(8);
+		write_uint32(spriteNodes, block.size());
+		write_uint32(spriteNodes, sprite.data.size());
+		write_uint16(spriteNodes, 0);
+		write_uint16(spriteNodes, translated ? 1 : 0);
+		block.insert(block.end(), sprite.data.begin(), sprite.data.end());
+	}
+	std::vector<uint8_t> out(headerSize, 0);
+	memcpy(out.data(), "ElecbyteSpr", 12);
+	out[15] = 2;
+	out[27] = 2;
+	const size_t spriteOffset = headerSize;
+	const size_t paletteOffset = spriteOffset + spriteNodeSize * m_sprites.size();
+	const size_t ldataOffset = paletteOffset + paletteNodeSize * m_palettes.size();
+	const size_t tdataOffset = ldataOffset + ldata.size();
+	put_uint32(out, 36, spriteOffset);
+	put_uint32(out, 40, m_sprites.size());
+	put_uint32(out, 44, paletteOffset);
+	put_uint32(out, 48, m_palettes.size());
+	put_uint32(out, 52, ldataOffset);
+	put_uint32(out, 56, ldata.size());
+	put_uint32(out, 60, tdataOffset);
+	put_uint32(out, 64, tdata.size());
+	out.insert(out.end(), spriteNodes.begin(), spriteNodes.end());
+	out.insert(out.end(), paletteNodes.begin(), paletteNodes.end());
+	out.insert(out.end(), ldata.begin(), ldata.end());
+	out.insert(out.end(), tdata.begin(), tdata.end());
+	return out;
+}
+
+std::vector<std::string> SyntheticSff::write(const std::string & path) const
+{
+	auto writeFile = [](const std::string & filePath, const std::vector<uint8_t> & data) {
+		std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+		if (!file.write(reinterpret_cast<const char *>(data.data()), data.size()))
+			throw std::runtime_error("Cannot write " + filePath);
+	};
+	writeFile(path, m_options.version == 1 ? sffv1() : sffv2());
+	std::vector<std::string> paletteFiles;
+	if (m_options.version == 1) {
+		for (size_t i = 0; i < m_options.palettes; i++) {
+			paletteFiles.push_back(path + "." + std::to_string(i + 1) + ".act");
+			writeFile(paletteFiles.back(), m_palettes[i]);
+		}
+	}
+	return paletteFiles;
+}
+
+const char * SyntheticSff::name(SyntheticCompression compression)
+{
+	switch (compression) {
+	case SyntheticCompression::Pcx:
+		return "pcx";
+	case SyntheticCompression::Raw:
+		return "raw";
+	case SyntheticCompression::Rle8:
+		return "rle8";
+	case SyntheticCompression::Rle5:
+		return "rle5";
+	case SyntheticCompression::Lz5:
+		return "lz5";
+	case SyntheticCompression::Png8:
+		return "png8";
+	}
+	return "";
+}
+
+bool SyntheticSff::parse(const std::string & name, SyntheticCompression & compression)
+{
+	for (SyntheticCompression known: { SyntheticCompression::Pcx, SyntheticCompression::Raw, SyntheticCompression::Rle8, SyntheticCompression::Rle5, SyntheticCompression::Lz5, SyntheticCompression::Png8 }) {
+		if (name == SyntheticSff::name(known)) {
+			compression = known;
+			return true;
+		}
+	}
+	return false;
+}
+
+}
+}
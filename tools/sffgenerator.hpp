@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2016 Victor Nivet
+ *
+ * This file is part of Nugem.
+ *
+ * Nugem is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * Nugem is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ *  along with Nugem.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SFFGENERATOR_HPP
+#define SFFGENERATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Nugem {
+namespace Mugen {
+
+// Compression of the synthetic sprites: SFFv1 sprites are always PCX, the others are SFFv2 formats
+enum class SyntheticCompression {
+	Pcx,
+	Raw,
+	Rle8,
+	Rle5,
+	Lz5,
+	Png8
+};
+
+struct SyntheticSffOptions {
+	// 1 or 2
+	int version = 2;
+	size_t sprites = 200;
+	size_t width = 128;
+	size_t height = 128;
+	// SFFv2: palettes of the file; SFFv1: palette files written next to it
+	size_t palettes = 1;
+	// the sprites go through these in turn
+	std::vector<SyntheticCompression> compressions { SyntheticCompression::Rle8 };
+	uint32_t seed = 1;
+};
+
+/**
+ * Sprite files made up for benchmarks, the same for a given seed.
+ *
+ * The sprites look like the sprites of a game: a transparent border around a shape made of runs of a few colors,
+ * with repeated rows. RLE5 and LZ5 sprites only use 32 colors, as their format requires.
+ */
+class SyntheticSff {
+public:
+	struct EncodedSprite {
+		SyntheticCompression compression;
+		size_t width;
+		size_t height;
+		// as stored in the file: a whole PCX image, or the 4 bytes of uncompressed size and the compressed data
+		std::vector<uint8_t> data;
+	};
+	SyntheticSff(const SyntheticSffOptions & options);
+	const std::vector<EncodedSprite> & sprites() const { return m_sprites; };
+	// Writes the sprite file, and the palette files of a SFFv1 next to it.
+	// Returns the palette files; throws a runtime_error if a file cannot be written.
+	std::vector<std::string> write(const std::string & path) const;
+	static const char * name(SyntheticCompression compression);
+	// false if there is no compression of that name
+	static bool parse(const std::string & name, SyntheticCompression & compression);
+private:
+	std::vector<uint8_t> sffv1() const;
+	std::vector<uint8_t> sffv2() const;
+	SyntheticSffOptions m_options;
+	std::vector<EncodedSprite> m_sprites;
+	std::vector<std::vector<uint8_t>> m_palettes;
+	// sprites with a palette of their own, for SFFv1
+	std::vector<bool> m_ownPalettes;
+};
+
+}
+}
+
+#endif // SFFGENERATOR_HPP